@@ -0,0 +1,60 @@
+/*
+ * binlog.h
+ *
+ * Deferred binary logging. Instead of formatting text on the MCU, a call site
+ * records the address of its format string plus the raw argument words in a
+ * RAM ring. The format strings are placed in the .blog_fmt section, which is
+ * kept in the ELF but not loaded into flash. Tools/blog_decode.py rebuilds
+ * the text on the host from the ELF.
+ */
+
+#ifndef INC_BINLOG_H_
+#define INC_BINLOG_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32l4xx_hal.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+#ifndef BLOG_BUFFER_WORDS
+#define BLOG_BUFFER_WORDS 256		// Ring size in 32bit words, must be a power of 2
+#endif
+#define BLOG_MAX_ARGS 8
+#define BLOG_FRAME_MARKER 0x00		// Starts a record in the console stream, text never contains \0
+
+/* Macros --------------------------------------------------------------------*/
+/**
+ * Records a log message. Only integer and pointer arguments are supported,
+ * %s arguments are decoded on the host if they point to constant strings.
+ * Each argument is stored as one 32bit word, signed values sign extended.
+ */
+#define BLOG(fmt, ...)	do{\
+							static const char blogFmt[] __attribute__((section(".blog_fmt"), used)) = fmt;\
+							const uint32_t blogArgs[] = { 0 BLOG_ARGS(__VA_ARGS__) };\
+							blog_write((uint32_t)(uintptr_t) blogFmt, &blogArgs[1], sizeof(blogArgs)/sizeof(uint32_t) - 1);\
+						}while(0)
+
+// Converts each argument to a word, so pointers do not trigger -Wint-conversion
+#define BLOG_ARG(arg)					, (uint32_t)(uintptr_t)(arg)
+#define BLOG_ARGS(...)					BLOG_ARGS_N(BLOG_COUNT(__VA_ARGS__))(__VA_ARGS__)
+#define BLOG_ARGS_N(n)					BLOG_ARGS_SELECT(n)
+#define BLOG_ARGS_SELECT(n)				BLOG_ARGS_##n
+#define BLOG_ARGS_0(...)
+#define BLOG_ARGS_1(a)					BLOG_ARG(a)
+#define BLOG_ARGS_2(a, ...)				BLOG_ARG(a) BLOG_ARGS_1(__VA_ARGS__)
+#define BLOG_ARGS_3(a, ...)				BLOG_ARG(a) BLOG_ARGS_2(__VA_ARGS__)
+#define BLOG_ARGS_4(a, ...)				BLOG_ARG(a) BLOG_ARGS_3(__VA_ARGS__)
+#define BLOG_ARGS_5(a, ...)				BLOG_ARG(a) BLOG_ARGS_4(__VA_ARGS__)
+#define BLOG_ARGS_6(a, ...)				BLOG_ARG(a) BLOG_ARGS_5(__VA_ARGS__)
+#define BLOG_ARGS_7(a, ...)				BLOG_ARG(a) BLOG_ARGS_6(__VA_ARGS__)
+#define BLOG_ARGS_8(a, ...)				BLOG_ARG(a) BLOG_ARGS_7(__VA_ARGS__)
+#define BLOG_COUNT(...)					BLOG_COUNT_N(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define BLOG_COUNT_N(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...)	n
+
+/* Prototypes ----------------------------------------------------------------*/
+void blog_write(uint32_t id, const uint32_t* args, uint32_t nArgs);
+uint32_t blog_drain(uint32_t maxRecords);
+uint32_t blog_dropped_records(void);
+
+
+#endif /* INC_BINLOG_H_ */
@@ -21,6 +21,28 @@
 #define GETCHAR_PROTOTYPE int getc(FILE *f)
 #endif /* __GNUC__ */
 
+/**
+ * Console output buffering.
+ * printf writes into a ring buffer, which is drained in the background by the
+ * USART1 TX DMA. When the buffer is full, bytes are either dropped and counted
+ * or printf waits until the DMA has made room. The size must be a power of 2.
+ */
+#define CONSOLE_OVERFLOW_DROP	0
+#define CONSOLE_OVERFLOW_BLOCK	1
+
+#ifndef CONSOLE_TX_BUFFER_SIZE
+#define CONSOLE_TX_BUFFER_SIZE	512
+#endif
+#ifndef CONSOLE_OVERFLOW_POLICY
+#define CONSOLE_OVERFLOW_POLICY	CONSOLE_OVERFLOW_DROP
+#endif
+
+uint32_t console_dropped_bytes(void);
+uint8_t console_busy(void);
+uint32_t console_free(void);
+void console_process(void);
+void console_flush(void);
+
 /**
  * Hacks
  */
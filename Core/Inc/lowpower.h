@@ -0,0 +1,54 @@
+/*
+ * lowpower.h
+ *
+ * Idle hook for blocking waits. Instead of spinning, lowpower_wait() puts the
+ * MCU into Sleep for short waits and into Stop 2 for long ones. Any enabled
+ * interrupt wakes it up, e.g. EXTI1 of CMD_DATA_READY. The deadline of a
+ * Stop 2 wait is kept by LPTIM1 running from the LSI, since SysTick stops.
+ * After Stop 2 the PLL is switched on again and the HAL tick is advanced by
+ * the time spent in Stop 2.
+ */
+
+#ifndef INC_LOWPOWER_H_
+#define INC_LOWPOWER_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32l4xx_hal.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+#ifndef LOWPOWER_STOP2_THRESHOLD
+#define LOWPOWER_STOP2_THRESHOLD 20		// Minimum wait in ms for Stop 2, shorter waits use Sleep
+#endif
+#define LOWPOWER_MAX_STOP2 0xFFFF		// Longest Stop 2 period in ms (16bit LPTIM at 1 kHz)
+
+
+/* Structs -------------------------------------------------------------------*/
+typedef enum
+{
+  LOWPOWER_RUN = 0,
+  LOWPOWER_SLEEP,
+  LOWPOWER_STOP2,
+  LOWPOWER_MODE_COUNT
+} LOWPOWER_ModeTypeDef;
+
+typedef struct
+{
+  uint32_t entries[LOWPOWER_MODE_COUNT];
+  uint32_t residency[LOWPOWER_MODE_COUNT];	// ms spent waiting in each mode, RUN counts spinning
+  uint32_t wakeByCondition;
+  uint32_t wakeByDeadline;
+  uint32_t clockRestoreCycles;				// Cycles to restore the PLL after the last Stop 2
+} LOWPOWER_StatsTypeDef;
+
+
+/* Prototypes ----------------------------------------------------------------*/
+void lowpower_init(void);
+HAL_StatusTypeDef lowpower_wait(uint32_t timeout, FlagStatus (*condition)(void));
+void lowpower_delay(uint32_t delay);
+void lowpower_timer_irq(void);
+void lowpower_get_stats(LOWPOWER_StatsTypeDef* stats);
+void lowpower_dump(void);
+
+
+#endif /* INC_LOWPOWER_H_ */
@@ -0,0 +1,50 @@
+/*
+ * pool.h
+ *
+ * Lock-free pool of fixed-size packet buffers. The size classes are set at
+ * compile time with POOL_CLASSES, each class has up to 32 blocks whose usage
+ * is tracked in one bitmap word. Blocks are claimed and released with
+ * LDREX/STREX, so the pool can be used from interrupts, the driver and the
+ * application at the same time. A block is handed over by its pointer and is
+ * released by whoever owns it last.
+ */
+
+#ifndef INC_POOL_H_
+#define INC_POOL_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32l4xx_hal.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+/**
+ * Size classes as X(blockSize, blocks), ascending by block size. The block
+ * size must be a multiple of 4, blocks may be at most 32.
+ */
+#ifndef POOL_CLASSES
+#define POOL_CLASSES(X)	X(64, 8) X(256, 4) X(1024, 2)
+#endif
+
+
+/* Structs -------------------------------------------------------------------*/
+typedef struct
+{
+  uint16_t blockSize;
+  uint8_t blocks;
+  uint8_t used;
+  uint8_t highWater;		// Most blocks in use at once
+  uint32_t allocations;
+  uint32_t exhausted;		// Requests that did not find a free block in this class
+} POOL_StatsTypeDef;
+
+
+/* Prototypes ----------------------------------------------------------------*/
+void* pool_alloc(uint16_t size);
+void pool_free(void* block);
+uint16_t pool_block_size(const void* block);
+uint8_t pool_class_count(void);
+void pool_get_stats(uint8_t sizeClass, POOL_StatsTypeDef* stats);
+void pool_dump(void);
+
+
+#endif /* INC_POOL_H_ */
@@ -0,0 +1,86 @@
+/*
+ * profiler.h
+ *
+ * Scoped profiling with named probes. PROFILE_SCOPE(name) measures the time
+ * from its declaration to the end of the enclosing block, including early
+ * returns, and accumulates min/max/mean/count and a log2 histogram per probe.
+ * The cycle counter of the DWT runs freely and is never reset, so probes can
+ * be nested. Define PROFILER_ENABLED to compile the probes in, and
+ * PROFILER_HOST to use clock_gettime() (ns) instead of the DWT (cycles).
+ */
+
+#ifndef INC_PROFILER_H_
+#define INC_PROFILER_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+#ifdef PROFILER_HOST
+#include <time.h>
+#else
+#include "stm32l4xx_hal.h"
+#endif
+
+
+/* Defines -------------------------------------------------------------------*/
+#define PROFILER_MAX_PROBES 16
+#define PROFILER_HISTOGRAM_BUCKETS 24	// Bucket n counts durations in [2^(n-1), 2^n)
+#define PROFILER_NO_PROBE 0xFF
+
+
+/* Structs -------------------------------------------------------------------*/
+typedef struct
+{
+  const char* name;
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+  uint32_t histogram[PROFILER_HISTOGRAM_BUCKETS];
+} PROFILER_ProbeTypeDef;
+
+typedef struct
+{
+  uint8_t id;
+  uint32_t start;
+} PROFILER_ScopeTypeDef;
+
+
+/* Macros --------------------------------------------------------------------*/
+#ifdef PROFILER_ENABLED
+#define PROFILE_SCOPE(name)		static uint8_t profilerId_##name = PROFILER_NO_PROBE;\
+								PROFILER_ScopeTypeDef profilerScope_##name __attribute__((cleanup(profiler_scope_end))) =\
+									profiler_scope_begin(&profilerId_##name, #name)
+#else
+#define PROFILE_SCOPE(name)
+#endif
+
+
+/* Inline functions ----------------------------------------------------------*/
+/**
+ * @brief Free running counter, cycles on the target and ns on the host
+ * @return current counter value
+ */
+static inline uint32_t profiler_counter(void){
+#ifdef PROFILER_HOST
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)((uint64_t)now.tv_sec * 1000000000u + now.tv_nsec);
+#else
+	return DWT->CYCCNT;
+#endif
+}
+
+
+/* Prototypes ----------------------------------------------------------------*/
+void profiler_init(void);
+uint8_t profiler_register(const char* name);
+void profiler_record(uint8_t id, uint32_t duration);
+PROFILER_ScopeTypeDef profiler_scope_begin(uint8_t* id, const char* name);
+void profiler_scope_end(PROFILER_ScopeTypeDef* scope);
+const PROFILER_ProbeTypeDef* profiler_get_probe(uint8_t id);
+void profiler_reset(void);
+void profiler_dump(void);
+
+
+#endif /* INC_PROFILER_H_ */
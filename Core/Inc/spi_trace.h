@@ -0,0 +1,62 @@
+/*
+ * spi_trace.h
+ *
+ * Recorder for the raw SPI conversation with the module. Every transmitted
+ * and received frame is appended to a RAM ring together with a cycle
+ * timestamp and its direction, the oldest frames are overwritten. The ring
+ * can be dumped as text over the console or HTTP and be analysed with
+ * Tools/spi_trace.py. Define SPI_TRACE_ENABLED to compile the recorder in.
+ */
+
+#ifndef INC_SPI_TRACE_H_
+#define INC_SPI_TRACE_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32l4xx_hal.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+#ifndef SPI_TRACE_BUFFER_SIZE
+#define SPI_TRACE_BUFFER_SIZE 2048	// Ring size in bytes, must be a power of 2
+#endif
+#ifndef SPI_TRACE_MAX_PAYLOAD
+#define SPI_TRACE_MAX_PAYLOAD 64	// Bytes kept per frame, longer frames are truncated (max. 255)
+#endif
+#define SPI_TRACE_HEADER_SIZE 8
+
+
+/* Structs -------------------------------------------------------------------*/
+typedef enum
+{
+  SPI_TRACE_TX = 'T',
+  SPI_TRACE_RX = 'R'
+} SPI_TRACE_DirectionTypeDef;
+
+typedef struct
+{
+  uint32_t timestamp;		// DWT cycles
+  SPI_TRACE_DirectionTypeDef direction;
+  uint16_t length;			// Length on the bus
+  uint8_t storedLength;		// Bytes kept in the ring
+} SPI_TRACE_RecordTypeDef;
+
+
+/* Macros --------------------------------------------------------------------*/
+#ifdef SPI_TRACE_ENABLED
+#define SPI_TRACE(direction, data, length, tail, tailLength)	spi_trace_record(direction, data, length, tail, tailLength)
+#else
+#define SPI_TRACE(direction, data, length, tail, tailLength)
+#endif
+
+
+/* Prototypes ----------------------------------------------------------------*/
+void spi_trace_record(SPI_TRACE_DirectionTypeDef direction, const char* data, uint16_t length, const char* tail, uint16_t tailLength);
+void spi_trace_pause(FunctionalState state);
+uint32_t spi_trace_start(void);
+uint8_t spi_trace_read(uint32_t* cursor, SPI_TRACE_RecordTypeDef* record, uint8_t* data);
+uint32_t spi_trace_overwritten(void);
+void spi_trace_clear(void);
+void spi_trace_dump(void);
+
+
+#endif /* INC_SPI_TRACE_H_ */
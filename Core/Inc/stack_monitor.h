@@ -0,0 +1,77 @@
+/*
+ * stack_monitor.h
+ *
+ * Stack usage measurement by painting. stack_paint() fills the free stack
+ * with a pattern at boot, stack_high_water() finds the deepest word that was
+ * overwritten since. STACK_SCOPE(name) measures the peak depth of a call
+ * path against that paint without repainting: it scans a window below the
+ * caller for the deepest word used so far, and again when the enclosing block
+ * ends. A call that reaches below that baseline is measured exactly, a call
+ * that stays above it is only bounded by it. Scopes can be nested. Define
+ * STACK_MONITOR_ENABLED to compile the scopes in, and STACK_MONITOR_HOST for
+ * host builds, where stack_paint() paints twice the window below its caller
+ * and the high-water mark is not available.
+ */
+
+#ifndef INC_STACK_MONITOR_H_
+#define INC_STACK_MONITOR_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+#ifndef STACK_MONITOR_HOST
+#include "stm32l4xx_hal.h"
+#endif
+
+
+/* Defines -------------------------------------------------------------------*/
+#define STACK_PAINT_PATTERN 0xC5C5C5C5
+#define STACK_MAX_PROBES 16
+#define STACK_NO_PROBE 0xFF
+#ifndef STACK_MONITOR_WINDOW
+#define STACK_MONITOR_WINDOW 2048	// Bytes scanned below the outermost scope
+#endif
+#define STACK_MONITOR_GUARD 64		// Bytes kept free below the painting function
+
+
+/* Structs -------------------------------------------------------------------*/
+typedef struct
+{
+  const char* name;
+  uint32_t calls;
+  uint32_t measured;		// Calls that reached below the stack used before
+  uint32_t maxDepth;		// Bytes below the caller, deepest measured call
+  uint32_t maxBound;		// Bytes below the caller, upper bound of the other calls
+  uint32_t overflows;		// Calls that used the whole window
+} STACK_ProbeTypeDef;
+
+typedef struct
+{
+  uint8_t id;
+  uint8_t level;
+  uint8_t* top;
+  uint8_t* baseline;		// Deepest used word below the caller when the scope started
+} STACK_ScopeTypeDef;
+
+
+/* Macros --------------------------------------------------------------------*/
+#ifdef STACK_MONITOR_ENABLED
+#define STACK_SCOPE(name)		static uint8_t stackId_##name = STACK_NO_PROBE;\
+								STACK_ScopeTypeDef stackScope_##name __attribute__((cleanup(stack_scope_end))) =\
+									stack_scope_begin(&stackId_##name, #name)
+#else
+#define STACK_SCOPE(name)
+#endif
+
+
+/* Prototypes ----------------------------------------------------------------*/
+void stack_paint(void);
+uint32_t stack_high_water(void);
+uint32_t stack_size(void);
+STACK_ScopeTypeDef stack_scope_begin(uint8_t* id, const char* name);
+void stack_scope_end(STACK_ScopeTypeDef* scope);
+const STACK_ProbeTypeDef* stack_get_probe(uint8_t id);
+void stack_dump(void);
+
+
+#endif /* INC_STACK_MONITOR_H_ */
@@ -7,16 +7,63 @@
 
 #include "stm32l4xx_hal.h"
 #include "main.h"
+#include "profiler.h"
+#ifdef WIFI_USE_LOWPOWER
+#include "lowpower.h"
+#endif
 
 
 /* Defines -------------------------------------------------------------------*/
+/**
+ * RAM footprint profiles, selected with WIFI_FOOTPRINT.
+ * FULL:  separate TX and RX buffers, IP addresses and configuration strings
+ *        are kept as char arrays in the handle.
+ * SMALL: TX and RX share one buffer (half-duplex), IP addresses are stored as
+ *        uint32_t and configuration strings are pointers, e.g. to constants
+ *        in flash.
+ */
+#define WIFI_FOOTPRINT_FULL 0
+#define WIFI_FOOTPRINT_SMALL 1
+#ifndef WIFI_FOOTPRINT
+#define WIFI_FOOTPRINT WIFI_FOOTPRINT_FULL
+#endif
+
 #define WIFI_TIMEOUT_TIME 5000
-#define WIFI_TX_BUFFER_SIZE 1024
+#define WIFI_JOIN_TIMEOUT_TIME 15000	// ms C0 may take, it includes scan, authentication and DHCP
+#define WIFI_RESET_PULSE_TIME 10		// ms the reset line is held low
+#define WIFI_BOOT_TIMEOUT_TIME 2000		// ms from releasing reset until the power-up prompt
+#define WIFI_CONFIG_FLASH_ADDRESS 0x080FF800	// Last flash page, excluded from FLASH in the linker scripts
+#define WIFI_LINK_FLASH_ADDRESS 0x080FF000		// Page before, holds the cached BSSID and channel (WIFI_USE_TARGETED_JOIN)
+#define WIFI_CONFIG_FLASH_SIZE 0x800			// Size of either page
 #define WIFI_RX_BUFFER_SIZE 1024
+#if WIFI_FOOTPRINT == WIFI_FOOTPRINT_SMALL
+#define WIFI_TX_BUFFER_SIZE WIFI_RX_BUFFER_SIZE
+#else
+#define WIFI_TX_BUFFER_SIZE 1024
+#endif
 #define WIFI_MAX_READ_PACKET_SIZE 1200
 #define WIFI_READ_PACKET_SIZE ( WIFI_MAX_READ_PACKET_SIZE > WIFI_RX_BUFFER_SIZE ? WIFI_RX_BUFFER_SIZE : WIFI_MAX_READ_PACKET_SIZE )
 #define WIFI_READ_TIMEOUT 2000
+#define WIFI_MAX_READ_TIMEOUT ( WIFI_TIMEOUT_TIME - 1000 )	// Longest R2, so R0 answers within WIFI_TIMEOUT_TIME
 #define WIFI_POLLING_DELAY 200
+#define WIFI_MAX_SOCKETS 4
+#define WIFI_TCP_SOCKET 1				// Socket of WIFI_TCPConnect(), socket 0 serves the web server and MQTT
+#define WIFI_MAX_SEND_SIZE 1460			// Largest S3 payload the module accepts
+#define WIFI_SOCKET_NONE 0xFF
+#define WIFI_ASYNC_QUEUE_SIZE 4
+#define WIFI_ASYNC_RX_SIZE 256	// Pool block size for queued commands without response buffer (WIFI_USE_POOL)
+#define WIFI_METRICS_CHUNK_SIZE 128	// Bytes per S3 while streaming the metrics response
+#define WIFI_METRICS_PATH "/metrics"
+#define WIFI_TRACE_PATH "/trace"		// SPI trace dump, needs SPI_TRACE_ENABLED
+#define WIFI_DHCP_LEASE_TIME 3600		// s a cached DHCP lease is reused, the module does not report the lease time
+#define WIFI_POWER_IDLE_TIMEOUT 2000	// Default ms without commands until the policy enables power save
+#define WIFI_POWER_WAKE_LEAD 200		// Default ms the module is woken before a scheduled transfer
+#define WIFI_QUALITY_SAMPLE_INTERVAL 5000	// Default ms between link quality samples
+#define WIFI_QUALITY_WINDOW 16			// RSSI samples of the link quality window
+#define WIFI_ROAM_WEAK_SAMPLES 3		// Consecutive samples below the threshold until a roam scan
+#define WIFI_ROAM_BACKOFF_TIME 60000	// ms until a scan is repeated while the signal stays weak
+#define WIFI_ROAM_CANDIDATES 2			// Scan results kept, one of them may be the joined access point
+#define WIFI_RESPONSE_OVERHEAD 12	// "\r\n" before and "\r\nOK\r\n> " after the payload, \0 and word padding
 
 #define WIFI_TX_PADDING 0x0A
 #define WIFI_RX_PADDING 0x15
@@ -25,30 +72,122 @@
 #define WIFI_MSG_START "\r\n[SOMA]"
 #define WIFI_MSG_END "[EOMA]\r\nOK\r\n>"
 #define WIFI_MSG_EMPTY "\r\n[SOMA][EOMA]\r\nOK\r\n> "
+#define WIFI_MSG_STATUS_OK "OK"
+#define WIFI_MSG_STATUS_ERROR "ERROR"
+#define WIFI_MSG_PROMPT "> "
+#define WIFI_MSG_READ_END "\r\nOK\r\n> "	// Follows the payload of R0
+
+// Power management commands, the numbering follows the AT command set of the module firmware
+#define WIFI_CMD_POWER_SAVE "ZP="		// Power save level, see WIFI_PowerSaveTypeDef
+#define WIFI_CMD_LISTEN_INTERVAL "ZL="	// Number of DTIM beacons the module sleeps through
+#define WIFI_CMD_SAVE_SETTINGS "Z0"		// Saves the current settings as the user profile of the module
+
+// Targeted join, opt-in with WIFI_USE_TARGETED_JOIN. These commands are not confirmed against the AT reference
+// of the module firmware, in the ISM43362 command set CB and CN are the join retry count and the country code.
+#ifdef WIFI_USE_TARGETED_JOIN
+#define WIFI_CMD_JOIN_BSSID "CB="		// BSSID the next C0 joins, all zero joins by SSID
+#define WIFI_CMD_JOIN_CHANNEL "CN="		// Channel the next C0 joins, 0 scans all channels
+#define WIFI_CMD_LINK_INFO "CW"			// BSSID and channel of the joined access point
+#define WIFI_LINK_BSSID_FIELD 0
+#define WIFI_LINK_CHANNEL_FIELD 1
+#endif
+
+#define WIFI_CMD_SCAN "F0"
+#define WIFI_CMD_RSSI "CR"				// RSSI of the joined access point in dBm
+#define WIFI_CMD_CONNECTION_STATUS "CS"	// 1 while joined, else 0
+#define WIFI_CMD_DISCONNECT "CD"
+#define WIFI_CMD_NETWORK_SETTINGS "C?"	// Current network settings, including the ones assigned by DHCP
+#define WIFI_SETTINGS_MASK_FIELD 6
+#define WIFI_SETTINGS_GATEWAY_FIELD 7
+#define WIFI_SETTINGS_DNS_FIELD 8
+
+// Fields of a scan result line, e.g. #001,"ssid",AA:BB:CC:DD:EE:FF,-56,54.0,Infrastructure,WPA2 AES,2.4GHz,6
+#define WIFI_SCAN_SSID_FIELD 1
+#define WIFI_SCAN_BSSID_FIELD 2
+#define WIFI_SCAN_RSSI_FIELD 3
+#define WIFI_SCAN_SECURITY_FIELD 6
+#define WIFI_SCAN_CHANNEL_FIELD 8
+#define WIFI_SCAN_LINE_SIZE 128			// Longest result line, longer ones are skipped
+#define WIFI_SCAN_BLOCK_SIZE 32			// Bytes received at a time while the scan response is parsed
+#define WIFI_SSID_SIZE 33
+
+// Upper bounds in ms of the join time histogram, the last bucket takes the rest
+#define WIFI_JOIN_TIME_BUCKETS { 100, 250, 500, 1000, 2000, 5000 }
+#define WIFI_JOIN_TIME_BUCKET_COUNT 7
+
+#define WIFI_MAX_RESPONSE_FIELDS 16
+
+#define WIFI_CMD_PREFIX_MAX_LENGTH 5	// Longest command prefix, e.g. "PM=0,"
+#define WIFI_CMD_UINT_MAX_LENGTH 10		// Digits of the largest uint32_t
+#define WIFI_CMD_STRING_MAX_LENGTH 64	// Longest string argument, e.g. passphrase or MQTT topic
+#define WIFI_CMD_BUFFER_SIZE(argMaxLength) ( WIFI_CMD_PREFIX_MAX_LENGTH + (argMaxLength) + sizeof("\r") )
 
 /* Macros --------------------------------------------------------------------*/
-#define WIFI_RESET_MODULE()                 HAL_GPIO_WritePin(WIFI_RESET_GPIO_Port, WIFI_RESET_Pin, GPIO_PIN_RESET );\
-                                            HAL_Delay(10);\
-                                            HAL_GPIO_WritePin( WIFI_RESET_GPIO_Port, WIFI_RESET_Pin, GPIO_PIN_SET );\
-                                            HAL_Delay(500);
+#define WIFI_ASSERT_RESET()                 HAL_GPIO_WritePin( WIFI_RESET_GPIO_Port, WIFI_RESET_Pin, GPIO_PIN_RESET )
+#define WIFI_RELEASE_RESET()                HAL_GPIO_WritePin( WIFI_RESET_GPIO_Port, WIFI_RESET_Pin, GPIO_PIN_SET )
 
 
 #define WIFI_ENABLE_NSS()                   HAL_GPIO_WritePin( WIFI_NSS_GPIO_Port, WIFI_NSS_Pin, GPIO_PIN_RESET );\
-                                            HAL_Delay(10);
+                                            WIFI_DELAY(10)
 
 
 #define WIFI_DISABLE_NSS()                  HAL_GPIO_WritePin( WIFI_NSS_GPIO_Port, WIFI_NSS_Pin, GPIO_PIN_SET );\
-                                            HAL_Delay(10);
+                                            WIFI_DELAY(10)
 
 
 #define WIFI_IS_CMDDATA_READY()             (HAL_GPIO_ReadPin(WIFI_CMD_DATA_READY_GPIO_Port, WIFI_CMD_DATA_READY_Pin) == GPIO_PIN_SET)
 
+// WIFI_SPI_USE_HAL clocks received words through HAL_SPI_Receive() instead of the SPI registers (host builds)
+#ifdef WIFI_SPI_USE_HAL
+#define WIFI_READ_CMDDATA_READY()			WIFI_IS_CMDDATA_READY()
+#else
+#define WIFI_READ_CMDDATA_READY()			((WIFI_CMD_DATA_READY_GPIO_Port->IDR & WIFI_CMD_DATA_READY_Pin) != 0)
+#endif
+#define WIFI_SPI_DUMMY						0x0000	// Word clocked out while receiving, the module ignores it
+#define WIFI_SPI_SPIN_LIMIT					10000	// Status register polls before a word counts as lost
+
+// With WIFI_USE_LOWPOWER the driver waits in Sleep or Stop 2 instead of spinning.
+// WIFI_WAIT_CMDDATA_READY() gives up after WIFI_TIMEOUT_TIME ms and returns WIFI_TIMEOUT.
+#ifdef WIFI_USE_LOWPOWER
+#define WIFI_DELAY(ms)						lowpower_delay(ms);
+#define WIFI_WAIT_CMDDATA_READY()			((WIFI_StatusTypeDef) lowpower_wait(WIFI_TIMEOUT_TIME, WIFI_IsCmdDataReady))
+#else
 #define WIFI_DELAY(ms)						HAL_Delay(ms);
+#define WIFI_WAIT_CMDDATA_READY()			WIFI_WaitCmdDataReady(WIFI_TIMEOUT_TIME)
+#endif
+
+// Places a hot path in SRAM (.RamFunc, copied with .data), so it runs without flash wait states
+#ifdef WIFI_USE_RAMFUNC
+#define WIFI_RAMFUNC						__RAM_FUNC
+#else
+#define WIFI_RAMFUNC
+#endif
+
+// Adds the counter ticks since lap to counter and restarts lap
+#define WIFI_STATS_LAP(counter, lap)		do{ uint32_t now = profiler_counter(); (counter) += now - (lap); (lap) = now; }while(0)
+
+#define WIFI_IS_SOCKET_OPEN(hwifi, socket)	((((hwifi)->clientSockets | (hwifi)->serverSockets) & (1 << (socket))) != 0)
+
+// IPv4 address a.b.c.d as stored in WIFI_IPAddressTypeDef of the SMALL profile
+#define WIFI_IP(a, b, c, d)					((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define WIFI_IP_STRING_SIZE 16				// "255.255.255.255" including \0
+#define WIFI_BSSID_STRING_SIZE 18			// "AA:BB:CC:DD:EE:FF" including \0
+
+// Declares a configuration string of the handle, an array or a pointer depending on the profile
+#if WIFI_FOOTPRINT == WIFI_FOOTPRINT_SMALL
+#define WIFI_CONFIG_STRING(name, size)		const char* name
+#else
+#define WIFI_CONFIG_STRING(name, size)		char name[size]
+#endif
 
 
 /* Variables -----------------------------------------------------------------*/
-char wifiTxBuffer[WIFI_TX_BUFFER_SIZE];
-char wifiRxBuffer[WIFI_RX_BUFFER_SIZE];
+#if WIFI_FOOTPRINT == WIFI_FOOTPRINT_SMALL
+#define wifiTxBuffer wifiRxBuffer
+#else
+extern char wifiTxBuffer[WIFI_TX_BUFFER_SIZE];
+#endif
+extern char wifiRxBuffer[WIFI_RX_BUFFER_SIZE];
 
 
 /* Structs and Enums ---------------------------------------------------------*/
@@ -90,17 +229,324 @@ typedef enum {
   WIFI_MQTT_SECURITY_CERT
 }WIFI_MQTTSecurityTypeDef;
 
+typedef enum {
+  WIFI_SOCKET_CLIENT = 0,
+  WIFI_SOCKET_SERVER
+}WIFI_SocketRoleTypeDef;
+
+#if WIFI_FOOTPRINT == WIFI_FOOTPRINT_SMALL
+typedef uint32_t WIFI_IPAddressTypeDef;
+#else
+typedef char WIFI_IPAddressTypeDef[17];
+#endif
+
 typedef struct{
-	char publishTopic[64];
-	char subscribeTopic[64];
+	WIFI_CONFIG_STRING(publishTopic, 64);
+	WIFI_CONFIG_STRING(subscribeTopic, 64);
 	WIFI_MQTTSecurityTypeDef securityMode;
-	char userName[32];
-	char password[32];
-	char clientId[24];
+	WIFI_CONFIG_STRING(userName, 32);
+	WIFI_CONFIG_STRING(password, 32);
+	WIFI_CONFIG_STRING(clientId, 24);
 	uint16_t keepAlive;
 } WIFI_MQTTTypeDef;
 
-typedef struct
+typedef enum {
+  WIFI_CMD_CLASS_C = 0,		// Network commands, e.g. C0, C1
+  WIFI_CMD_CLASS_P,			// Transport commands except PM, e.g. P0, P6
+  WIFI_CMD_CLASS_PM,		// MQTT configuration
+  WIFI_CMD_CLASS_S3,		// Send data
+  WIFI_CMD_CLASS_R0,		// Read data
+  WIFI_CMD_CLASS_MR,		// Read MQTT/server messages
+  WIFI_CMD_CLASS_OTHER,
+  WIFI_CMD_CLASS_COUNT
+}WIFI_CmdClassTypeDef;
+
+typedef struct{
+	uint32_t count;
+	uint32_t errors;
+	uint32_t bytesTx;
+	uint32_t bytesRx;
+	uint64_t waitCycles;		// Waiting for CMD/DATA READY
+	uint64_t nssCycles;			// NSS setup and hold delays
+	uint64_t transferCycles;	// SPI transfer
+	uint64_t parseCycles;		// WIFI_ParseResponse()
+} WIFI_CmdStatsTypeDef;
+
+typedef struct{
+	WIFI_CmdStatsTypeDef cmd[WIFI_CMD_CLASS_COUNT];
+	uint32_t joins;
+	uint32_t joinErrors;
+	uint32_t profileJoins;		// Joins that used the saved profile of the module
+	uint32_t linkHits;			// Targeted joins to the cached BSSID and channel (WIFI_USE_TARGETED_JOIN)
+	uint32_t linkMisses;		// Targeted joins that fell back to a full scan (WIFI_USE_TARGETED_JOIN)
+	uint32_t joinTime[WIFI_JOIN_TIME_BUCKET_COUNT];	// Histogram of successful joins
+	uint32_t joinTimeSum;		// ms
+	uint32_t leaseJoins;		// Joins that reused a cached DHCP lease
+	uint32_t leaseRevalidations;	// Reused leases confirmed by a ping to the gateway
+	uint32_t leaseRejects;		// Reused leases whose gateway did not answer
+	uint16_t rxHighWater;		// Largest response in bytes
+	uint8_t queueHighWater;		// Most queued commands at once
+} WIFI_StatsTypeDef;
+
+typedef enum {
+  WIFI_POWERSAVE_OFF = 0,
+  WIFI_POWERSAVE_ON,			// 802.11 power save, the radio sleeps between beacons
+  WIFI_POWERSAVE_DEEP			// Radio and CPU of the module sleep between listen intervals
+}WIFI_PowerSaveTypeDef;
+
+typedef enum {
+  WIFI_POWER_AWAKE = 0,
+  WIFI_POWER_DOZING,
+  WIFI_POWER_WAKING				// Wake command sent, the module dozes until it answers OK
+}WIFI_PowerStateTypeDef;
+
+typedef struct{
+	uint32_t dozes;
+	uint32_t scheduledWakes;	// Woken ahead of a scheduled transfer, the wake latency was hidden
+	uint32_t demandWakes;		// Woken by a command, the command waited for the wake-up
+	uint32_t lastWakeLatency;	// Cycles from the wake command to the first response byte
+	uint32_t maxWakeLatency;
+	uint64_t sumWakeLatency;
+	uint32_t awakeTime;			// ms
+	uint32_t dozeTime;			// ms
+} WIFI_PowerStatsTypeDef;
+
+typedef struct{
+	WIFI_PowerSaveTypeDef level;	// Level the policy uses, WIFI_POWERSAVE_OFF disables the policy
+	uint32_t idleTimeout;
+	uint32_t wakeLead;
+	WIFI_PowerStateTypeDef state;
+	uint32_t stateSince;
+	uint32_t lastActivity;
+	FlagStatus wakeScheduled;
+	uint32_t wakeAt;
+	FlagStatus wakePending;
+	uint32_t wakeStart;
+	WIFI_PowerStatsTypeDef stats;
+} WIFI_PowerTypeDef;
+
+typedef enum {
+  WIFI_BOOT_IDLE = 0,			// No reset started
+  WIFI_BOOT_RESET,				// Reset line held low
+  WIFI_BOOT_WAIT_READY,			// Reset released, waiting for the power-up prompt
+  WIFI_BOOT_READY,				// Prompt received, WIFI_Init() may continue
+  WIFI_BOOT_RUNNING,			// WIFI_Init() completed
+  WIFI_BOOT_FAILED
+}WIFI_BootStateTypeDef;
+
+typedef struct{
+	WIFI_BootStateTypeDef state;
+	uint32_t resetTick;
+	uint32_t readyTime;			// ms from asserting reset until the power-up prompt
+	uint32_t firstCommandTick;	// HAL tick of the first AT command, i.e. ms since power-on
+} WIFI_BootTypeDef;
+
+typedef struct{
+	uint8_t bssid[6];
+	uint8_t channel;
+} WIFI_LinkTypeDef;
+
+typedef struct{
+	FlagStatus valid;
+	FlagStatus applied;			// The module is configured with the lease instead of DHCP
+	FlagStatus revalidate;		// WIFI_LeaseProcess() has to ping the gateway
+	uint32_t obtainedTick;
+	uint32_t leaseTime;			// s
+	WIFI_IPAddressTypeDef ipAddress;
+	WIFI_IPAddressTypeDef networkMask;
+	WIFI_IPAddressTypeDef defaultGateway;
+	WIFI_IPAddressTypeDef primaryDNSServer;
+} WIFI_LeaseTypeDef;
+
+typedef struct{
+	char ssid[WIFI_SSID_SIZE];
+	uint8_t bssid[6];
+	int8_t rssi;				// dBm
+	uint8_t channel;
+	WIFI_SecurityTypeTypeDef security;
+} WIFI_ScanResultTypeDef;
+
+typedef struct{
+	const char* ssid;			// Only access points of this SSID, NULL for all
+	int8_t minRssi;				// dBm, weaker access points are skipped
+} WIFI_ScanFilterTypeDef;
+
+typedef enum {
+  WIFI_ROAM_IDLE = 0,			// Waiting for weak RSSI samples
+  WIFI_ROAM_SCAN,				// Signal weak, a scan is due once the queue is empty
+  WIFI_ROAM_JOINING,			// Joining the stronger access point
+  WIFI_ROAM_REJOINING			// The candidate failed, rejoining the previous access point
+}WIFI_RoamStateTypeDef;
+
+typedef struct{
+	uint32_t scans;
+	uint32_t roams;
+	uint32_t failures;			// Roams whose join failed
+	uint32_t mismatches;		// Joins that landed on another access point than the candidate
+	uint32_t rejoinFailures;	// The previous access point was not rejoined either
+	uint32_t lastOffline;		// ms from the disconnect until the sockets were reopened
+	uint32_t maxOffline;
+	uint32_t sumOffline;
+} WIFI_RoamStatsTypeDef;
+
+typedef struct{
+	FlagStatus enabled;
+	int8_t threshold;			// dBm, a weaker signal starts a roam scan
+	uint8_t hysteresis;			// dB above the threshold until a new scan is armed
+	uint8_t margin;				// dB a candidate has to be stronger than the joined access point
+	WIFI_RoamStateTypeDef state;
+	FlagStatus armed;
+	uint8_t weakSamples;
+	int8_t rssi;				// Last sample in dBm
+	uint32_t scanTick;
+	uint32_t offlineTick;
+	uint8_t clientSockets;		// Sockets reopened after the roam
+	uint8_t serverSockets;
+	WIFI_RoamStatsTypeDef stats;
+} WIFI_RoamTypeDef;
+
+typedef struct{
+	uint32_t sampleInterval;	// ms, 0 disables the sampler
+	uint32_t sampleTick;
+	FlagStatus rssiPending;		// The status was sampled, the RSSI follows
+	FlagStatus connected;
+	int8_t window[WIFI_QUALITY_WINDOW];	// RSSI samples in dBm, oldest at head once full
+	uint8_t head;
+	uint8_t count;
+	uint32_t rssiSamples;
+	uint32_t statusSamples;
+	uint32_t disconnectedSamples;
+	uint32_t disconnects;		// Samples that found the module no longer joined
+} WIFI_QualityTypeDef;
+
+typedef struct{
+	uint8_t count;				// Samples in the window
+	int8_t min;					// dBm
+	int8_t max;					// dBm
+	int16_t mean;				// 0.1 dBm
+	int16_t trend;				// 0.1 dB per sample, least squares slope, negative while the signal fades
+	FlagStatus connected;
+} WIFI_QualityReportTypeDef;
+
+struct __WIFI_HandleTypeDef;
+
+/**
+ * Called when a queued command completed. With WIFI_USE_POOL, a response that
+ * was taken from the packet pool is owned by the callback and must be
+ * released with pool_free().
+ */
+typedef void (*WIFI_CallbackTypeDef)(struct __WIFI_HandleTypeDef* hwifi, WIFI_StatusTypeDef status, char* response, void* context);
+
+/**
+ * Reads the response of WIFI_Transaction() while NSS is asserted, e.g. with
+ * WIFI_SPI_ReceiveBlock() until CMD/DATA READY drops.
+ */
+typedef WIFI_StatusTypeDef (*WIFI_ReceiverTypeDef)(struct __WIFI_HandleTypeDef* hwifi, void* context);
+
+typedef enum {
+  WIFI_ASYNC_IDLE = 0,
+  WIFI_ASYNC_WAIT_TX,
+  WIFI_ASYNC_WAIT_RX
+}WIFI_AsyncStateTypeDef;
+
+typedef struct{
+	char cmd[WIFI_CMD_BUFFER_SIZE(WIFI_CMD_STRING_MAX_LENGTH)];
+	uint16_t sizeCmd;
+	const char* data;
+	uint16_t sizeData;
+	char* bRx;
+	uint16_t sizeRx;
+	FlagStatus pooled;			// bRx is a pool block
+	uint32_t timeout;			// ms from start until the response has to be complete
+	WIFI_CallbackTypeDef callback;
+	void* context;
+} WIFI_AsyncCommandTypeDef;
+
+typedef struct{
+	WIFI_AsyncCommandTypeDef queue[WIFI_ASYNC_QUEUE_SIZE];
+	uint8_t head;
+	uint8_t count;
+	WIFI_AsyncStateTypeDef state;
+	uint32_t startTick;
+	uint32_t lap;
+} WIFI_AsyncTypeDef;
+
+typedef enum {
+  WIFI_JOIN_CONFIGURING = 0,	// Network settings are sent to the module
+  WIFI_JOIN_SCANNING,			// C0 sent, the module scans for the SSID
+  WIFI_JOIN_AUTHENTICATING,		// C0 sent to the cached access point, no scan
+  WIFI_JOIN_DHCP,				// Joined, the addresses are known
+  WIFI_JOIN_CONNECTED,
+  WIFI_JOIN_FAILED
+}WIFI_JoinPhaseTypeDef;
+
+typedef enum {
+  WIFI_JOIN_REASON_NONE = 0,
+  WIFI_JOIN_REASON_PROFILE,			// Settings skipped, the saved profile of the module matches
+  WIFI_JOIN_REASON_CACHED_LINK,		// C0 restricted to the cached BSSID and channel
+  WIFI_JOIN_REASON_LINK_MISS,		// The cached access point was not joined, scanning
+  WIFI_JOIN_REASON_PROFILE_LOST,	// The saved profile did not join, configuring
+  WIFI_JOIN_REASON_LEASE,			// Cached DHCP lease reused
+  WIFI_JOIN_REASON_MODULE_ERROR,	// The module answered ERROR
+  WIFI_JOIN_REASON_TIMEOUT,
+  WIFI_JOIN_REASON_TRANSFER,		// SPI error or full command queue
+  WIFI_JOIN_REASON_NO_ADDRESS		// The join response carried no DHCP address
+}WIFI_JoinReasonTypeDef;
+
+typedef struct{
+	WIFI_JoinPhaseTypeDef phase;
+	WIFI_JoinReasonTypeDef reason;
+	uint32_t elapsed;			// ms since the join started
+	uint32_t duration;			// ms since the previous event
+} WIFI_JoinEventTypeDef;
+
+/**
+ * Called with the progress events of WIFI_JoinNetworkAsync() from within
+ * WIFI_Process(). A new join can be started once the callback returned.
+ */
+typedef void (*WIFI_JoinCallbackTypeDef)(struct __WIFI_HandleTypeDef* hwifi, const WIFI_JoinEventTypeDef* event, void* context);
+
+typedef enum {
+  WIFI_JOIN_STEP_IDLE = 0,
+  WIFI_JOIN_STEP_SSID,
+  WIFI_JOIN_STEP_PASSPHRASE,
+  WIFI_JOIN_STEP_SECURITY,
+  WIFI_JOIN_STEP_DHCP,
+  WIFI_JOIN_STEP_IP,
+  WIFI_JOIN_STEP_MASK,
+  WIFI_JOIN_STEP_GATEWAY,
+  WIFI_JOIN_STEP_DNS,
+  WIFI_JOIN_STEP_LEASE_DHCP,
+  WIFI_JOIN_STEP_LEASE_IP,
+  WIFI_JOIN_STEP_LEASE_MASK,
+  WIFI_JOIN_STEP_LEASE_GATEWAY,
+  WIFI_JOIN_STEP_LEASE_DNS,
+  WIFI_JOIN_STEP_BSSID,
+  WIFI_JOIN_STEP_CHANNEL,
+  WIFI_JOIN_STEP_CONNECT,
+  WIFI_JOIN_STEP_LINK_INFO,
+  WIFI_JOIN_STEP_SETTINGS,
+  WIFI_JOIN_STEP_SAVE
+}WIFI_JoinStepTypeDef;
+
+typedef struct{
+	WIFI_JoinStepTypeDef step;
+	FlagStatus profile;			// The saved profile of the module is used
+	FlagStatus configured;		// The settings were sent
+	FlagStatus targeted;		// C0 is restricted to the cached access point
+	FlagStatus pinned;			// C0 is restricted to the link of WIFI_JoinLinkAsync()
+	FlagStatus confirmed;		// CW reported the BSSID of the link of WIFI_JoinLinkAsync()
+	WIFI_LinkTypeDef link;
+	uint32_t fingerprint;
+	uint32_t startTick;
+	uint32_t eventTick;
+	WIFI_JoinReasonTypeDef reason;	// Reason of the next event
+	WIFI_StatusTypeDef result;
+	WIFI_JoinCallbackTypeDef callback;
+	void* context;
+} WIFI_JoinTypeDef;
+
+typedef struct __WIFI_HandleTypeDef
 {
   SPI_HandleTypeDef* handle;
   char* ssid;
@@ -111,26 +557,127 @@ typedef struct
   WIFI_TransportProtocolTypeDef transportProtocol;
   uint16_t port;
   uint16_t remotePort;
-  char ipAddress[17];
-  char remoteIpAddress[32];
-  char networkMask[17];
-  char defaultGateway[17];
-  char primaryDNSServer[17];
+  WIFI_IPAddressTypeDef ipAddress;
+  WIFI_CONFIG_STRING(remoteIpAddress, 32);	// Remote host name or IP address
+  WIFI_IPAddressTypeDef networkMask;
+  WIFI_IPAddressTypeDef defaultGateway;
+  WIFI_IPAddressTypeDef primaryDNSServer;
   WIFI_MQTTTypeDef mqtt;
+  uint8_t activeSocket;
+  uint8_t clientSockets;
+  uint8_t serverSockets;
+  uint16_t readPacketSize;
+  uint32_t readTimeout;
+  WIFI_AsyncTypeDef async;
+  WIFI_StatsTypeDef stats;
+  WIFI_PowerTypeDef power;
+  WIFI_BootTypeDef boot;
+  WIFI_LeaseTypeDef lease;
+  WIFI_JoinTypeDef join;
+  WIFI_RoamTypeDef roam;
+  WIFI_QualityTypeDef quality;
 } WIFI_HandleTypeDef;
 
+typedef enum
+{
+  WIFI_RESPONSE_OK = 0,
+  WIFI_RESPONSE_ERROR,
+  WIFI_RESPONSE_INCOMPLETE
+} WIFI_ResponseStatusTypeDef;
+
+typedef struct
+{
+  const char* start;
+  uint16_t length;
+} WIFI_FieldTypeDef;
+
+typedef struct
+{
+  WIFI_ResponseStatusTypeDef status;
+  const char* payload;
+  uint16_t payloadLength;
+  uint8_t fieldCount;
+  WIFI_FieldTypeDef fields[WIFI_MAX_RESPONSE_FIELDS];
+} WIFI_ResponseTypeDef;
+
 /* Prototypes ----------------------------------------------------------------*/
 WIFI_StatusTypeDef WIFI_SPI_Receive(WIFI_HandleTypeDef* hwifi, char* buffer, uint16_t size);
+WIFI_StatusTypeDef WIFI_SPI_ReceiveBlock(WIFI_HandleTypeDef* hwifi, char* buffer, uint16_t size, uint16_t* received);
 WIFI_StatusTypeDef WIFI_SPI_Transmit(WIFI_HandleTypeDef* hwifi, char* buffer, uint16_t size);
+WIFI_StatusTypeDef WIFI_SPI_TransmitData(WIFI_HandleTypeDef* hwifi, const char* header, uint16_t sizeHeader, const char* data, uint16_t sizeData);
 WIFI_StatusTypeDef WIFI_Init(WIFI_HandleTypeDef* hwifi);
+void WIFI_StartReset(WIFI_HandleTypeDef* hwifi);
+WIFI_StatusTypeDef WIFI_BootProcess(WIFI_HandleTypeDef* hwifi);
 WIFI_StatusTypeDef WIFI_SendATCommand(WIFI_HandleTypeDef* hwifi, char* hCmd, uint16_t sizeCmd, char* hRx, uint16_t sizeRx);
+WIFI_StatusTypeDef WIFI_SendATCommandData(WIFI_HandleTypeDef* hwifi, const char* bCmd, uint16_t sizeCmd, const char* data, uint16_t sizeData, char* bRx, uint16_t sizeRx);
+WIFI_StatusTypeDef WIFI_Transaction(WIFI_HandleTypeDef* hwifi, const char* bCmd, uint16_t sizeCmd, const char* data, uint16_t sizeData, WIFI_ReceiverTypeDef receiver, void* context);
+WIFI_StatusTypeDef WIFI_SendCommand(WIFI_HandleTypeDef* hwifi, const char* prefix);
+WIFI_StatusTypeDef WIFI_SendCommandUint(WIFI_HandleTypeDef* hwifi, const char* prefix, uint32_t value);
+WIFI_StatusTypeDef WIFI_SendCommandString(WIFI_HandleTypeDef* hwifi, const char* prefix, const char* value);
+WIFI_StatusTypeDef WIFI_SubmitATCommand(WIFI_HandleTypeDef* hwifi, const char* bCmd, uint16_t sizeCmd, const char* data, uint16_t sizeData, char* bRx, uint16_t sizeRx, WIFI_CallbackTypeDef callback, void* context);
+WIFI_StatusTypeDef WIFI_SubmitCommandUint(WIFI_HandleTypeDef* hwifi, const char* prefix, uint32_t value, WIFI_CallbackTypeDef callback, void* context);
+WIFI_StatusTypeDef WIFI_SubmitCommandString(WIFI_HandleTypeDef* hwifi, const char* prefix, const char* value, WIFI_CallbackTypeDef callback, void* context);
+WIFI_StatusTypeDef WIFI_Process(WIFI_HandleTypeDef* hwifi);
 WIFI_StatusTypeDef WIFI_CreateNewNetwork(WIFI_HandleTypeDef* hwifi);
 WIFI_StatusTypeDef WIFI_WebServerInit(WIFI_HandleTypeDef* hwifi);
 WIFI_StatusTypeDef WIFI_WebServerListen(WIFI_HandleTypeDef* hwifi);
 WIFI_StatusTypeDef WIFI_WebServerHandleRequest(WIFI_HandleTypeDef* hwifi, char* req, uint16_t sizeReq, char* res, uint16_t sizeRes);
 WIFI_StatusTypeDef WIFI_JoinNetwork(WIFI_HandleTypeDef* hwifi);
+WIFI_StatusTypeDef WIFI_JoinNetworkAsync(WIFI_HandleTypeDef* hwifi, WIFI_JoinCallbackTypeDef callback, void* context);
+WIFI_StatusTypeDef WIFI_JoinLinkAsync(WIFI_HandleTypeDef* hwifi, const WIFI_LinkTypeDef* link, WIFI_JoinCallbackTypeDef callback, void* context);
+uint32_t WIFI_ConfigFingerprint(WIFI_HandleTypeDef* hwifi);
+WIFI_StatusTypeDef WIFI_ConfigLoad(uint32_t* fingerprint);
+WIFI_StatusTypeDef WIFI_ConfigStore(uint32_t fingerprint);
+WIFI_StatusTypeDef WIFI_ConfigInvalidate(void);
+#ifdef WIFI_USE_TARGETED_JOIN
+WIFI_StatusTypeDef WIFI_LinkLoad(WIFI_LinkTypeDef* link);
+WIFI_StatusTypeDef WIFI_LinkStore(const WIFI_LinkTypeDef* link);
+WIFI_StatusTypeDef WIFI_LinkInvalidate(void);
+#endif
+WIFI_StatusTypeDef WIFI_LeaseProcess(WIFI_HandleTypeDef* hwifi);
+void WIFI_LeaseInvalidate(WIFI_HandleTypeDef* hwifi);
 WIFI_StatusTypeDef WIFI_MQTTClientInit(WIFI_HandleTypeDef* hwifi);
 WIFI_StatusTypeDef WIFI_MQTTPublish(WIFI_HandleTypeDef* hwifi, char* message, uint16_t sizeMessage);
+WIFI_StatusTypeDef WIFI_SocketOpen(WIFI_HandleTypeDef* hwifi, uint8_t socket, WIFI_SocketRoleTypeDef role);
+WIFI_StatusTypeDef WIFI_SocketClose(WIFI_HandleTypeDef* hwifi, uint8_t socket);
+WIFI_StatusTypeDef WIFI_SocketCloseAll(WIFI_HandleTypeDef* hwifi);
+WIFI_StatusTypeDef WIFI_SocketSend(WIFI_HandleTypeDef* hwifi, uint8_t socket, const char* data, uint16_t length);
+WIFI_StatusTypeDef WIFI_SocketReceive(WIFI_HandleTypeDef* hwifi, uint8_t socket, char* buffer, uint16_t size, uint16_t* received);
+WIFI_StatusTypeDef WIFI_SetReadPacketSize(WIFI_HandleTypeDef* hwifi, uint16_t size);
+WIFI_StatusTypeDef WIFI_SetReadTimeout(WIFI_HandleTypeDef* hwifi, uint32_t timeout);
+WIFI_StatusTypeDef WIFI_TCPConnect(WIFI_HandleTypeDef* hwifi, const char* host, uint16_t port);
+WIFI_StatusTypeDef WIFI_TCPClose(WIFI_HandleTypeDef* hwifi);
+WIFI_StatusTypeDef WIFI_Send(WIFI_HandleTypeDef* hwifi, const char* buffer, uint32_t length);
+WIFI_StatusTypeDef WIFI_Recv(WIFI_HandleTypeDef* hwifi, char* buffer, uint32_t length, uint32_t timeout, uint32_t* received);
+WIFI_StatusTypeDef WIFI_ParseResponse(const char* buffer, uint16_t size, WIFI_ResponseTypeDef* response);
+WIFI_StatusTypeDef WIFI_CopyField(const WIFI_ResponseTypeDef* response, uint8_t index, char* dst, uint16_t size);
+FlagStatus WIFI_PayloadContains(const WIFI_ResponseTypeDef* response, const char* token);
+void WIFI_GetStats(WIFI_HandleTypeDef* hwifi, WIFI_StatsTypeDef* stats);
+void WIFI_ResetStats(WIFI_HandleTypeDef* hwifi);
+uint32_t WIFI_StackHighWater(void);
+FlagStatus WIFI_IsCmdDataReady(void);
+WIFI_StatusTypeDef WIFI_WaitCmdDataReady(uint32_t timeout);
+WIFI_StatusTypeDef WIFI_SetPowerSave(WIFI_HandleTypeDef* hwifi, WIFI_PowerSaveTypeDef level);
+WIFI_StatusTypeDef WIFI_SetListenInterval(WIFI_HandleTypeDef* hwifi, uint8_t interval);
+void WIFI_PowerPolicyConfig(WIFI_HandleTypeDef* hwifi, WIFI_PowerSaveTypeDef level, uint32_t idleTimeout, uint32_t wakeLead);
+void WIFI_PowerSchedule(WIFI_HandleTypeDef* hwifi, uint32_t tick);
+WIFI_StatusTypeDef WIFI_PowerProcess(WIFI_HandleTypeDef* hwifi);
+WIFI_StatusTypeDef WIFI_PowerWake(WIFI_HandleTypeDef* hwifi);
+void WIFI_GetPowerStats(WIFI_HandleTypeDef* hwifi, WIFI_PowerStatsTypeDef* stats);
+uint16_t WIFI_IPToString(uint32_t ip, char* dst, uint16_t size);
+WIFI_StatusTypeDef WIFI_StringToIP(const char* src, uint16_t length, uint32_t* ip);
+uint16_t WIFI_BSSIDToString(const uint8_t* bssid, char* dst, uint16_t size);
+WIFI_StatusTypeDef WIFI_StringToBSSID(const char* src, uint16_t length, uint8_t* bssid);
+WIFI_StatusTypeDef WIFI_Scan(WIFI_HandleTypeDef* hwifi, const WIFI_ScanFilterTypeDef* filter, WIFI_ScanResultTypeDef* results, uint8_t size, uint8_t* count);
+WIFI_StatusTypeDef WIFI_RoamConfig(WIFI_HandleTypeDef* hwifi, int8_t threshold, uint8_t hysteresis, uint8_t margin);
+void WIFI_RoamSample(WIFI_HandleTypeDef* hwifi, int8_t rssi);
+WIFI_StatusTypeDef WIFI_RoamProcess(WIFI_HandleTypeDef* hwifi);
+void WIFI_QualityConfig(WIFI_HandleTypeDef* hwifi, uint32_t sampleInterval);
+WIFI_StatusTypeDef WIFI_QualityProcess(WIFI_HandleTypeDef* hwifi);
+void WIFI_GetQuality(WIFI_HandleTypeDef* hwifi, WIFI_QualityReportTypeDef* report);
+FlagStatus WIFI_IsHttpGet(const char* request, uint16_t length, const char* path);
+WIFI_StatusTypeDef WIFI_MetricsRespond(WIFI_HandleTypeDef* hwifi, uint8_t socket);
+WIFI_StatusTypeDef WIFI_TraceRespond(WIFI_HandleTypeDef* hwifi, uint8_t socket);
 void trimstr(char* str, uint32_t strSize, char c);
 
 
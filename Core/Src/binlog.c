@@ -0,0 +1,112 @@
+/* Includes ------------------------------------------------------------------*/
+#include "binlog.h"
+#include "helper_functions.h"
+
+
+/* Variables -----------------------------------------------------------------*/
+/**
+ * A record consists of a header word (format id in the lower 24 bits,
+ * argument count in the upper 8 bits), the tick and the arguments.
+ */
+static uint32_t blogRing[BLOG_BUFFER_WORDS];
+static volatile uint32_t blogHead = 0;
+static volatile uint32_t blogTail = 0;
+static volatile uint32_t blogDropped = 0;
+
+extern PUTCHAR_PROTOTYPE;
+
+
+/**
+  * @brief  Appends a record to the log ring. Can be called from interrupts,
+  * 		the ring is only locked for the few word copies.
+  * @param  id: Address of the format string in the .blog_fmt section
+  * @param  args: Argument words
+  * @param  nArgs: Number of arguments
+  * @retval None
+  */
+
+void blog_write(uint32_t id, const uint32_t* args, uint32_t nArgs){
+
+	uint32_t primask = __get_PRIMASK();
+	uint32_t head;
+
+	if(nArgs > BLOG_MAX_ARGS) nArgs = BLOG_MAX_ARGS;
+
+	__disable_irq();
+
+	head = blogHead;
+
+	// Drop the whole record if it does not fit, the ring keeps one word free
+	if(((blogTail - head - 1) & (BLOG_BUFFER_WORDS - 1)) < nArgs + 2){
+		blogDropped++;
+	}
+	else{
+		blogRing[head] = (id & 0x00FFFFFF) | (nArgs << 24);
+		head = (head + 1) & (BLOG_BUFFER_WORDS - 1);
+		blogRing[head] = HAL_GetTick();
+		head = (head + 1) & (BLOG_BUFFER_WORDS - 1);
+
+		for(uint32_t i = 0; i < nArgs; i++){
+			blogRing[head] = args[i];
+			head = (head + 1) & (BLOG_BUFFER_WORDS - 1);
+		}
+
+		blogHead = head;
+	}
+
+	__set_PRIMASK(primask);
+}
+
+
+/**
+  * @brief  Sends buffered records to the console, which writes them either
+  * 		over the USART1 DMA ring or over ITM (USE_ITM). Each record is
+  * 		framed by BLOG_FRAME_MARKER and its word count, so it can be
+  * 		interleaved with printf text. Only whole records that fit into
+  * 		the console ring are sent, so no frame loses bytes. Called by
+  * 		console_process() and console_flush().
+  * @param  maxRecords: Maximum number of records to send, 0 for all that fit
+  * @retval Number of sent records
+  */
+
+uint32_t blog_drain(uint32_t maxRecords){
+
+	uint32_t sent = 0;
+
+	while(blogTail != blogHead && (maxRecords == 0 || sent < maxRecords)){
+
+		uint32_t tail = blogTail;
+		uint32_t nWords = (blogRing[tail] >> 24) + 2;
+
+		if(console_free() < 2 + 4 * nWords) break;
+
+		__io_putchar(BLOG_FRAME_MARKER);
+		__io_putchar(nWords);
+
+		for(uint32_t i = 0; i < nWords; i++){
+			uint32_t word = blogRing[tail];
+
+			// Little endian, like the words are stored in the ELF
+			for(uint32_t j = 0; j < 4; j++){
+				__io_putchar((word >> (8 * j)) & 0xFF);
+			}
+			tail = (tail + 1) & (BLOG_BUFFER_WORDS - 1);
+		}
+
+		blogTail = tail;
+		sent++;
+	}
+
+	return sent;
+}
+
+
+/**
+  * @brief  Number of records that were dropped because the ring was full.
+  * @retval Dropped records since reset
+  */
+
+uint32_t blog_dropped_records(void){
+
+	return blogDropped;
+}
@@ -5,6 +5,7 @@
  */
 
 #include "helper_functions.h"
+#include "binlog.h"
  /**
   * external variables and defines
   */
@@ -24,8 +25,90 @@ volatile int32_t ITM_RxBuffer=ITM_RXBUFFER_EMPTY;
  */
 
 #ifndef USE_ITM
+	/**
+	 * Single producer ring buffer: head is only written by transmit_char,
+	 * tail only by the DMA completion. The DMA is claimed with an exclusive
+	 * access, so printf and the completion interrupt never both start it.
+	 */
+	static char txRing[CONSOLE_TX_BUFFER_SIZE];
+	static volatile uint32_t txHead = 0;
+	static volatile uint32_t txTail = 0;
+	static volatile uint32_t txLength = 0;
+	static volatile uint8_t txBusy = 0;
+	static volatile uint32_t txDropped = 0;
+
+	static void start_transmission(void){
+		uint32_t head;
+		uint32_t tail;
+
+		// Claim the DMA, only one context succeeds
+		do{
+			if(__LDREXB(&txBusy)){
+				__CLREX();
+				return;
+			}
+		}while(__STREXB(1, &txBusy));
+
+		head = txHead;
+		tail = txTail;
+
+		// Send the contiguous part up to the head or the end of the ring
+		txLength = (head >= tail) ? head - tail : CONSOLE_TX_BUFFER_SIZE - tail;
+
+		if(txLength == 0 || HAL_UART_Transmit_DMA(&UART_HANDLE, (uint8_t *)&txRing[tail], txLength) != HAL_OK){
+			// Nothing to send or UART not ready yet, the data is sent with the next char
+			txLength = 0;
+			txBusy = 0;
+		}
+	}
+
 	static void transmit_char(char ch){
-		HAL_UART_Transmit(&UART_HANDLE, (uint8_t *)&ch, 1, HAL_MAX_DELAY);
+		uint32_t head = txHead;
+		uint32_t next = (head + 1) & (CONSOLE_TX_BUFFER_SIZE - 1);
+
+		while(next == txTail){
+	#if CONSOLE_OVERFLOW_POLICY == CONSOLE_OVERFLOW_BLOCK
+			start_transmission();
+	#else
+			txDropped++;
+			return;
+	#endif
+		}
+
+		txRing[head] = ch;
+		__DMB();
+		txHead = next;
+
+		start_transmission();
+	}
+
+	void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart){
+		if(huart != &UART_HANDLE) return;
+
+		txTail = (txTail + txLength) & (CONSOLE_TX_BUFFER_SIZE - 1);
+		txLength = 0;
+		txBusy = 0;
+
+		// Continue with the data that was written in the meantime
+		start_transmission();
+	}
+
+	static uint32_t dropped_bytes(void){
+		return txDropped;
+	}
+
+	static uint8_t busy(void){
+		return txTail != txHead || txBusy;
+	}
+
+	static uint32_t free_bytes(void){
+		return (txTail - txHead - 1) & (CONSOLE_TX_BUFFER_SIZE - 1);
+	}
+
+	static void flush(void){
+		while(txTail != txHead || txBusy){
+			start_transmission();
+		}
 	}
 	static char receive_char(){
 		char ch;
@@ -41,6 +124,18 @@ volatile int32_t ITM_RxBuffer=ITM_RXBUFFER_EMPTY;
 		ch = (char)ITM_ReceiveChar();
 		return ch;
 	}
+	static uint32_t dropped_bytes(void){
+		return 0;
+	}
+	static uint8_t busy(void){
+		return 0;
+	}
+	static uint32_t free_bytes(void){
+		// ITM_SendChar waits for the stimulus port, so nothing is dropped
+		return UINT32_MAX;
+	}
+	static void flush(void){
+	}
 #endif
 /**
  * @brief PUTCHAR_PROTOTYPE function, called from printf
@@ -66,5 +161,47 @@ GETCHAR_PROTOTYPE{
 	return (int)ch;
 }
 
+/**
+ * @brief Number of console bytes that were dropped because the ring buffer was full
+ * @return dropped bytes since reset
+ */
+uint32_t console_dropped_bytes(void){
+	return dropped_bytes();
+}
+
+/**
+ * @brief Whether console output is still being sent, the USART must not be stopped then
+ * @return 1 if bytes are buffered or in flight, 0 otherwise
+ */
+uint8_t console_busy(void){
+	return busy();
+}
+
+/**
+ * @brief Number of bytes that fit into the console buffer without dropping or waiting
+ * @return free bytes
+ */
+uint32_t console_free(void){
+	return free_bytes();
+}
+
+/**
+ * @brief Sends pending binary log records (BLOG) over the console, as many as
+ * fit into the console buffer. Call it from the main loop.
+ */
+void console_process(void){
+	blog_drain(0);
+}
+
+/**
+ * @brief Waits until all buffered console output and log records were sent, e.g. before a reset
+ */
+void console_flush(void){
+	while(blog_drain(0) > 0){
+		flush();
+	}
+	flush();
+}
+
 
 
@@ -0,0 +1,245 @@
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+
+#include "lowpower.h"
+#include "helper_functions.h"
+#include "profiler.h"
+
+
+/* Variables -----------------------------------------------------------------*/
+static LOWPOWER_StatsTypeDef stats;
+static uint8_t initialised = 0;
+
+
+/* Private prototypes --------------------------------------------------------*/
+static void lowpower_sleep(void);
+static uint32_t lowpower_stop2(uint32_t period);
+static void lowpower_restore_clock(void);
+static uint32_t lowpower_timer_count(void);
+
+
+/**
+  * @brief  Starts the LSI and prepares LPTIM1 with a 1 kHz tick, so it can
+  * 		end a Stop 2 wait.
+  * @retval None
+  */
+
+void lowpower_init(void){
+
+	RCC->CSR |= RCC_CSR_LSION;
+	while(!(RCC->CSR & RCC_CSR_LSIRDY));
+
+	// LPTIM1 is clocked by the LSI (32 kHz / 32 = 1 kHz)
+	MODIFY_REG(RCC->CCIPR, RCC_CCIPR_LPTIM1SEL, RCC_CCIPR_LPTIM1SEL_0);
+	RCC->APB1ENR1 |= RCC_APB1ENR1_LPTIM1EN;
+	(void) RCC->APB1ENR1;
+
+	LPTIM1->CR = 0;
+	LPTIM1->CFGR = 5 << LPTIM_CFGR_PRESC_Pos;
+	LPTIM1->IER = LPTIM_IER_ARRMIE;
+
+	HAL_NVIC_SetPriority(LPTIM1_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(LPTIM1_IRQn);
+
+	// Keep the PLL source MSI after Stop 2, it is running again within a few us
+	CLEAR_BIT(RCC->CFGR, RCC_CFGR_STOPWUCK);
+
+	initialised = 1;
+}
+
+
+/**
+  * @brief  Waits until condition is true or the timeout expired, in the
+  * 		deepest mode that fits the remaining time. The condition is
+  * 		checked after every wake-up, so the event it waits for must raise
+  * 		an interrupt.
+  * @param  timeout: Timeout in ms
+  * @param  condition: Returns SET when the wait is over (may be NULL for a delay)
+  * @retval HAL_OK if the condition became true, HAL_TIMEOUT otherwise
+  */
+
+HAL_StatusTypeDef lowpower_wait(uint32_t timeout, FlagStatus (*condition)(void)){
+
+	uint32_t start = HAL_GetTick();
+	uint32_t elapsed;
+
+	while(1){
+		uint32_t now = HAL_GetTick();
+		LOWPOWER_ModeTypeDef mode;
+
+		elapsed = now - start;
+
+		// Checked with interrupts disabled, so a wake-up event between the check and WFI is not lost
+		__disable_irq();
+
+		if(condition != NULL && condition() == SET){
+			__enable_irq();
+			stats.wakeByCondition++;
+			return HAL_OK;
+		}
+		if(elapsed >= timeout){
+			__enable_irq();
+			if(condition != NULL) stats.wakeByDeadline++;
+			return HAL_TIMEOUT;
+		}
+
+		if(!initialised) mode = LOWPOWER_RUN;
+		else if(timeout - elapsed >= LOWPOWER_STOP2_THRESHOLD && !console_busy()) mode = LOWPOWER_STOP2;
+		else mode = LOWPOWER_SLEEP;
+
+		stats.entries[mode]++;
+
+		if(mode == LOWPOWER_STOP2){
+			uint32_t period = (timeout - elapsed > LOWPOWER_MAX_STOP2) ? LOWPOWER_MAX_STOP2 : timeout - elapsed;
+			uint32_t slept = lowpower_stop2(period);
+
+			// SysTick was stopped, so the HAL time is advanced by the LPTIM count
+			uwTick += slept;
+			stats.residency[mode] += slept;
+			__enable_irq();
+		}
+		else{
+			if(mode == LOWPOWER_SLEEP) lowpower_sleep();
+			__enable_irq();
+			stats.residency[mode] += HAL_GetTick() - now;
+		}
+	}
+}
+
+
+/**
+  * @brief  Replacement for HAL_Delay(), which idles instead of spinning.
+  * @param  delay: Delay in ms
+  * @retval None
+  */
+
+void lowpower_delay(uint32_t delay){
+
+	lowpower_wait(delay, NULL);
+}
+
+
+/**
+  * @brief  Handles the LPTIM1 interrupt, which ends a Stop 2 wait.
+  * @retval None
+  */
+
+void lowpower_timer_irq(void){
+
+	LPTIM1->ICR = LPTIM_ICR_ARRMCF;
+}
+
+
+/**
+  * @brief  Reads the residency statistics.
+  * @param  copy: Filled with the statistics
+  * @retval None
+  */
+
+void lowpower_get_stats(LOWPOWER_StatsTypeDef* copy){
+
+	__disable_irq();
+	memcpy(copy, &stats, sizeof(stats));
+	__enable_irq();
+}
+
+
+/**
+  * @brief  Prints the residency statistics to the console.
+  * @retval None
+  */
+
+void lowpower_dump(void){
+
+	static const char* const names[LOWPOWER_MODE_COUNT] = { "run", "sleep", "stop2" };
+
+	printf("%-8s %10s %12s\n", "mode", "entries", "residency ms");
+	for(uint8_t i = 0; i < LOWPOWER_MODE_COUNT; i++){
+		printf("%-8s %10lu %12lu\n", names[i], (unsigned long) stats.entries[i], (unsigned long) stats.residency[i]);
+	}
+	printf("wake by condition %lu, by deadline %lu, clock restore %lu cycles\n", (unsigned long) stats.wakeByCondition,
+			(unsigned long) stats.wakeByDeadline, (unsigned long) stats.clockRestoreCycles);
+}
+
+
+/**
+  * @brief  Enters Sleep until the next interrupt, SysTick wakes it up at
+  * 		the latest after 1 ms.
+  * @retval None
+  */
+
+static void lowpower_sleep(void){
+
+	HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
+}
+
+
+/**
+  * @brief  Enters Stop 2 until the next interrupt or until LPTIM1 reaches
+  * 		period. Must be called with interrupts disabled, they stay pending
+  * 		until the caller enables them again.
+  * @param  period: Maximum time in ms
+  * @retval Time spent in Stop 2 in ms
+  */
+
+static uint32_t lowpower_stop2(uint32_t period){
+
+	uint32_t slept;
+
+	// Start a single LPTIM1 period, ARR can only be written while enabled
+	LPTIM1->ICR = LPTIM_ICR_ARRMCF | LPTIM_ICR_ARROKCF;
+	LPTIM1->CR = LPTIM_CR_ENABLE;
+	LPTIM1->ARR = period;
+	while(!(LPTIM1->ISR & LPTIM_ISR_ARROK));
+	LPTIM1->CR = LPTIM_CR_ENABLE | LPTIM_CR_SNGSTRT;
+
+	HAL_SuspendTick();
+	HAL_PWREx_EnterSTOP2Mode(PWR_STOPENTRY_WFI);
+	lowpower_restore_clock();
+	HAL_ResumeTick();
+
+	slept = (LPTIM1->ISR & LPTIM_ISR_ARRM) ? period : lowpower_timer_count();
+	LPTIM1->CR = 0;
+
+	return slept;
+}
+
+
+/**
+  * @brief  Switches SYSCLK back to the PLL after Stop 2. The PLL settings
+  * 		are retained, so only the PLL is switched on again, which is much
+  * 		faster than SystemClock_Config().
+  * @retval None
+  */
+
+static void lowpower_restore_clock(void){
+
+	uint32_t start = profiler_counter();
+
+	SET_BIT(RCC->CR, RCC_CR_PLLON);
+	while(!(RCC->CR & RCC_CR_PLLRDY));
+
+	MODIFY_REG(RCC->CFGR, RCC_CFGR_SW, RCC_CFGR_SW_PLL);
+	while((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL);
+
+	stats.clockRestoreCycles = profiler_counter() - start;
+}
+
+
+/**
+  * @brief  Reads the LPTIM1 counter, which runs asynchronously, so it is read
+  * 		until two consecutive reads match.
+  * @retval Counter value in ms
+  */
+
+static uint32_t lowpower_timer_count(void){
+
+	uint32_t count;
+
+	do{
+		count = LPTIM1->CNT;
+	}while(count != LPTIM1->CNT);
+
+	return count;
+}
@@ -24,6 +24,9 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "wifi.h"
+#include "profiler.h"
+#include "stack_monitor.h"
+#include "helper_functions.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -48,6 +51,7 @@
 SPI_HandleTypeDef hspi3;
 
 UART_HandleTypeDef huart1;
+DMA_HandleTypeDef hdma_usart1_tx;
 
 /* USER CODE BEGIN PV */
 uint8_t txBuffer[TX_BUFFER_SIZE];
@@ -64,6 +68,7 @@ __IO FlagStatus cmdDataReady = 0;
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_SPI3_Init(void);
 static void MX_USART1_UART_Init(void);
 /* USER CODE BEGIN PFP */
@@ -83,6 +88,8 @@ int main(void)
 {
   /* USER CODE BEGIN 1 */
 
+  stack_paint();
+
   /* USER CODE END 1 */
 
   /* MCU Configuration--------------------------------------------------------*/
@@ -103,10 +110,16 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_SPI3_Init();
   MX_USART1_UART_Init();
   /* USER CODE BEGIN 2 */
 
+  // The module boots while the rest of the system is initialised
+  WIFI_StartReset(&hwifi);
+
+  profiler_init();
+
   WIFI_Init_main();
 
   WIFI_JoinNetwork(&hwifi);
@@ -120,6 +133,7 @@ int main(void)
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
+    console_process();
   }
   /* USER CODE END 3 */
 }
@@ -253,6 +267,22 @@ static void MX_USART1_UART_Init(void)
 
 }
 
+/** 
+  * Enable DMA controller clock
+  */
+static void MX_DMA_Init(void) 
+{
+
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  /* DMA interrupt init */
+  /* DMA1_Channel4_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel4_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+
+}
+
 /**
   * @brief GPIO Initialization Function
   * @param None
@@ -302,7 +332,7 @@ static void WIFI_Init_main(){
 	hwifi.transportProtocol = WIFI_TCP_PROTOCOL;
 	hwifi.port = 8080;
 
-	WIFI_Init(&hwifi);
+	if(WIFI_Init(&hwifi) != WIFI_OK) Error_Handler();
 }
 
 void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin){
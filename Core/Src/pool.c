@@ -0,0 +1,212 @@
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+
+#include "pool.h"
+
+
+/* Structs -------------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t* memory;
+  uint16_t blockSize;
+  uint8_t blocks;
+} POOL_ClassTypeDef;
+
+
+/* Variables -----------------------------------------------------------------*/
+#define POOL_MEMORY(size, n)	static uint32_t poolMemory##size[(size) / 4 * (n)];
+POOL_CLASSES(POOL_MEMORY)
+
+#define POOL_CLASS(size, n)		{ poolMemory##size, (size), (n) },
+static const POOL_ClassTypeDef poolClasses[] = { POOL_CLASSES(POOL_CLASS) };
+
+#define POOL_CLASS_COUNT (sizeof(poolClasses) / sizeof(poolClasses[0]))
+
+// Bit n is set while block n is in use
+static volatile uint32_t poolUsed[POOL_CLASS_COUNT];
+static volatile uint32_t poolHighWater[POOL_CLASS_COUNT];
+static volatile uint32_t poolAllocations[POOL_CLASS_COUNT];
+static volatile uint32_t poolExhausted[POOL_CLASS_COUNT];
+
+
+/* Private prototypes --------------------------------------------------------*/
+static void pool_atomic_increment(volatile uint32_t* counter);
+static void pool_atomic_max(volatile uint32_t* value, uint32_t candidate);
+static int8_t pool_find_class(const void* block, uint8_t* index);
+
+
+/**
+  * @brief  Claims a block of the smallest class that fits size. If that
+  * 		class is exhausted, the next larger class is tried.
+  * @param  size: Required size in bytes
+  * @retval Block, NULL if no class has a free block
+  */
+
+void* pool_alloc(uint16_t size){
+
+	for(uint8_t c = 0; c < POOL_CLASS_COUNT; c++){
+		const POOL_ClassTypeDef* sizeClass = &poolClasses[c];
+		uint32_t full = (sizeClass->blocks >= 32) ? 0xFFFFFFFF : (1UL << sizeClass->blocks) - 1;
+		uint32_t used;
+		uint8_t index;
+
+		if(sizeClass->blockSize < size) continue;
+
+		// Set the lowest free bit, retry if another context changed the bitmap meanwhile
+		do{
+			used = __LDREXW(&poolUsed[c]);
+			if(used == full){
+				__CLREX();
+				break;
+			}
+			index = __CLZ(__RBIT(~used));
+		}while(__STREXW(used | (1UL << index), &poolUsed[c]));
+
+		if(used == full){
+			pool_atomic_increment(&poolExhausted[c]);
+			continue;
+		}
+
+		pool_atomic_increment(&poolAllocations[c]);
+		pool_atomic_max(&poolHighWater[c], __builtin_popcount(used) + 1);
+
+		return &sizeClass->memory[index * (sizeClass->blockSize / 4)];
+	}
+
+	return NULL;
+}
+
+
+/**
+  * @brief  Returns a block to the pool.
+  * @param  block: Block from pool_alloc() (may be NULL)
+  * @retval None
+  */
+
+void pool_free(void* block){
+
+	uint8_t index;
+	int8_t c = pool_find_class(block, &index);
+	uint32_t used;
+
+	if(c < 0) return;
+
+	do{
+		used = __LDREXW(&poolUsed[c]);
+	}while(__STREXW(used & ~(1UL << index), &poolUsed[c]));
+}
+
+
+/**
+  * @brief  Usable size of a block.
+  * @param  block: Block from pool_alloc()
+  * @retval Block size in bytes, 0 if the block is not from the pool
+  */
+
+uint16_t pool_block_size(const void* block){
+
+	uint8_t index;
+	int8_t c = pool_find_class(block, &index);
+
+	return (c < 0) ? 0 : poolClasses[c].blockSize;
+}
+
+
+/**
+  * @brief  Number of size classes.
+  * @retval Number of classes in POOL_CLASSES
+  */
+
+uint8_t pool_class_count(void){
+
+	return POOL_CLASS_COUNT;
+}
+
+
+/**
+  * @brief  Reads the usage of a size class.
+  * @param  sizeClass: Class index, 0 is the smallest class
+  * @param  stats: Filled with the usage
+  * @retval None
+  */
+
+void pool_get_stats(uint8_t sizeClass, POOL_StatsTypeDef* stats){
+
+	memset(stats, 0, sizeof(*stats));
+
+	if(sizeClass >= POOL_CLASS_COUNT) return;
+
+	stats->blockSize = poolClasses[sizeClass].blockSize;
+	stats->blocks = poolClasses[sizeClass].blocks;
+	stats->used = __builtin_popcount(poolUsed[sizeClass]);
+	stats->highWater = poolHighWater[sizeClass];
+	stats->allocations = poolAllocations[sizeClass];
+	stats->exhausted = poolExhausted[sizeClass];
+}
+
+
+/**
+  * @brief  Prints the usage of all size classes.
+  * @retval None
+  */
+
+void pool_dump(void){
+
+	POOL_StatsTypeDef stats;
+
+	printf("%6s %6s %6s %6s %10s %10s\n", "size", "blocks", "used", "high", "allocs", "exhausted");
+
+	for(uint8_t c = 0; c < POOL_CLASS_COUNT; c++){
+		pool_get_stats(c, &stats);
+		printf("%6u %6u %6u %6u %10lu %10lu\n", stats.blockSize, stats.blocks, stats.used, stats.highWater,
+				(unsigned long) stats.allocations, (unsigned long) stats.exhausted);
+	}
+}
+
+
+static void pool_atomic_increment(volatile uint32_t* counter){
+
+	uint32_t current;
+
+	do{
+		current = __LDREXW(counter);
+	}while(__STREXW(current + 1, counter));
+}
+
+
+static void pool_atomic_max(volatile uint32_t* value, uint32_t candidate){
+
+	uint32_t current;
+
+	do{
+		current = __LDREXW(value);
+		if(current >= candidate){
+			__CLREX();
+			return;
+		}
+	}while(__STREXW(candidate, value));
+}
+
+
+/**
+  * @brief  Finds the class and block index of a block by its address.
+  * @param  block: Block from pool_alloc()
+  * @param  index: Filled with the block index in its class
+  * @retval Class index, -1 if the block is not from the pool
+  */
+
+static int8_t pool_find_class(const void* block, uint8_t* index){
+
+	for(uint8_t c = 0; c < POOL_CLASS_COUNT; c++){
+		const uint8_t* start = (const uint8_t*) poolClasses[c].memory;
+		const uint8_t* address = (const uint8_t*) block;
+
+		if(address >= start && address < start + poolClasses[c].blockSize * poolClasses[c].blocks){
+			*index = (address - start) / poolClasses[c].blockSize;
+			return c;
+		}
+	}
+
+	return -1;
+}
@@ -0,0 +1,178 @@
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+
+#include "profiler.h"
+
+
+/* Variables -----------------------------------------------------------------*/
+static PROFILER_ProbeTypeDef probes[PROFILER_MAX_PROBES];
+static uint8_t probeCount = 0;
+
+
+/**
+  * @brief  Starts the free running cycle counter. It is not reset, so other
+  * 		users of the DWT counter are not disturbed.
+  * @retval None
+  */
+
+void profiler_init(void){
+
+#ifndef PROFILER_HOST
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+
+
+/**
+  * @brief  Adds a probe to the statistics table. Probes are registered on
+  * 		their first use, so this must not race with an interrupt that
+  * 		registers a probe as well.
+  * @param  name: Probe name, must stay valid (usually a string literal)
+  * @retval Probe id, PROFILER_NO_PROBE if the table is full
+  */
+
+uint8_t profiler_register(const char* name){
+
+	PROFILER_ProbeTypeDef* probe;
+
+	if(probeCount >= PROFILER_MAX_PROBES) return PROFILER_NO_PROBE;
+
+	probe = &probes[probeCount];
+	memset(probe, 0, sizeof(*probe));
+	probe->name = name;
+	probe->min = UINT32_MAX;
+
+	return probeCount++;
+}
+
+
+/**
+  * @brief  Adds a measured duration to the statistics of a probe.
+  * @param  id: Probe id
+  * @param  duration: Duration in counter ticks
+  * @retval None
+  */
+
+void profiler_record(uint8_t id, uint32_t duration){
+
+	PROFILER_ProbeTypeDef* probe;
+	uint32_t bucket;
+
+	if(id >= probeCount) return;
+
+	probe = &probes[id];
+	probe->count++;
+	probe->sum += duration;
+	if(duration < probe->min) probe->min = duration;
+	if(duration > probe->max) probe->max = duration;
+
+	// The bucket is the number of significant bits of the duration
+	bucket = (duration == 0) ? 0 : 32 - __builtin_clz(duration);
+	if(bucket >= PROFILER_HISTOGRAM_BUCKETS) bucket = PROFILER_HISTOGRAM_BUCKETS - 1;
+	probe->histogram[bucket]++;
+}
+
+
+/**
+  * @brief  Starts a measurement, used by PROFILE_SCOPE().
+  * @param  id: Probe id of the call site, registered on the first call
+  * @param  name: Probe name
+  * @retval Scope, which is passed to profiler_scope_end()
+  */
+
+PROFILER_ScopeTypeDef profiler_scope_begin(uint8_t* id, const char* name){
+
+	PROFILER_ScopeTypeDef scope;
+
+	if(*id == PROFILER_NO_PROBE) *id = profiler_register(name);
+
+	scope.id = *id;
+	scope.start = profiler_counter();
+
+	return scope;
+}
+
+
+/**
+  * @brief  Ends a measurement, called automatically when a PROFILE_SCOPE()
+  * 		goes out of scope.
+  * @param  scope: Scope returned by profiler_scope_begin()
+  * @retval None
+  */
+
+void profiler_scope_end(PROFILER_ScopeTypeDef* scope){
+
+	// Unsigned subtraction handles one wrap of the counter
+	profiler_record(scope->id, profiler_counter() - scope->start);
+}
+
+
+/**
+  * @brief  Gives access to the statistics of a probe.
+  * @param  id: Probe id
+  * @retval Probe statistics, NULL if the id is unknown
+  */
+
+const PROFILER_ProbeTypeDef* profiler_get_probe(uint8_t id){
+
+	return (id < probeCount) ? &probes[id] : NULL;
+}
+
+
+/**
+  * @brief  Clears the statistics of all probes, the probes stay registered.
+  * @retval None
+  */
+
+void profiler_reset(void){
+
+	for(uint8_t i = 0; i < probeCount; i++){
+		const char* name = probes[i].name;
+		memset(&probes[i], 0, sizeof(probes[i]));
+		probes[i].name = name;
+		probes[i].min = UINT32_MAX;
+	}
+}
+
+
+/**
+  * @brief  Prints the statistics and histograms of all probes to the console.
+  * @retval None
+  */
+
+void profiler_dump(void){
+
+#ifdef PROFILER_HOST
+	const char* unit = "ns";
+#else
+	const char* unit = "cycles";
+#endif
+
+#ifndef PROFILER_HOST
+	// The cycle counts depend on the flash wait states and the ART accelerator
+	printf("flash latency %lu, prefetch %s, icache %s, dcache %s\n", (unsigned long)(FLASH->ACR & FLASH_ACR_LATENCY),
+			(FLASH->ACR & FLASH_ACR_PRFTEN) ? "on" : "off", (FLASH->ACR & FLASH_ACR_ICEN) ? "on" : "off",
+			(FLASH->ACR & FLASH_ACR_DCEN) ? "on" : "off");
+#endif
+
+	printf("%-24s %10s %10s %10s %10s (%s)\n", "probe", "count", "min", "mean", "max", unit);
+
+	for(uint8_t i = 0; i < probeCount; i++){
+		PROFILER_ProbeTypeDef* probe = &probes[i];
+
+		if(probe->count == 0){
+			printf("%-24s %10lu\n", probe->name, 0UL);
+			continue;
+		}
+
+		printf("%-24s %10lu %10lu %10lu %10lu\n", probe->name, (unsigned long) probe->count, (unsigned long) probe->min,
+				(unsigned long)(probe->sum / probe->count), (unsigned long) probe->max);
+
+		for(uint8_t j = 0; j < PROFILER_HISTOGRAM_BUCKETS; j++){
+			if(probe->histogram[j] == 0) continue;
+			printf("    < 2^%-2u %10lu\n", j, (unsigned long) probe->histogram[j]);
+		}
+	}
+}
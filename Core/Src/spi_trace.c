@@ -0,0 +1,184 @@
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+
+#include "spi_trace.h"
+#include "profiler.h"
+
+
+/* Variables -----------------------------------------------------------------*/
+/**
+ * A record consists of the timestamp (4 bytes, little endian), the direction,
+ * the bus length (2 bytes), the number of stored bytes and the stored bytes.
+ * The indices run freely and are masked on access, so a dump cursor can tell
+ * whether its record was overwritten in the meantime.
+ */
+static uint8_t traceRing[SPI_TRACE_BUFFER_SIZE];
+static uint32_t traceHead = 0;
+static uint32_t traceTail = 0;
+static uint32_t traceOverwritten = 0;
+static uint8_t tracePaused = 0;
+
+
+/* Private prototypes --------------------------------------------------------*/
+static void spi_trace_put(uint8_t byte);
+static uint8_t spi_trace_get(uint32_t index);
+
+
+/**
+  * @brief  Appends a frame to the trace ring and overwrites the oldest frames
+  * 		if there is not enough space. The frame may be given in two parts,
+  * 		e.g. a command header and its payload.
+  * @param  direction: SPI_TRACE_TX or SPI_TRACE_RX
+  * @param  data: First part of the frame
+  * @param  length: Length of the first part
+  * @param  tail: Second part of the frame (may be NULL)
+  * @param  tailLength: Length of the second part
+  * @retval None
+  */
+
+void spi_trace_record(SPI_TRACE_DirectionTypeDef direction, const char* data, uint16_t length, const char* tail, uint16_t tailLength){
+
+	uint32_t timestamp = profiler_counter();
+	uint8_t stored;
+
+	if(tracePaused) return;
+
+	stored = (length + tailLength > SPI_TRACE_MAX_PAYLOAD) ? SPI_TRACE_MAX_PAYLOAD : length + tailLength;
+
+	// Make room by dropping the oldest records
+	while(traceHead - traceTail + SPI_TRACE_HEADER_SIZE + stored > SPI_TRACE_BUFFER_SIZE){
+		traceTail += SPI_TRACE_HEADER_SIZE + spi_trace_get(traceTail + SPI_TRACE_HEADER_SIZE - 1);
+		traceOverwritten++;
+	}
+
+	for(uint8_t i = 0; i < 4; i++){
+		spi_trace_put(timestamp >> (8 * i));
+	}
+	spi_trace_put(direction);
+	spi_trace_put(length + tailLength);
+	spi_trace_put((length + tailLength) >> 8);
+	spi_trace_put(stored);
+
+	for(uint8_t i = 0; i < stored; i++){
+		spi_trace_put((i < length) ? data[i] : tail[i - length]);
+	}
+}
+
+
+/**
+  * @brief  Pauses the recording, e.g. while the trace is sent over the module.
+  * @param  state: ENABLE to pause, DISABLE to resume
+  * @retval None
+  */
+
+void spi_trace_pause(FunctionalState state){
+
+	tracePaused = (state == ENABLE);
+}
+
+
+/**
+  * @brief  Cursor of the oldest record in the ring.
+  * @retval Cursor for spi_trace_read()
+  */
+
+uint32_t spi_trace_start(void){
+
+	return traceTail;
+}
+
+
+/**
+  * @brief  Reads the record at the cursor and advances it. Records which were
+  * 		overwritten since the cursor was taken are skipped.
+  * @param  cursor: Cursor from spi_trace_start()
+  * @param  record: Record header
+  * @param  data: Buffer for at least SPI_TRACE_MAX_PAYLOAD bytes
+  * @retval 1 if a record was read, 0 at the end of the trace
+  */
+
+uint8_t spi_trace_read(uint32_t* cursor, SPI_TRACE_RecordTypeDef* record, uint8_t* data){
+
+	uint32_t index;
+
+	if((int32_t)(*cursor - traceTail) < 0) *cursor = traceTail;
+	if(*cursor == traceHead) return 0;
+
+	index = *cursor;
+
+	record->timestamp = 0;
+	for(uint8_t i = 0; i < 4; i++){
+		record->timestamp |= (uint32_t) spi_trace_get(index++) << (8 * i);
+	}
+	record->direction = spi_trace_get(index++);
+	record->length = spi_trace_get(index++);
+	record->length |= spi_trace_get(index++) << 8;
+	record->storedLength = spi_trace_get(index++);
+
+	for(uint8_t i = 0; i < record->storedLength; i++){
+		data[i] = spi_trace_get(index++);
+	}
+
+	*cursor = index;
+
+	return 1;
+}
+
+
+/**
+  * @brief  Number of records that were overwritten before they were dumped.
+  * @retval Overwritten records since reset
+  */
+
+uint32_t spi_trace_overwritten(void){
+
+	return traceOverwritten;
+}
+
+
+/**
+  * @brief  Discards all records.
+  * @retval None
+  */
+
+void spi_trace_clear(void){
+
+	traceTail = traceHead;
+}
+
+
+/**
+  * @brief  Prints the trace to the console. Each record is printed as
+  * 		"<timestamp> <T|R> <length> <hex bytes>", the first line holds the
+  * 		core clock, so the host can convert the cycles to time.
+  * @retval None
+  */
+
+void spi_trace_dump(void){
+
+	SPI_TRACE_RecordTypeDef record;
+	uint8_t data[SPI_TRACE_MAX_PAYLOAD];
+	uint32_t cursor = spi_trace_start();
+
+	printf("# spi trace %lu Hz, %lu overwritten\n", (unsigned long) SystemCoreClock, (unsigned long) traceOverwritten);
+
+	while(spi_trace_read(&cursor, &record, data)){
+		printf("%lu %c %u ", (unsigned long) record.timestamp, record.direction, record.length);
+		for(uint8_t i = 0; i < record.storedLength; i++){
+			printf("%02x", data[i]);
+		}
+		printf("\n");
+	}
+}
+
+
+static void spi_trace_put(uint8_t byte){
+
+	traceRing[traceHead++ & (SPI_TRACE_BUFFER_SIZE - 1)] = byte;
+}
+
+
+static uint8_t spi_trace_get(uint32_t index){
+
+	return traceRing[index & (SPI_TRACE_BUFFER_SIZE - 1)];
+}
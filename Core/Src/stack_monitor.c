@@ -0,0 +1,241 @@
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+
+#include "stack_monitor.h"
+
+
+/* Variables -----------------------------------------------------------------*/
+static STACK_ProbeTypeDef probes[STACK_MAX_PROBES];
+static uint8_t probeCount = 0;
+
+// Window scanned by the scopes, set by the outermost one
+static uint32_t* windowBottom = NULL;
+static uint8_t level = 0;
+
+#ifndef STACK_MONITOR_HOST
+// Defined by the linker script
+extern uint32_t _end;
+extern uint32_t _estack;
+extern uint32_t _Min_Heap_Size;
+
+// Lowest stack word, the reserved heap lies below
+#define STACK_FLOOR		((uint32_t*)((uint8_t*) &_end + (uintptr_t) &_Min_Heap_Size))
+#endif
+
+
+/* Private prototypes --------------------------------------------------------*/
+static uint8_t* stack_pointer(void);
+static void stack_fill(uint32_t* bottom, uint32_t* top);
+static uint8_t* stack_scan(uint32_t* bottom, uint32_t* top);
+static uint8_t stack_register(const char* name);
+
+
+/**
+  * @brief  Paints the free stack between the reserved heap and the current
+  * 		stack pointer. Should be called first thing in main(). A heap that
+  * 		grows beyond _Min_Heap_Size shows up as stack usage, which makes
+  * 		stack/heap collisions visible before malloc fails. On the host, twice
+  * 		the STACK_MONITOR_WINDOW below the caller is painted for the scopes.
+  * @retval None
+  */
+
+__attribute__((noinline)) void stack_paint(void){
+
+#ifndef STACK_MONITOR_HOST
+	stack_fill(STACK_FLOOR, (uint32_t*)(stack_pointer() - STACK_MONITOR_GUARD));
+#else
+	uint8_t* sp = stack_pointer();
+
+	// Twice the window, so it also covers the windows of scopes in deeper frames
+	stack_fill((uint32_t*)(((uintptr_t) sp - 2 * STACK_MONITOR_WINDOW) & ~(uintptr_t) 3), (uint32_t*)(sp - STACK_MONITOR_GUARD));
+#endif
+}
+
+
+/**
+  * @brief  Deepest stack usage since stack_paint(), including interrupts.
+  * @retval Used bytes below _estack, 0 on the host
+  */
+
+uint32_t stack_high_water(void){
+
+#ifndef STACK_MONITOR_HOST
+	return (uint8_t*) &_estack - stack_scan(STACK_FLOOR, (uint32_t*)(stack_pointer() - STACK_MONITOR_GUARD));
+#else
+	return 0;
+#endif
+}
+
+
+/**
+  * @brief  Stack size available after the reserved heap.
+  * @retval Bytes between the reserved heap and _estack, 0 on the host
+  */
+
+uint32_t stack_size(void){
+
+#ifndef STACK_MONITOR_HOST
+	return (uint8_t*) &_estack - (uint8_t*) STACK_FLOOR;
+#else
+	return 0;
+#endif
+}
+
+
+/**
+  * @brief  Starts a measurement, used by STACK_SCOPE(). The outermost scope
+  * 		sets the window below it. Nothing is painted, the scope only
+  * 		remembers the deepest word of the window that was used since
+  * 		stack_paint(), so the high-water mark is kept.
+  * @param  id: Probe id of the call site, registered on the first call
+  * @param  name: Probe name
+  * @retval Scope, which is passed to stack_scope_end()
+  */
+
+__attribute__((noinline)) STACK_ScopeTypeDef stack_scope_begin(uint8_t* id, const char* name){
+
+	STACK_ScopeTypeDef scope;
+	uint8_t* sp = stack_pointer();
+
+	if(*id == STACK_NO_PROBE) *id = stack_register(name);
+
+	if(level == 0){
+		windowBottom = (uint32_t*)(((uintptr_t) sp - STACK_MONITOR_WINDOW) & ~(uintptr_t) 3);
+#ifndef STACK_MONITOR_HOST
+		// Never scan into the heap
+		if(windowBottom < STACK_FLOOR) windowBottom = STACK_FLOOR;
+#endif
+	}
+
+	scope.id = *id;
+	scope.level = level++;
+	scope.top = sp;
+	scope.baseline = stack_scan(windowBottom, (uint32_t*)(sp - STACK_MONITOR_GUARD));
+
+	return scope;
+}
+
+
+/**
+  * @brief  Ends a measurement, called automatically when a STACK_SCOPE()
+  * 		goes out of scope. Only the stack below the baseline is scanned,
+  * 		since everything above it was already used before the scope.
+  * @param  scope: Scope returned by stack_scope_begin()
+  * @retval None
+  */
+
+__attribute__((noinline)) void stack_scope_end(STACK_ScopeTypeDef* scope){
+
+	uint8_t* lowest = stack_scan(windowBottom, (uint32_t*) scope->baseline);
+	STACK_ProbeTypeDef* probe;
+
+	level = scope->level;
+
+	if(scope->id >= probeCount) return;
+
+	probe = &probes[scope->id];
+	probe->calls++;
+
+	if(lowest < scope->baseline){
+		// The scope used stack that was untouched before, so its depth is exact
+		probe->measured++;
+		if((uint32_t)(scope->top - lowest) > probe->maxDepth) probe->maxDepth = scope->top - lowest;
+	}
+	else if((uint32_t)(scope->top - scope->baseline) > probe->maxBound){
+		probe->maxBound = scope->top - scope->baseline;
+	}
+
+	if(lowest <= (uint8_t*) windowBottom) probe->overflows++;
+}
+
+
+/**
+  * @brief  Gives access to the statistics of a probe.
+  * @param  id: Probe id
+  * @retval Probe statistics, NULL if the id is unknown
+  */
+
+const STACK_ProbeTypeDef* stack_get_probe(uint8_t id){
+
+	return (id < probeCount) ? &probes[id] : NULL;
+}
+
+
+/**
+  * @brief  Prints the high-water mark and the peak depth of all probes to the
+  * 		console. Depths marked with ! used the whole window and are lower
+  * 		bounds, increase STACK_MONITOR_WINDOW for them. The bound is the
+  * 		most the calls could have used that stayed within stack used
+  * 		before them.
+  * @retval None
+  */
+
+void stack_dump(void){
+
+	printf("stack high water %lu of %lu bytes\n", (unsigned long) stack_high_water(), (unsigned long) stack_size());
+	printf("%-24s %10s %10s %10s %10s\n", "probe", "calls", "measured", "max depth", "bound");
+
+	for(uint8_t i = 0; i < probeCount; i++){
+		printf("%-24s %10lu %10lu %10lu%s %10lu\n", probes[i].name, (unsigned long) probes[i].calls,
+				(unsigned long) probes[i].measured, (unsigned long) probes[i].maxDepth,
+				probes[i].overflows ? "!" : "", (unsigned long) probes[i].maxBound);
+	}
+}
+
+
+static inline __attribute__((always_inline)) uint8_t* stack_pointer(void){
+
+#ifdef STACK_MONITOR_HOST
+	return __builtin_frame_address(0);
+#else
+	return (uint8_t*)(uintptr_t) __get_MSP();
+#endif
+}
+
+
+/**
+  * @brief  Paints [bottom, top) with the pattern. Must not use the stack
+  * 		below the guard, so no library call is used.
+  * @param  bottom: Lowest word
+  * @param  top: Word above the last painted word
+  * @retval None
+  */
+
+static void stack_fill(uint32_t* bottom, uint32_t* top){
+
+	for(volatile uint32_t* word = bottom; word < top; word++){
+		*word = STACK_PAINT_PATTERN;
+	}
+}
+
+
+/**
+  * @brief  Finds the lowest word in [bottom, top) that lost the pattern.
+  * @param  bottom: Lowest word
+  * @param  top: Word above the last painted word
+  * @retval Address of that word, top if the range is untouched
+  */
+
+static uint8_t* stack_scan(uint32_t* bottom, uint32_t* top){
+
+	volatile uint32_t* word = bottom;
+
+	while(word < top && *word == STACK_PAINT_PATTERN) word++;
+
+	return (uint8_t*) word;
+}
+
+
+static uint8_t stack_register(const char* name){
+
+	if(probeCount >= STACK_MAX_PROBES) return STACK_NO_PROBE;
+
+	probes[probeCount].name = name;
+	probes[probeCount].calls = 0;
+	probes[probeCount].measured = 0;
+	probes[probeCount].maxDepth = 0;
+	probes[probeCount].maxBound = 0;
+	probes[probeCount].overflows = 0;
+
+	return probeCount++;
+}
@@ -1,7 +1,152 @@
 /* Includes ------------------------------------------------------------------*/
+#include <stdlib.h>
+
 #include "wifi.h"
+#include "binlog.h"
 #include "helper_functions.h"
+#include "profiler.h"
+#include "spi_trace.h"
+#include "stack_monitor.h"
+#ifdef WIFI_USE_POOL
+#include "pool.h"
+#endif
+
+/* Variables -----------------------------------------------------------------*/
+#if WIFI_FOOTPRINT != WIFI_FOOTPRINT_SMALL
+char wifiTxBuffer[WIFI_TX_BUFFER_SIZE];
+#endif
+char wifiRxBuffer[WIFI_RX_BUFFER_SIZE];
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct{
+	char* buffer;
+	uint16_t size;
+} WIFI_RxBufferTypeDef;
+
+typedef struct{
+	char* buffer;
+	uint16_t size;			// Read packet size that is set, i.e. the longest payload
+	uint16_t received;		// Number of payload bytes
+} WIFI_PayloadTypeDef;
+
+/* Private variables ---------------------------------------------------------*/
+// Statistics of the command in flight, the receive and parse times are added to it
+static WIFI_CmdStatsTypeDef* currentStats = NULL;
+
+/* Private prototypes --------------------------------------------------------*/
+static WIFI_StatusTypeDef WIFI_SPI_ReceiveWords(WIFI_HandleTypeDef* hwifi, char* buffer, uint16_t size, uint16_t* received);
+static WIFI_StatusTypeDef WIFI_ReceiveResponse(WIFI_HandleTypeDef* hwifi, void* context);
+static uint8_t WIFI_MatchPrefix(const char* str, const char* prefix, uint16_t length);
+static void WIFI_SplitResponse(const char* buffer, uint16_t size, WIFI_ResponseTypeDef* response);
+static FlagStatus WIFI_IsPayloadEmpty(const WIFI_ResponseTypeDef* response);
+static uint16_t WIFI_FormatCommand(char* bCmd, uint16_t size, const char* prefix, const char* arg, uint16_t argLength);
+static uint16_t WIFI_FormatCommandUint(char* bCmd, uint16_t size, const char* prefix, uint32_t value);
+static WIFI_StatusTypeDef WIFI_SelectSocket(WIFI_HandleTypeDef* hwifi, uint8_t socket);
+static WIFI_StatusTypeDef WIFI_ReceivePayload(WIFI_HandleTypeDef* hwifi, char* buffer, uint16_t size, uint16_t* received);
+static WIFI_StatusTypeDef WIFI_PayloadReceive(WIFI_HandleTypeDef* hwifi, void* context);
+static WIFI_StatusTypeDef WIFI_CopyIPField(const WIFI_ResponseTypeDef* response, uint8_t index, WIFI_IPAddressTypeDef* ip);
+static WIFI_CmdStatsTypeDef* WIFI_StartStats(WIFI_HandleTypeDef* hwifi, const char* bCmd, uint16_t sizeTx);
+static WIFI_AsyncCommandTypeDef* WIFI_AllocateAsyncCommand(WIFI_HandleTypeDef* hwifi, const char* data, uint16_t sizeData, char* bRx, uint16_t sizeRx, WIFI_CallbackTypeDef callback, void* context);
+static void WIFI_ReleaseAsyncCommand(WIFI_AsyncCommandTypeDef* slot);
+static WIFI_StatusTypeDef WIFI_JoinParseIP(WIFI_HandleTypeDef* hwifi, WIFI_ResponseTypeDef* response);
+static WIFI_StatusTypeDef WIFI_JoinStart(WIFI_HandleTypeDef* hwifi, const WIFI_LinkTypeDef* link, WIFI_JoinCallbackTypeDef callback, void* context);
+static WIFI_StatusTypeDef WIFI_JoinSubmit(WIFI_HandleTypeDef* hwifi);
+static void WIFI_JoinCompleted(WIFI_HandleTypeDef* hwifi, WIFI_StatusTypeDef status, char* response, void* context);
+static WIFI_JoinStepTypeDef WIFI_JoinNextStep(WIFI_HandleTypeDef* hwifi, WIFI_JoinReasonTypeDef reason, WIFI_ResponseTypeDef* response);
+static WIFI_JoinStepTypeDef WIFI_JoinConnected(WIFI_HandleTypeDef* hwifi, WIFI_JoinReasonTypeDef reason, WIFI_ResponseTypeDef* response);
+static WIFI_JoinStepTypeDef WIFI_JoinLeaseStep(WIFI_HandleTypeDef* hwifi);
+static WIFI_JoinStepTypeDef WIFI_JoinLinkStep(WIFI_HandleTypeDef* hwifi);
+static WIFI_JoinStepTypeDef WIFI_JoinAddressStep(WIFI_HandleTypeDef* hwifi);
+static WIFI_JoinStepTypeDef WIFI_JoinSaveStep(WIFI_HandleTypeDef* hwifi);
+static WIFI_JoinStepTypeDef WIFI_JoinFinish(WIFI_HandleTypeDef* hwifi, WIFI_StatusTypeDef status, WIFI_JoinReasonTypeDef reason);
+static void WIFI_JoinPost(WIFI_HandleTypeDef* hwifi, WIFI_JoinPhaseTypeDef phase);
+static WIFI_StatusTypeDef WIFI_JoinSubmitString(WIFI_HandleTypeDef* hwifi, const char* prefix, const char* value, uint32_t timeout);
+static WIFI_StatusTypeDef WIFI_JoinSubmitUint(WIFI_HandleTypeDef* hwifi, const char* prefix, uint32_t value);
+static WIFI_StatusTypeDef WIFI_JoinSubmitIP(WIFI_HandleTypeDef* hwifi, const char* prefix, const WIFI_IPAddressTypeDef* ip);
+#ifdef WIFI_USE_TARGETED_JOIN
+static WIFI_StatusTypeDef WIFI_JoinParseLink(const WIFI_ResponseTypeDef* response, WIFI_LinkTypeDef* link);
+#endif
+static void WIFI_JoinRecordTime(WIFI_HandleTypeDef* hwifi, uint32_t start);
+static void WIFI_LeaseCapture(WIFI_HandleTypeDef* hwifi, const WIFI_ResponseTypeDef* response);
+static void WIFI_LeaseRevalidated(WIFI_HandleTypeDef* hwifi, WIFI_StatusTypeDef status, char* response, void* context);
+
+
+/**
+  * @brief  Clocks 16bit words from the module into buffer as long as it
+  * 		holds CMD/DATA READY. The SPI and GPIO registers are accessed
+  * 		directly, so the loop does not call into flash.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  buffer: A char buffer, where the received data will be saved in.
+  * 		NULL discards the words.
+  * @param  size: Buffer size, ignored if buffer is NULL
+  * @param  received: Number of bytes clocked in
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_RAMFUNC static WIFI_StatusTypeDef WIFI_SPI_ReceiveWords(WIFI_HandleTypeDef* hwifi, char* buffer, uint16_t size, uint16_t* received){
+
+	WIFI_StatusTypeDef status = WIFI_OK;
+	uint16_t cnt = 0;
+	uint16_t word = 0;
+#ifndef WIFI_SPI_USE_HAL
+	SPI_TypeDef* spi = hwifi->handle->Instance;
+	uint32_t spin = 0;
+
+	// Drop stale words from the RX FIFO, the transfer is clocked by the dummy writes below
+	while(spi->SR & SPI_SR_FRLVL) word = *(volatile uint16_t*) &spi->DR;
+	spi->CR1 |= SPI_CR1_SPE;
+#endif
+
+	while((buffer == NULL || cnt + 2 <= size) && WIFI_READ_CMDDATA_READY())
+	{
+#ifdef WIFI_SPI_USE_HAL
+		if(HAL_SPI_Receive(hwifi->handle, (uint8_t*) &word, 1, WIFI_TIMEOUT) != HAL_OK){
+			status = WIFI_ERROR;
+			break;
+		}
+#else
+		for(spin = 0; !(spi->SR & SPI_SR_TXE) && spin < WIFI_SPI_SPIN_LIMIT; spin++);
+		*(volatile uint16_t*) &spi->DR = WIFI_SPI_DUMMY;
+		for(spin = 0; !(spi->SR & SPI_SR_RXNE) && spin < WIFI_SPI_SPIN_LIMIT; spin++);
+		if(spin == WIFI_SPI_SPIN_LIMIT){
+			status = WIFI_TIMEOUT;
+			break;
+		}
+		word = *(volatile uint16_t*) &spi->DR;
+#endif
+		if(buffer != NULL){
+			buffer[cnt] = (char) (word & 0xFF);
+			buffer[cnt + 1] = (char) (word >> 8);
+		}
+		cnt += 2;
+	}
+
+	*received = cnt;
+	return status;
+}
+
+
+/**
+  * @brief  Receives up to size bytes over the defined SPI interface as they
+  * 		come, without terminating or trimming them. Called until CMD/DATA
+  * 		READY drops, it streams a response of any length.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  buffer: A char buffer, where the received data will be saved in.
+  * @param  size: Buffer size, only whole 16bit words are received
+  * @param  received: Number of received bytes
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SPI_ReceiveBlock(WIFI_HandleTypeDef* hwifi, char* buffer, uint16_t size, uint16_t* received){
+
+	WIFI_StatusTypeDef status = WIFI_SPI_ReceiveWords(hwifi, buffer, size, received);
+
+	SPI_TRACE(SPI_TRACE_RX, buffer, *received, NULL, 0);
 
+	if(currentStats != NULL) currentStats->bytesRx += *received;
+
+	return status;
+}
 
 
 /**
@@ -10,28 +155,35 @@
   * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
   * @param  buffer: A char buffer, where the received data will be saved in.
   * @param  size: Buffer size
-  * @retval WIFI_StatusTypeDef
+  * @retval WIFI_ERROR if the data does not fit into buffer
   */
 
 WIFI_StatusTypeDef WIFI_SPI_Receive(WIFI_HandleTypeDef* hwifi, char* buffer, uint16_t size){
 
+	WIFI_StatusTypeDef status = WIFI_ERROR;
 	uint16_t cnt = 0;
-	memset(buffer, '\0', size); // Erase buffer
+	uint16_t dropped = 0;
+	PROFILE_SCOPE(WIFI_SPI_Receive);
 
-	while (WIFI_IS_CMDDATA_READY())
-	{
-		// Fill buffer as long there is still space
-		if ( (cnt > (size - 2)) || (HAL_SPI_Receive(hwifi->handle , (uint8_t*) buffer + cnt, 1, WIFI_TIMEOUT) != HAL_OK) )
-		  {
-			Error_Handler();
-		  }
-		cnt+=2;
+	if(size == 0) return WIFI_ERROR;
+
+	// Keep room for the terminator
+	status = WIFI_SPI_ReceiveBlock(hwifi, buffer, size - 1, &cnt);
+	buffer[cnt] = '\0';
+
+	// Let the module finish a response that does not fit
+	if(status == WIFI_OK && WIFI_IS_CMDDATA_READY()){
+		WIFI_SPI_ReceiveWords(hwifi, NULL, 0, &dropped);
+		if(currentStats != NULL) currentStats->bytesRx += dropped;
+		status = WIFI_ERROR;
 	}
 
+	if(cnt + dropped > hwifi->stats.rxHighWater) hwifi->stats.rxHighWater = cnt + dropped;
+
 	// Trim padding chars from data
-	trimstr(buffer, size, (char) WIFI_RX_PADDING);
+	trimstr(buffer, cnt + 1, (char) WIFI_RX_PADDING);
 
-	return WIFI_OK;
+	return status;
 }
 
 
@@ -46,49 +198,192 @@ WIFI_StatusTypeDef WIFI_SPI_Receive(WIFI_HandleTypeDef* hwifi, char* buffer, uin
 
 WIFI_StatusTypeDef WIFI_SPI_Transmit(WIFI_HandleTypeDef* hwifi, char* buffer, uint16_t size){
 
-	char bTx[(size/2)*2 + 1]; // Make a buffer that has an even amount of bytes (even is meant for the chars excluding \0)
-	snprintf( bTx, size, buffer ); // Copy buffer in bTx
+	return WIFI_SPI_TransmitData(hwifi, buffer, size - 1, NULL, 0);
+}
+
+
+/**
+  * @brief  Sends a command header followed by a payload over the defined SPI
+  * 		interface without copying them into a common buffer. Since the
+  * 		module is clocked in 16bit words, a header with an odd length is
+  * 		bridged with the first payload byte and an odd tail is padded.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  header: A char buffer, which contains the command header.
+  * @param  sizeHeader: Number of header bytes (excluding \0)
+  * @param  data: A char buffer, which contains the payload (may be NULL).
+  * @param  sizeData: Number of payload bytes
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SPI_TransmitData(WIFI_HandleTypeDef* hwifi, const char* header, uint16_t sizeHeader, const char* data, uint16_t sizeData){
+
+	char bridge[2];
+	PROFILE_SCOPE(WIFI_SPI_Transmit);
+
+	SPI_TRACE(SPI_TRACE_TX, header, sizeHeader, data, sizeData);
+
+	// Send the even part of the header directly from the caller's buffer
+	if(sizeHeader >= 2 && HAL_SPI_Transmit(hwifi->handle, (uint8_t*) header, sizeHeader/2, WIFI_TIMEOUT) != HAL_OK) return WIFI_ERROR;
 
-	if ( !(size % 2) ) strcat(bTx, (char) WIFI_TX_PADDING); // If buffer had an odd amount of bytes, append a filler char to bTx
+	// Bridge an odd header with the first payload byte
+	if(sizeHeader % 2){
+		bridge[0] = header[sizeHeader - 1];
+		bridge[1] = (sizeData > 0) ? *data : (char) WIFI_TX_PADDING;
+		if(sizeData > 0){
+			data++;
+			sizeData--;
+		}
+		if(HAL_SPI_Transmit(hwifi->handle, (uint8_t*) bridge, 1, WIFI_TIMEOUT) != HAL_OK) return WIFI_ERROR;
+	}
 
-	if (HAL_SPI_Transmit(hwifi->handle, (uint8_t*)bTx, size/2, WIFI_TIMEOUT) != HAL_OK) // size must be halved since 16bits are sent via SPI
-	  {
-		Error_Handler();
-	  }
+	// Send the even part of the payload directly from the caller's buffer
+	if(sizeData >= 2 && HAL_SPI_Transmit(hwifi->handle, (uint8_t*) data, sizeData/2, WIFI_TIMEOUT) != HAL_OK) return WIFI_ERROR;
+
+	// Pad an odd payload tail
+	if(sizeData % 2){
+		bridge[0] = data[sizeData - 1];
+		bridge[1] = (char) WIFI_TX_PADDING;
+		if(HAL_SPI_Transmit(hwifi->handle, (uint8_t*) bridge, 1, WIFI_TIMEOUT) != HAL_OK) return WIFI_ERROR;
+	}
 
 	return WIFI_OK;
 }
 
 
 /**
-  * @brief  Resets and initialises the Wifi module.
+  * @brief  Asserts the reset of the Wifi module and returns immediately. It
+  * 		should be called early, so the boot of the module overlaps with
+  * 		the rest of the system initialisation. WIFI_BootProcess() or
+  * 		WIFI_Init() complete the boot.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval None
+  */
+
+void WIFI_StartReset(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_ASSERT_RESET();
+
+	hwifi->boot.state = WIFI_BOOT_RESET;
+	hwifi->boot.resetTick = HAL_GetTick();
+	hwifi->boot.readyTime = 0;
+	hwifi->boot.firstCommandTick = 0;
+}
+
+
+/**
+  * @brief  Advances the boot of the Wifi module without blocking. The reset
+  * 		is released after WIFI_RESET_PULSE_TIME, and the boot completes
+  * 		with the CMD/DATA READY edge, after which the power-up prompt is
+  * 		read and validated.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval WIFI_BUSY while booting, WIFI_OK when the prompt was received
+  */
+
+WIFI_StatusTypeDef WIFI_BootProcess(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_BootTypeDef* boot = &hwifi->boot;
+	uint32_t elapsed = HAL_GetTick() - boot->resetTick;
+
+	switch(boot->state){
+
+	case WIFI_BOOT_RESET:
+		if(elapsed < WIFI_RESET_PULSE_TIME) return WIFI_BUSY;
+		WIFI_RELEASE_RESET();
+		boot->state = WIFI_BOOT_WAIT_READY;
+		return WIFI_BUSY;
+
+	case WIFI_BOOT_WAIT_READY:
+		if(!WIFI_IS_CMDDATA_READY()){
+			if(elapsed < WIFI_RESET_PULSE_TIME + WIFI_BOOT_TIMEOUT_TIME) return WIFI_BUSY;
+			boot->state = WIFI_BOOT_FAILED;
+			return WIFI_TIMEOUT;
+		}
+
+		WIFI_ENABLE_NSS();
+		if(WIFI_SPI_Receive(hwifi, wifiRxBuffer, WIFI_RX_BUFFER_SIZE) != WIFI_OK || strcmp(wifiRxBuffer, WIFI_MSG_POWERUP)){
+			WIFI_DISABLE_NSS();
+			boot->state = WIFI_BOOT_FAILED;
+			return WIFI_ERROR;
+		}
+		WIFI_DISABLE_NSS();
+
+		boot->readyTime = HAL_GetTick() - boot->resetTick;
+		boot->state = WIFI_BOOT_READY;
+		return WIFI_OK;
+
+	case WIFI_BOOT_READY:
+	case WIFI_BOOT_RUNNING:
+		return WIFI_OK;
+
+	default:
+		return WIFI_ERROR;
+	}
+}
+
+
+/**
+  * @brief  Resets and initialises the Wifi module. A boot started with
+  * 		WIFI_StartReset() is continued instead of resetting again.
   * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
   * @retval WIFI_StatusTypeDef
   */
 
 WIFI_StatusTypeDef WIFI_Init(WIFI_HandleTypeDef* hwifi){
 
-	int msgLength = 0;
+	WIFI_StatusTypeDef status;
+	STACK_SCOPE(WIFI_Init);
 
-	WIFI_RESET_MODULE();
-	WIFI_ENABLE_NSS();
+	// The module forgets its socket state on reset
+	hwifi->activeSocket = WIFI_SOCKET_NONE;
+	hwifi->clientSockets = 0;
+	hwifi->serverSockets = 0;
+	hwifi->readPacketSize = 0;
+	hwifi->readTimeout = 0;
+
+	// Drop queued commands of a previous session
+	for(uint8_t i = 0; i < hwifi->async.count; i++){
+		WIFI_ReleaseAsyncCommand(&hwifi->async.queue[(hwifi->async.head + i) % WIFI_ASYNC_QUEUE_SIZE]);
+	}
+	memset(&hwifi->async, 0, sizeof(hwifi->async));
 
-	while(!WIFI_IS_CMDDATA_READY());
+	// The module starts without power save
+	memset(&hwifi->power, 0, sizeof(hwifi->power));
+	hwifi->power.idleTimeout = WIFI_POWER_IDLE_TIMEOUT;
+	hwifi->power.wakeLead = WIFI_POWER_WAKE_LEAD;
+	hwifi->power.stateSince = HAL_GetTick();
 
-	if(WIFI_SPI_Receive(hwifi, wifiRxBuffer, WIFI_RX_BUFFER_SIZE) != WIFI_OK) Error_Handler();
+	// The module loads its saved profile, so a lease is no longer configured
+	hwifi->lease.applied = RESET;
+	hwifi->lease.revalidate = RESET;
+	hwifi->join.step = WIFI_JOIN_STEP_IDLE;
 
-	if( strcmp(wifiRxBuffer, WIFI_MSG_POWERUP) ) Error_Handler();
+	// Roaming stays off until WIFI_RoamConfig(), the link quality window starts empty
+	memset(&hwifi->roam, 0, sizeof(hwifi->roam));
+	memset(&hwifi->quality, 0, sizeof(hwifi->quality));
+	hwifi->quality.sampleInterval = WIFI_QUALITY_SAMPLE_INTERVAL;
 
-	WIFI_DISABLE_NSS();
+	// The command timing is taken from the free running cycle counter
+	profiler_init();
 
+#ifdef WIFI_USE_LOWPOWER
+	lowpower_init();
+#endif
 
-	msgLength = sprintf(wifiTxBuffer, "Z3=0\r");
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, WIFI_TX_BUFFER_SIZE, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	// Reset unless an early boot is still in progress
+	if(hwifi->boot.state < WIFI_BOOT_RESET || hwifi->boot.state > WIFI_BOOT_READY) WIFI_StartReset(hwifi);
 
-	msgLength = sprintf(wifiTxBuffer, "Z0\r");
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, WIFI_TX_BUFFER_SIZE, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
-	printf("Answer reset:\n %s", wifiRxBuffer);
+	while((status = WIFI_BootProcess(hwifi)) == WIFI_BUSY);
+	if(status != WIFI_OK) return status;
 
+	WIFI_SendCommandUint(hwifi, "Z3=", 0);
+
+	// Writing the settings to the flash of the module on every boot is slow and wears it
+#ifdef WIFI_BOOT_SAVE_SETTINGS
+	WIFI_SendCommand(hwifi, WIFI_CMD_SAVE_SETTINGS);
+#endif
+
+	hwifi->boot.state = WIFI_BOOT_RUNNING;
+	BLOG("wifi: module ready after %lu ms, first command at %lu ms", hwifi->boot.readyTime, hwifi->boot.firstCommandTick);
 
 	return WIFI_OK;
 }
@@ -107,28 +402,388 @@ WIFI_StatusTypeDef WIFI_Init(WIFI_HandleTypeDef* hwifi){
 
 WIFI_StatusTypeDef WIFI_SendATCommand(WIFI_HandleTypeDef* hwifi, char* bCmd, uint16_t sizeCmd, char* bRx, uint16_t sizeRx){
 
-	while(!WIFI_IS_CMDDATA_READY());
+	return WIFI_SendATCommandData(hwifi, bCmd, sizeCmd, NULL, 0, bRx, sizeRx);
+}
+
+
+/**
+  * @brief  Sends an AT command followed by a payload to the Wifi module and
+  * 		writes the response in a buffer. The payload is transmitted
+  * 		straight from the caller's buffer.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  bCmd: Char buffer that contains command.
+  * @param  sizeCmd: Command buffer size (including \0)
+  * @param  data: Payload buffer (may be NULL)
+  * @param  sizeData: Number of payload bytes
+  * @param  bRx: Response buffer
+  * @param  sizeRx: Response buffer size
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SendATCommandData(WIFI_HandleTypeDef* hwifi, const char* bCmd, uint16_t sizeCmd, const char* data, uint16_t sizeData, char* bRx, uint16_t sizeRx){
+
+	STACK_SCOPE(WIFI_SendATCommandData);
+
+	WIFI_RxBufferTypeDef rx = { .buffer = bRx, .size = sizeRx };
+
+	return WIFI_Transaction(hwifi, bCmd, sizeCmd - 1, data, sizeData, WIFI_ReceiveResponse, &rx);
+}
+
+
+/**
+  * @brief  Runs a blocking transaction: sends a command with an optional
+  * 		payload, and lets receiver read the response while NSS is
+  * 		asserted. A queued command on the wire is completed and a dozing
+  * 		module is woken first. The transaction is counted in the
+  * 		statistics of its command class, wake latency included.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  bCmd: Char buffer that contains command.
+  * @param  sizeCmd: Number of command bytes (excluding \0)
+  * @param  data: Payload buffer (may be NULL)
+  * @param  sizeData: Number of payload bytes
+  * @param  receiver: Reads the response
+  * @param  context: Passed to receiver
+  * @retval WIFI_TIMEOUT if the module does not get ready, otherwise the
+  * 		status of the transmission and of receiver
+  */
+
+WIFI_StatusTypeDef WIFI_Transaction(WIFI_HandleTypeDef* hwifi, const char* bCmd, uint16_t sizeCmd, const char* data, uint16_t sizeData, WIFI_ReceiverTypeDef receiver, void* context){
+
+	WIFI_CmdStatsTypeDef* stats;
+	WIFI_StatusTypeDef status;
+	uint32_t lap;
+
+	// A blocking command must not interleave with a queued one, so the one on the wire is completed first
+	while(hwifi->async.state != WIFI_ASYNC_IDLE) WIFI_Process(hwifi);
+
+	// A command that finds the module in power save has to wait for it to wake up
+	if(hwifi->power.state == WIFI_POWER_DOZING){
+		if(WIFI_PowerWake(hwifi) != WIFI_OK) return WIFI_ERROR;
+		hwifi->power.stats.demandWakes++;
+	}
+
+	PROFILE_SCOPE(WIFI_Transaction);
+
+	stats = WIFI_StartStats(hwifi, bCmd, sizeCmd + sizeData);
+	lap = profiler_counter();
+
+	if(WIFI_WAIT_CMDDATA_READY() != WIFI_OK){
+		stats->errors++;
+		return WIFI_TIMEOUT;
+	}
+	WIFI_STATS_LAP(stats->waitCycles, lap);
 
 	WIFI_ENABLE_NSS();
+	WIFI_STATS_LAP(stats->nssCycles, lap);
 
-	if(WIFI_SPI_Transmit(hwifi, bCmd, sizeCmd) != WIFI_OK) Error_Handler();
+	status = WIFI_SPI_TransmitData(hwifi, bCmd, sizeCmd, data, sizeData);
+	WIFI_STATS_LAP(stats->transferCycles, lap);
 
 	WIFI_DISABLE_NSS();
+	WIFI_STATS_LAP(stats->nssCycles, lap);
+
+	if(status != WIFI_OK){
+		stats->errors++;
+		return WIFI_ERROR;
+	}
+
+	if(WIFI_WAIT_CMDDATA_READY() != WIFI_OK){
+		stats->errors++;
+		return WIFI_TIMEOUT;
+	}
+	WIFI_STATS_LAP(stats->waitCycles, lap);
 
-	while(!WIFI_IS_CMDDATA_READY());
+	if(hwifi->power.wakePending == SET){
+		uint32_t latency = profiler_counter() - hwifi->power.wakeStart;
 
-	WIFI_ENABLE_NSS();
+		hwifi->power.wakePending = RESET;
+		hwifi->power.stats.lastWakeLatency = latency;
+		hwifi->power.stats.sumWakeLatency += latency;
+		if(latency > hwifi->power.stats.maxWakeLatency) hwifi->power.stats.maxWakeLatency = latency;
+	}
 
-	if(WIFI_SPI_Receive(hwifi, bRx, sizeRx) != WIFI_OK) Error_Handler();
+	WIFI_ENABLE_NSS();
+	WIFI_STATS_LAP(stats->nssCycles, lap);
 
-	if(WIFI_IS_CMDDATA_READY()) Error_Handler(); // If CMDDATA_READY is still high, then the buffer is too small for the data
+	status = receiver(hwifi, context);
+	WIFI_STATS_LAP(stats->transferCycles, lap);
 
 	WIFI_DISABLE_NSS();
+	WIFI_STATS_LAP(stats->nssCycles, lap);
+
+	if(status != WIFI_OK) stats->errors++;
+
+	return status;
+}
+
+
+/**
+  * @brief  Receiver of WIFI_SendATCommandData(), reads the response into
+  * 		the caller's buffer.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  context: WIFI_RxBufferTypeDef
+  * @retval WIFI_StatusTypeDef
+  */
+
+static WIFI_StatusTypeDef WIFI_ReceiveResponse(WIFI_HandleTypeDef* hwifi, void* context){
+
+	WIFI_RxBufferTypeDef* rx = context;
+
+	return WIFI_SPI_Receive(hwifi, rx->buffer, rx->size);
+}
+
+
+/**
+  * @brief  Sends an AT command without argument to the Wifi module and
+  * 		writes the response in wifiRxBuffer.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  prefix: Command, e.g. "C0"
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SendCommand(WIFI_HandleTypeDef* hwifi, const char* prefix){
+
+	char bCmd[WIFI_CMD_BUFFER_SIZE(0)];
+	uint16_t length = WIFI_FormatCommand(bCmd, sizeof(bCmd), prefix, NULL, 0);
+
+	if(length == 0) return WIFI_ERROR;
+
+	return WIFI_SendATCommand(hwifi, bCmd, length + 1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+}
+
+
+/**
+  * @brief  Sends an AT command with a numeric argument to the Wifi module
+  * 		and writes the response in wifiRxBuffer.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  prefix: Command including "=", e.g. "P2="
+  * @param  value: Argument, which is appended in decimal
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SendCommandUint(WIFI_HandleTypeDef* hwifi, const char* prefix, uint32_t value){
+
+	char bCmd[WIFI_CMD_BUFFER_SIZE(WIFI_CMD_UINT_MAX_LENGTH)];
+	uint16_t length = WIFI_FormatCommandUint(bCmd, sizeof(bCmd), prefix, value);
+
+	if(length == 0) return WIFI_ERROR;
+
+	return WIFI_SendATCommand(hwifi, bCmd, length + 1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+}
+
+
+/**
+  * @brief  Sends an AT command with a string argument to the Wifi module
+  * 		and writes the response in wifiRxBuffer.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  prefix: Command including "=", e.g. "C1="
+  * @param  value: C string argument, at most WIFI_CMD_STRING_MAX_LENGTH chars
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SendCommandString(WIFI_HandleTypeDef* hwifi, const char* prefix, const char* value){
+
+	char bCmd[WIFI_CMD_BUFFER_SIZE(WIFI_CMD_STRING_MAX_LENGTH)];
+	uint16_t length = WIFI_FormatCommand(bCmd, sizeof(bCmd), prefix, value, strnlen(value, WIFI_CMD_STRING_MAX_LENGTH + 1));
+
+	if(length == 0) return WIFI_ERROR;
+
+	return WIFI_SendATCommand(hwifi, bCmd, length + 1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+}
+
+
+/**
+  * @brief  Queues an AT command, which is executed by WIFI_Process() without
+  * 		blocking. The command is copied into a slot of the fixed queue,
+  * 		the payload is sent straight from data and must stay valid until
+  * 		the callback was called.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  bCmd: Char buffer that contains command.
+  * @param  sizeCmd: Command buffer size (including \0)
+  * @param  data: Payload buffer (may be NULL)
+  * @param  sizeData: Number of payload bytes
+  * @param  bRx: Response buffer, wifiRxBuffer or with WIFI_USE_POOL a pool
+  * 		block of sizeRx bytes is used if NULL
+  * @param  sizeRx: Response buffer size
+  * @param  callback: Called with the command status when the response was received (may be NULL)
+  * @param  context: Passed through to the callback
+  * @retval WIFI_BUSY if the queue is full, WIFI_OK otherwise
+  */
+
+WIFI_StatusTypeDef WIFI_SubmitATCommand(WIFI_HandleTypeDef* hwifi, const char* bCmd, uint16_t sizeCmd, const char* data, uint16_t sizeData, char* bRx, uint16_t sizeRx, WIFI_CallbackTypeDef callback, void* context){
+
+	WIFI_AsyncCommandTypeDef* slot;
+
+	if(sizeCmd > WIFI_CMD_BUFFER_SIZE(WIFI_CMD_STRING_MAX_LENGTH)) return WIFI_ERROR;
+
+	slot = WIFI_AllocateAsyncCommand(hwifi, data, sizeData, bRx, sizeRx, callback, context);
+	if(slot == NULL) return WIFI_BUSY;
+
+	memcpy(slot->cmd, bCmd, sizeCmd);
+	slot->sizeCmd = sizeCmd;
+	hwifi->async.count++;
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Queues an AT command with a numeric argument, see
+  * 		WIFI_SubmitATCommand(). The response is written in wifiRxBuffer
+  * 		or, with WIFI_USE_POOL, in a pool block of WIFI_ASYNC_RX_SIZE.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  prefix: Command including "=", e.g. "P2="
+  * @param  value: Argument, which is appended in decimal
+  * @param  callback: Called when the response was received (may be NULL)
+  * @param  context: Passed through to the callback
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SubmitCommandUint(WIFI_HandleTypeDef* hwifi, const char* prefix, uint32_t value, WIFI_CallbackTypeDef callback, void* context){
+
+	WIFI_AsyncCommandTypeDef* slot = WIFI_AllocateAsyncCommand(hwifi, NULL, 0, NULL, WIFI_ASYNC_RX_SIZE, callback, context);
+
+	if(slot == NULL) return WIFI_BUSY;
+
+	slot->sizeCmd = WIFI_FormatCommandUint(slot->cmd, sizeof(slot->cmd), prefix, value) + 1;
+	if(slot->sizeCmd == 1){
+		WIFI_ReleaseAsyncCommand(slot);
+		return WIFI_ERROR;
+	}
+
+	hwifi->async.count++;
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Queues an AT command with a string argument, see
+  * 		WIFI_SubmitATCommand(). The response is written in wifiRxBuffer
+  * 		or, with WIFI_USE_POOL, in a pool block of WIFI_ASYNC_RX_SIZE.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  prefix: Command, e.g. "C1=" or "C0"
+  * @param  value: C string argument (may be NULL)
+  * @param  callback: Called when the response was received (may be NULL)
+  * @param  context: Passed through to the callback
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SubmitCommandString(WIFI_HandleTypeDef* hwifi, const char* prefix, const char* value, WIFI_CallbackTypeDef callback, void* context){
+
+	WIFI_AsyncCommandTypeDef* slot = WIFI_AllocateAsyncCommand(hwifi, NULL, 0, NULL, WIFI_ASYNC_RX_SIZE, callback, context);
+	uint16_t valueLength = (value == NULL) ? 0 : strnlen(value, WIFI_CMD_STRING_MAX_LENGTH + 1);
+
+	if(slot == NULL) return WIFI_BUSY;
+
+	slot->sizeCmd = WIFI_FormatCommand(slot->cmd, sizeof(slot->cmd), prefix, value, valueLength) + 1;
+	if(slot->sizeCmd == 1){
+		WIFI_ReleaseAsyncCommand(slot);
+		return WIFI_ERROR;
+	}
+
+	hwifi->async.count++;
 
 	return WIFI_OK;
 }
 
 
+/**
+  * @brief  Advances the queued commands. Instead of waiting for CMD/DATA
+  * 		READY, it returns immediately, so it has to be called repeatedly,
+  * 		e.g. from the main loop after the EXTI1 interrupt woke the core.
+  * 		The callback of a command is called from here and may queue the
+  * 		next step of its flow.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval WIFI_BUSY while commands are pending, WIFI_OK when idle
+  */
+
+WIFI_StatusTypeDef WIFI_Process(WIFI_HandleTypeDef* hwifi){
+
+	STACK_SCOPE(WIFI_Process);
+
+	WIFI_AsyncTypeDef* async = &hwifi->async;
+	WIFI_AsyncCommandTypeDef* cmd = &async->queue[async->head];
+	WIFI_StatusTypeDef status = WIFI_OK;
+	WIFI_CmdStatsTypeDef* stats = NULL;
+	WIFI_CallbackTypeDef callback;
+	void* context;
+	char* response;
+
+	switch(async->state){
+
+	case WIFI_ASYNC_IDLE:
+		if(async->count == 0) return WIFI_OK;
+		async->startTick = HAL_GetTick();
+		async->lap = profiler_counter();
+		async->state = WIFI_ASYNC_WAIT_TX;
+		// Counted from the start, so a module that never gets ready shows up as error of the command
+		WIFI_StartStats(hwifi, cmd->cmd, cmd->sizeCmd - 1 + cmd->sizeData);
+		/* fall through */
+
+	case WIFI_ASYNC_WAIT_TX:
+		stats = currentStats;
+
+		if(!WIFI_IS_CMDDATA_READY()){
+			if(HAL_GetTick() - async->startTick < cmd->timeout) return WIFI_BUSY;
+			status = WIFI_TIMEOUT;
+			break;
+		}
+
+		WIFI_STATS_LAP(stats->waitCycles, async->lap);
+
+		WIFI_ENABLE_NSS();
+		WIFI_STATS_LAP(stats->nssCycles, async->lap);
+		status = WIFI_SPI_TransmitData(hwifi, cmd->cmd, cmd->sizeCmd - 1, cmd->data, cmd->sizeData);
+		WIFI_STATS_LAP(stats->transferCycles, async->lap);
+		WIFI_DISABLE_NSS();
+		WIFI_STATS_LAP(stats->nssCycles, async->lap);
+
+		if(status != WIFI_OK) break;
+
+		async->state = WIFI_ASYNC_WAIT_RX;
+		return WIFI_BUSY;
+
+	case WIFI_ASYNC_WAIT_RX:
+		stats = currentStats;
+
+		if(!WIFI_IS_CMDDATA_READY()){
+			if(HAL_GetTick() - async->startTick < cmd->timeout) return WIFI_BUSY;
+			status = WIFI_TIMEOUT;
+			break;
+		}
+
+		WIFI_STATS_LAP(stats->waitCycles, async->lap);
+		WIFI_ENABLE_NSS();
+		WIFI_STATS_LAP(stats->nssCycles, async->lap);
+		status = WIFI_SPI_Receive(hwifi, cmd->bRx, cmd->sizeRx);
+		WIFI_STATS_LAP(stats->transferCycles, async->lap);
+		if(WIFI_IS_CMDDATA_READY()) status = WIFI_ERROR; // The buffer is too small for the data
+		WIFI_DISABLE_NSS();
+		WIFI_STATS_LAP(stats->nssCycles, async->lap);
+		break;
+	}
+
+	if(status != WIFI_OK){
+		if(stats != NULL) stats->errors++;
+		BLOG("wifi: queued command %c%c failed with status %d", cmd->cmd[0], cmd->cmd[1], status);
+	}
+
+	// Release the slot before the callback, so it can queue the next command
+	callback = cmd->callback;
+	context = cmd->context;
+	response = cmd->bRx;
+	if(callback == NULL) WIFI_ReleaseAsyncCommand(cmd);
+	async->head = (async->head + 1) % WIFI_ASYNC_QUEUE_SIZE;
+	async->count--;
+	async->state = WIFI_ASYNC_IDLE;
+
+	if(callback != NULL) callback(hwifi, status, response, context);
+
+	return (async->count > 0) ? WIFI_BUSY : WIFI_OK;
+}
+
+
 /**
   * @brief  Creates Wifi access point on Wifi module
   * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
@@ -138,39 +793,29 @@ WIFI_StatusTypeDef WIFI_SendATCommand(WIFI_HandleTypeDef* hwifi, char* bCmd, uin
 
 WIFI_StatusTypeDef WIFI_CreateNewNetwork(WIFI_HandleTypeDef* hwifi){
 
-	int msgLength = 0;
-	char* ipStart;
-	char* ipEnd;
+	STACK_SCOPE(WIFI_CreateNewNetwork);
 
-	// The msgLength+1 is because sprintf only returns string length without counting \0
+	WIFI_ResponseTypeDef response;
 
 	// Activate the soft access point
-	msgLength = sprintf(wifiTxBuffer, "A1=%d\r", hwifi->securityType);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	WIFI_SendCommandUint(hwifi, "A1=", hwifi->securityType);
 
 	// Set AP security key
-	msgLength = sprintf(wifiTxBuffer, "A2=%s\r", hwifi->passphrase);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	WIFI_SendCommandString(hwifi, "A2=", hwifi->passphrase);
 
 	// Set AP SSID
-	msgLength = sprintf(wifiTxBuffer, "AS=0,%s\r", hwifi->ssid);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	WIFI_SendCommandString(hwifi, "AS=0,", hwifi->ssid);
 
 	// Activate AP direct mode
-	msgLength = sprintf(wifiTxBuffer, "AD\r");
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	WIFI_SendCommand(hwifi, "AD");
 
 	// Get AP info
-	msgLength = sprintf(wifiTxBuffer, "A?\r");
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	WIFI_SendCommand(hwifi, "A?");
 
-	// Get the position of the IP address
-	ipStart = strstr(wifiRxBuffer, ",") + 1;
-	ipEnd = strstr(ipStart, ",");
+	if(WIFI_ParseResponse(wifiRxBuffer, WIFI_RX_BUFFER_SIZE, &response) != WIFI_OK) return WIFI_ERROR;
 
-	// Save IP address in the Wifi handle
-	memset(hwifi->ipAddress, '\0', sizeof(hwifi->ipAddress));
-	snprintf(hwifi->ipAddress, ipEnd - ipStart + 1, ipStart);
+	// Save IP address in the Wifi handle, it is the second field of the AP info
+	if(WIFI_CopyIPField(&response, 1, &hwifi->ipAddress) != WIFI_OK) return WIFI_ERROR;
 
 	return WIFI_OK;
 }
@@ -184,24 +829,19 @@ WIFI_StatusTypeDef WIFI_CreateNewNetwork(WIFI_HandleTypeDef* hwifi){
 
 WIFI_StatusTypeDef WIFI_WebServerInit(WIFI_HandleTypeDef* hwifi){
 
-	int msgLength = 0;
-
+	STACK_SCOPE(WIFI_WebServerInit);
 
 	// Set TCP keep alive
-	msgLength = sprintf(wifiTxBuffer, "PK=1,3000\r");
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	WIFI_SendCommandUint(hwifi, "PK=1,", 3000);
 
 	// Set communication socket
-	msgLength = sprintf(wifiTxBuffer, "P0=0\r");
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	WIFI_SelectSocket(hwifi, 0);
 
 	// Set transport protocol
-	msgLength = sprintf(wifiTxBuffer, "P1=%d\r", hwifi->transportProtocol);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	WIFI_SendCommandUint(hwifi, "P1=", hwifi->transportProtocol);
 
 	// Set port
-	msgLength = sprintf(wifiTxBuffer, "P2=%u\r", hwifi->port);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	WIFI_SendCommandUint(hwifi, "P2=", hwifi->port);
 
 	return WIFI_OK;
 }
@@ -216,19 +856,18 @@ WIFI_StatusTypeDef WIFI_WebServerInit(WIFI_HandleTypeDef* hwifi){
 
 WIFI_StatusTypeDef WIFI_WebServerListen(WIFI_HandleTypeDef* hwifi){
 
-	int msgLength = 0;
+	STACK_SCOPE(WIFI_WebServerListen);
+
+	WIFI_ResponseTypeDef response;
 
 	// Start web server
-	msgLength = sprintf(wifiTxBuffer, "P5=1\r");
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	if(WIFI_SocketOpen(hwifi, 0, WIFI_SOCKET_SERVER) != WIFI_OK) return WIFI_ERROR;
 
 	// Set read packet size
-	msgLength = sprintf(wifiTxBuffer, "R1=%d\r", WIFI_READ_PACKET_SIZE);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	WIFI_SetReadPacketSize(hwifi, WIFI_READ_PACKET_SIZE);
 
 	// Set read timeout
-	msgLength = sprintf(wifiTxBuffer, "R2=%d\r", WIFI_READ_TIMEOUT);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	WIFI_SetReadTimeout(hwifi, WIFI_READ_TIMEOUT);
 
 	// Poll as long until a transport request arrives
 	while(1){
@@ -236,15 +875,15 @@ WIFI_StatusTypeDef WIFI_WebServerListen(WIFI_HandleTypeDef* hwifi){
 			// delay so the Wifi module is not blocked by the polling
 			WIFI_DELAY(WIFI_POLLING_DELAY);
 			// Read messages
-			msgLength = sprintf(wifiTxBuffer, "MR\r");
-			WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
-		}while(!strcmp(WIFI_MSG_OK, wifiRxBuffer) || !strcmp(WIFI_MSG_EMPTY, wifiRxBuffer));
+			WIFI_SendCommand(hwifi, "MR");
+			WIFI_ParseResponse(wifiRxBuffer, WIFI_RX_BUFFER_SIZE, &response);
+		}while(response.status == WIFI_RESPONSE_OK && WIFI_IsPayloadEmpty(&response));
 
 		// Check the received message
-		if(strstr(wifiRxBuffer, "Accepted") != 0){
+		if(WIFI_PayloadContains(&response, "Accepted")){
 			break;
 		}
-		else if(strstr(wifiRxBuffer, "ERROR") != 0){
+		else if(response.status == WIFI_RESPONSE_ERROR){
 			Error_Handler();
 		}
 		else{
@@ -253,22 +892,43 @@ WIFI_StatusTypeDef WIFI_WebServerListen(WIFI_HandleTypeDef* hwifi){
 	}
 
 	// Read received data
-	msgLength = sprintf(wifiTxBuffer, "R0\r");
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	WIFI_SendCommand(hwifi, "R0");
+
+#ifdef WIFI_USE_METRICS_ENDPOINT
+	// Answer metrics scrapes without the request handler
+	WIFI_ParseResponse(wifiRxBuffer, WIFI_RX_BUFFER_SIZE, &response);
+	if(WIFI_IsHttpGet(response.payload, response.payloadLength, WIFI_METRICS_PATH)){
+		if(WIFI_MetricsRespond(hwifi, 0) != WIFI_OK){
+			WIFI_SocketClose(hwifi, 0);
+			return WIFI_ERROR;
+		}
+		return WIFI_SocketClose(hwifi, 0);
+	}
+#ifdef SPI_TRACE_ENABLED
+	if(WIFI_IsHttpGet(response.payload, response.payloadLength, WIFI_TRACE_PATH)){
+		if(WIFI_TraceRespond(hwifi, 0) != WIFI_OK){
+			WIFI_SocketClose(hwifi, 0);
+			return WIFI_ERROR;
+		}
+		return WIFI_SocketClose(hwifi, 0);
+	}
+#endif
+#endif
 
-	// Call request handler
+	// Call request handler, with a shared buffer it reads the request from the buffer it answers in
+#if WIFI_FOOTPRINT != WIFI_FOOTPRINT_SMALL
 	strcpy(wifiTxBuffer,wifiRxBuffer);
+#endif
 	WIFI_WebServerHandleRequest(hwifi, wifiTxBuffer, WIFI_TX_BUFFER_SIZE, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
 
-	// Send response
-	msgLength = sprintf(wifiTxBuffer, "S3=%d\r%s", strlen(wifiRxBuffer), wifiRxBuffer);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	// Send response, the payload is clocked out before the answer overwrites wifiRxBuffer
+	if(WIFI_SocketSend(hwifi, 0, wifiRxBuffer, strnlen(wifiRxBuffer, WIFI_RX_BUFFER_SIZE)) != WIFI_OK){
+		WIFI_SocketClose(hwifi, 0);
+		return WIFI_ERROR;
+	}
 
 	// Stop web server
-	msgLength = sprintf(wifiTxBuffer, "P5=0\r");
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
-
-	return WIFI_OK;
+	return WIFI_SocketClose(hwifi, 0);
 }
 
 /**
@@ -287,211 +947,1777 @@ __weak WIFI_StatusTypeDef WIFI_WebServerHandleRequest(WIFI_HandleTypeDef* hwifi,
 
 /**
   * @brief  Joins an existing Network using the network configuration in
-  * 		the Wifi handle.
+  * 		the Wifi handle. Blocks until WIFI_JoinNetworkAsync() completed.
   * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
   * @retval WIFI_StatusTypeDef
   */
 
 WIFI_StatusTypeDef WIFI_JoinNetwork(WIFI_HandleTypeDef* hwifi){
 
-	int msgLength = 0;
+	STACK_SCOPE(WIFI_JoinNetwork);
 
-	// Set SSID
-	msgLength = sprintf(wifiTxBuffer, "C1=%s\r", hwifi->ssid);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	WIFI_StatusTypeDef status = WIFI_JoinNetworkAsync(hwifi, NULL, NULL);
 
-	// Set passphrase
-	msgLength = sprintf(wifiTxBuffer, "C2=%s\r", hwifi->passphrase);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	if(status != WIFI_OK) return status;
 
-	// Set security type
-	msgLength = sprintf(wifiTxBuffer, "C3=%d\r", hwifi->securityType);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	while(WIFI_Process(hwifi) == WIFI_BUSY);
 
-	// Set if IP is requested via DHCP
-	msgLength = sprintf(wifiTxBuffer, "C4=%d\r", hwifi->DHCP);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	return hwifi->join.result;
+}
 
-	// If DHCP is not used, set the additionally needed configurations
-	if(hwifi->DHCP != SET){
 
-		// Set module's IP address
-		msgLength = sprintf(wifiTxBuffer, "C6=%s\r", hwifi->ipAddress);
-		WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+/**
+  * @brief  Starts joining the network configured in the Wifi handle and
+  * 		returns immediately. The join runs on the command queue, so
+  * 		WIFI_Process() has to be called until the callback reports
+  * 		WIFI_JOIN_CONNECTED or WIFI_JOIN_FAILED. The settings are skipped
+  * 		if the saved profile of the module matches and a cached DHCP
+  * 		lease is reused. With WIFI_USE_TARGETED_JOIN, the cached access
+  * 		point is tried before a full scan.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  callback: Called with every progress event, may be NULL
+  * @param  context: Passed to the callback
+  * @retval WIFI_BUSY if a join or other commands are pending
+  */
 
-		// Set module's network mask
-		msgLength = sprintf(wifiTxBuffer, "C7=%s\r", hwifi->networkMask);
-		WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+WIFI_StatusTypeDef WIFI_JoinNetworkAsync(WIFI_HandleTypeDef* hwifi, WIFI_JoinCallbackTypeDef callback, void* context){
 
-		// Set module's default gateway
-		msgLength = sprintf(wifiTxBuffer, "C8=%s\r", hwifi->defaultGateway);
-		WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	return WIFI_JoinStart(hwifi, NULL, callback, context);
+}
+
+
+/**
+  * @brief  Starts joining the access point given by link, e.g. a roaming
+  * 		candidate, like WIFI_JoinNetworkAsync() does for the cached one.
+  * 		A miss fails the join without a full scan, and the cached access
+  * 		point is kept. After the join, CW tells whether the module really
+  * 		joined the link, see join.confirmed. The joined access point is
+  * 		cached either way.
+  * 		Needs WIFI_USE_TARGETED_JOIN.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  link: BSSID and channel of the access point
+  * @param  callback: Called with every progress event, may be NULL
+  * @param  context: Passed to the callback
+  * @retval WIFI_BUSY if a join or other commands are pending, WIFI_ERROR
+  * 		without WIFI_USE_TARGETED_JOIN
+  */
+
+WIFI_StatusTypeDef WIFI_JoinLinkAsync(WIFI_HandleTypeDef* hwifi, const WIFI_LinkTypeDef* link, WIFI_JoinCallbackTypeDef callback, void* context){
+
+#ifdef WIFI_USE_TARGETED_JOIN
+	return WIFI_JoinStart(hwifi, link, callback, context);
+#else
+	// C0 cannot be restricted to an access point
+	(void) hwifi;
+	(void) link;
+	(void) callback;
+	(void) context;
+	return WIFI_ERROR;
+#endif
+}
+
+
+/**
+  * @brief  Starts a join for WIFI_JoinNetworkAsync() and WIFI_JoinLinkAsync().
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  link: Access point to join, NULL for the cached one
+  * @param  callback: Called with every progress event, may be NULL
+  * @param  context: Passed to the callback
+  * @retval WIFI_StatusTypeDef
+  */
+
+static WIFI_StatusTypeDef WIFI_JoinStart(WIFI_HandleTypeDef* hwifi, const WIFI_LinkTypeDef* link, WIFI_JoinCallbackTypeDef callback, void* context){
+
+	WIFI_JoinTypeDef* join = &hwifi->join;
+	uint32_t saved;
+
+	if(join->step != WIFI_JOIN_STEP_IDLE || hwifi->async.count > 0) return WIFI_BUSY;
+
+	join->callback = callback;
+	join->context = context;
+	join->startTick = HAL_GetTick();
+	join->eventTick = join->startTick;
+	join->result = WIFI_BUSY;
+	join->configured = RESET;
+	join->targeted = RESET;
+	join->pinned = (link != NULL) ? SET : RESET;
+	join->confirmed = RESET;
+	if(link != NULL) join->link = *link;
+	join->reason = WIFI_JOIN_REASON_NONE;
+
+	// The module already holds this configuration in its user profile
+	join->fingerprint = WIFI_ConfigFingerprint(hwifi);
+	join->profile = (WIFI_ConfigLoad(&saved) == WIFI_OK && saved == join->fingerprint) ? SET : RESET;
+
+	if(join->profile == SET){
+		join->reason = WIFI_JOIN_REASON_PROFILE;
+		join->step = WIFI_JoinLeaseStep(hwifi);
+	}else{
+		join->step = WIFI_JOIN_STEP_SSID;
+	}
+
+	if(WIFI_JoinSubmit(hwifi) != WIFI_OK){
+		join->step = WIFI_JOIN_STEP_IDLE;
+		return WIFI_ERROR;
+	}
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Queues the command of the current join step.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval WIFI_StatusTypeDef
+  */
+
+static WIFI_StatusTypeDef WIFI_JoinSubmit(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_JoinTypeDef* join = &hwifi->join;
+	WIFI_LeaseTypeDef* lease = &hwifi->lease;
+#ifdef WIFI_USE_TARGETED_JOIN
+	char bssid[WIFI_BSSID_STRING_SIZE];
+#endif
+
+	switch(join->step){
+
+	case WIFI_JOIN_STEP_SSID:
+		join->configured = SET;
+		WIFI_JoinPost(hwifi, WIFI_JOIN_CONFIGURING);
+		return WIFI_JoinSubmitString(hwifi, "C1=", hwifi->ssid, WIFI_TIMEOUT_TIME);
+	case WIFI_JOIN_STEP_PASSPHRASE: return WIFI_JoinSubmitString(hwifi, "C2=", hwifi->passphrase, WIFI_TIMEOUT_TIME);
+	case WIFI_JOIN_STEP_SECURITY: return WIFI_JoinSubmitUint(hwifi, "C3=", hwifi->securityType);
+	case WIFI_JOIN_STEP_DHCP: return WIFI_JoinSubmitUint(hwifi, "C4=", hwifi->DHCP);
+	case WIFI_JOIN_STEP_IP: return WIFI_JoinSubmitIP(hwifi, "C6=", &hwifi->ipAddress);
+	case WIFI_JOIN_STEP_MASK: return WIFI_JoinSubmitIP(hwifi, "C7=", &hwifi->networkMask);
+	case WIFI_JOIN_STEP_GATEWAY: return WIFI_JoinSubmitIP(hwifi, "C8=", &hwifi->defaultGateway);
+	case WIFI_JOIN_STEP_DNS: return WIFI_JoinSubmitIP(hwifi, "C9=", &hwifi->primaryDNSServer);
+
+	// A reused lease is configured as static addresses, otherwise DHCP is switched on again
+	case WIFI_JOIN_STEP_LEASE_DHCP: return WIFI_JoinSubmitUint(hwifi, "C4=", (lease->applied == SET) ? RESET : SET);
+	case WIFI_JOIN_STEP_LEASE_IP: return WIFI_JoinSubmitIP(hwifi, "C6=", &lease->ipAddress);
+	case WIFI_JOIN_STEP_LEASE_MASK: return WIFI_JoinSubmitIP(hwifi, "C7=", &lease->networkMask);
+	case WIFI_JOIN_STEP_LEASE_GATEWAY: return WIFI_JoinSubmitIP(hwifi, "C8=", &lease->defaultGateway);
+	case WIFI_JOIN_STEP_LEASE_DNS: return WIFI_JoinSubmitIP(hwifi, "C9=", &lease->primaryDNSServer);
+
+#ifdef WIFI_USE_TARGETED_JOIN
+	case WIFI_JOIN_STEP_BSSID:
+		WIFI_BSSIDToString(join->link.bssid, bssid, sizeof(bssid));
+		return WIFI_JoinSubmitString(hwifi, WIFI_CMD_JOIN_BSSID, bssid, WIFI_TIMEOUT_TIME);
+	case WIFI_JOIN_STEP_CHANNEL: return WIFI_JoinSubmitUint(hwifi, WIFI_CMD_JOIN_CHANNEL, join->link.channel);
+#endif
+
+	case WIFI_JOIN_STEP_CONNECT:
+		// With the cached access point the module skips the scan
+		if(join->targeted == SET) join->reason = WIFI_JOIN_REASON_CACHED_LINK;
+		WIFI_JoinPost(hwifi, (join->targeted == SET) ? WIFI_JOIN_AUTHENTICATING : WIFI_JOIN_SCANNING);
+		return WIFI_JoinSubmitString(hwifi, "C0", NULL, WIFI_JOIN_TIMEOUT_TIME);
+
+#ifdef WIFI_USE_TARGETED_JOIN
+	case WIFI_JOIN_STEP_LINK_INFO: return WIFI_JoinSubmitString(hwifi, WIFI_CMD_LINK_INFO, NULL, WIFI_TIMEOUT_TIME);
+#endif
+	case WIFI_JOIN_STEP_SETTINGS: return WIFI_JoinSubmitString(hwifi, WIFI_CMD_NETWORK_SETTINGS, NULL, WIFI_TIMEOUT_TIME);
+	case WIFI_JOIN_STEP_SAVE: return WIFI_JoinSubmitString(hwifi, WIFI_CMD_SAVE_SETTINGS, NULL, WIFI_TIMEOUT_TIME);
+
+	default: return WIFI_ERROR;
+	}
+}
+
+
+/**
+  * @brief  Completes a join step and queues the next one.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  status: Transfer status of the command
+  * @param  response: Response of the command
+  * @param  context: Unused
+  * @retval None
+  */
+
+static void WIFI_JoinCompleted(WIFI_HandleTypeDef* hwifi, WIFI_StatusTypeDef status, char* response, void* context){
+
+	WIFI_JoinTypeDef* join = &hwifi->join;
+	WIFI_ResponseTypeDef parsed;
+	WIFI_JoinReasonTypeDef reason = WIFI_JOIN_REASON_NONE;
+
+	if(status != WIFI_OK){
+		reason = (status == WIFI_TIMEOUT) ? WIFI_JOIN_REASON_TIMEOUT : WIFI_JOIN_REASON_TRANSFER;
+	}else if(WIFI_ParseResponse(response, strlen(response) + 1, &parsed) != WIFI_OK){
+		reason = WIFI_JOIN_REASON_MODULE_ERROR;
+	}
+
+	// The response is only valid until it is released
+	join->step = WIFI_JoinNextStep(hwifi, reason, &parsed);
+
+#ifdef WIFI_USE_POOL
+	pool_free(response);
+#endif
+
+	if(join->step != WIFI_JOIN_STEP_IDLE && WIFI_JoinSubmit(hwifi) != WIFI_OK){
+		join->step = WIFI_JoinFinish(hwifi, WIFI_ERROR, WIFI_JOIN_REASON_TRANSFER);
+	}
+}
+
+
+/**
+  * @brief  Decides the next join step from the result of the current one.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  reason: WIFI_JOIN_REASON_NONE if the step succeeded, else the cause
+  * @param  response: Parsed response of the step
+  * @retval Next step, WIFI_JOIN_STEP_IDLE when the join is finished
+  */
+
+static WIFI_JoinStepTypeDef WIFI_JoinNextStep(WIFI_HandleTypeDef* hwifi, WIFI_JoinReasonTypeDef reason, WIFI_ResponseTypeDef* response){
+
+	WIFI_JoinTypeDef* join = &hwifi->join;
+#ifdef WIFI_USE_TARGETED_JOIN
+	WIFI_LinkTypeDef link;
+#endif
+
+	if(join->step == WIFI_JOIN_STEP_CONNECT) return WIFI_JoinConnected(hwifi, reason, response);
+
+	// Without the settings the module cannot join, the steps after C0 only fill caches
+	if(reason != WIFI_JOIN_REASON_NONE && join->step < WIFI_JOIN_STEP_CONNECT) return WIFI_JoinFinish(hwifi, WIFI_ERROR, reason);
+
+	switch(join->step){
+
+	case WIFI_JOIN_STEP_DHCP:
+		hwifi->lease.applied = RESET;
+		return (hwifi->DHCP == SET) ? WIFI_JoinLeaseStep(hwifi) : WIFI_JOIN_STEP_IP;
+	case WIFI_JOIN_STEP_DNS: return WIFI_JoinLeaseStep(hwifi);
+	case WIFI_JOIN_STEP_LEASE_DHCP: return (hwifi->lease.applied == SET) ? WIFI_JOIN_STEP_LEASE_IP : WIFI_JoinLinkStep(hwifi);
+	case WIFI_JOIN_STEP_LEASE_DNS: return WIFI_JoinLinkStep(hwifi);
+
+#ifdef WIFI_USE_TARGETED_JOIN
+	case WIFI_JOIN_STEP_LINK_INFO:
+		// Remember the access point for the next join, a given link only counts if the module reports its BSSID
+		if(reason == WIFI_JOIN_REASON_NONE && WIFI_JoinParseLink(response, &link) == WIFI_OK){
+			if(join->pinned == SET && !memcmp(link.bssid, join->link.bssid, sizeof(link.bssid))) join->confirmed = SET;
+			join->link = link;
+			WIFI_LinkStore(&join->link);
+		}
+		return WIFI_JoinAddressStep(hwifi);
+#endif
+
+	case WIFI_JOIN_STEP_SETTINGS:
+		if(reason == WIFI_JOIN_REASON_NONE) WIFI_LeaseCapture(hwifi, response);
+		WIFI_JoinPost(hwifi, WIFI_JOIN_DHCP);
+		return WIFI_JoinSaveStep(hwifi);
+
+	case WIFI_JOIN_STEP_SAVE:
+		if(reason == WIFI_JOIN_REASON_NONE) WIFI_ConfigStore(join->fingerprint);
+		return WIFI_JoinFinish(hwifi, WIFI_OK, WIFI_JOIN_REASON_NONE);
+
+	// The remaining settings follow each other
+	default: return join->step + 1;
+	}
+}
+
+
+/**
+  * @brief  Handles the result of C0. A failed join to the cached access
+  * 		point is repeated with a full scan, and a failed join with the
+  * 		saved profile is repeated with all settings.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  reason: WIFI_JOIN_REASON_NONE if C0 succeeded, else the cause
+  * @param  response: Parsed join response
+  * @retval Next step
+  */
+
+static WIFI_JoinStepTypeDef WIFI_JoinConnected(WIFI_HandleTypeDef* hwifi, WIFI_JoinReasonTypeDef reason, WIFI_ResponseTypeDef* response){
+
+	WIFI_JoinTypeDef* join = &hwifi->join;
+
+	hwifi->stats.joins++;
+
+	if(reason == WIFI_JOIN_REASON_NONE && WIFI_JoinParseIP(hwifi, response) != WIFI_OK) reason = WIFI_JOIN_REASON_NO_ADDRESS;
+
+	if(reason != WIFI_JOIN_REASON_NONE){
+		hwifi->stats.joinErrors++;
+
+#ifdef WIFI_USE_TARGETED_JOIN
+		// The access point moved to another channel or is gone. A given link is left to the caller.
+		if(join->targeted == SET && join->pinned == RESET){
+			hwifi->stats.linkMisses++;
+			WIFI_LinkInvalidate();
+			memset(&join->link, 0, sizeof(join->link));
+			join->targeted = RESET;
+			join->reason = WIFI_JOIN_REASON_LINK_MISS;
+			return WIFI_JOIN_STEP_BSSID;
+		}
+#endif
+
+		// The profile was lost, e.g. by a factory reset, so configure from scratch
+		if(join->profile == SET){
+			WIFI_ConfigInvalidate();
+			join->profile = RESET;
+			join->reason = WIFI_JOIN_REASON_PROFILE_LOST;
+			return WIFI_JOIN_STEP_SSID;
+		}
+
+		return WIFI_JoinFinish(hwifi, WIFI_ERROR, reason);
+	}
+
+	WIFI_JoinRecordTime(hwifi, join->startTick);
+	if(join->profile == SET && join->configured == RESET) hwifi->stats.profileJoins++;
+
+#ifdef WIFI_USE_TARGETED_JOIN
+	// A given link is checked with CW, the module may have joined another access point of the SSID
+	if(join->targeted == SET && join->pinned == RESET){
+		hwifi->stats.linkHits++;
+		return WIFI_JoinAddressStep(hwifi);
+	}
+
+	return WIFI_JOIN_STEP_LINK_INFO;
+#else
+	return WIFI_JoinAddressStep(hwifi);
+#endif
+}
+
+
+/**
+  * @brief  Decides whether a cached DHCP lease is configured before C0.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval Next step
+  */
+
+static WIFI_JoinStepTypeDef WIFI_JoinLeaseStep(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_LeaseTypeDef* lease = &hwifi->lease;
+
+	if(hwifi->DHCP == SET){
+		if(lease->valid == SET && (HAL_GetTick() - lease->obtainedTick) / 1000 < lease->leaseTime){
+			lease->applied = SET;
+			return WIFI_JOIN_STEP_LEASE_DHCP;
+		}
+
+		// The lease expired, request a new one
+		lease->valid = RESET;
+		if(lease->applied == SET){
+			lease->applied = RESET;
+			return WIFI_JOIN_STEP_LEASE_DHCP;
+		}
+	}
+
+	return WIFI_JoinLinkStep(hwifi);
+}
+
+
+/**
+  * @brief  Decides whether C0 is restricted to the cached access point.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval Next step
+  */
+
+static WIFI_JoinStepTypeDef WIFI_JoinLinkStep(WIFI_HandleTypeDef* hwifi){
+
+#ifdef WIFI_USE_TARGETED_JOIN
+	WIFI_JoinTypeDef* join = &hwifi->join;
+
+	// A link given by WIFI_JoinLinkAsync() is joined instead of the cached one
+	if(join->pinned == RESET && WIFI_LinkLoad(&join->link) != WIFI_OK) return WIFI_JOIN_STEP_CONNECT;
+
+	join->targeted = SET;
+
+	return WIFI_JOIN_STEP_BSSID;
+#else
+	// C0 scans all channels
+	(void) hwifi;
+	return WIFI_JOIN_STEP_CONNECT;
+#endif
+}
+
+
+/**
+  * @brief  Decides whether the addresses assigned by DHCP are read after
+  * 		the join.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval Next step
+  */
+
+static WIFI_JoinStepTypeDef WIFI_JoinAddressStep(WIFI_HandleTypeDef* hwifi){
+
+	if(hwifi->DHCP != SET) return WIFI_JoinSaveStep(hwifi);
+
+	if(hwifi->lease.applied == RESET) return WIFI_JOIN_STEP_SETTINGS;
+
+	// The reused lease is checked by WIFI_LeaseProcess()
+	hwifi->stats.leaseJoins++;
+	hwifi->lease.revalidate = SET;
+	hwifi->join.reason = WIFI_JOIN_REASON_LEASE;
+	WIFI_JoinPost(hwifi, WIFI_JOIN_DHCP);
+
+	return WIFI_JoinSaveStep(hwifi);
+}
+
+
+/**
+  * @brief  Decides whether the settings are saved in the module, so the next
+  * 		boot can skip them. A reused lease is not saved, since the profile
+  * 		has to request DHCP.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval Next step
+  */
+
+static WIFI_JoinStepTypeDef WIFI_JoinSaveStep(WIFI_HandleTypeDef* hwifi){
+
+	if(hwifi->join.configured == SET && hwifi->lease.applied == RESET) return WIFI_JOIN_STEP_SAVE;
+
+	return WIFI_JoinFinish(hwifi, WIFI_OK, WIFI_JOIN_REASON_NONE);
+}
+
+
+/**
+  * @brief  Ends the join and reports the result.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  status: Result of the join
+  * @param  reason: Cause of a failure
+  * @retval WIFI_JOIN_STEP_IDLE
+  */
+
+static WIFI_JoinStepTypeDef WIFI_JoinFinish(WIFI_HandleTypeDef* hwifi, WIFI_StatusTypeDef status, WIFI_JoinReasonTypeDef reason){
+
+	hwifi->join.result = status;
+	hwifi->join.reason = reason;
+	BLOG("wifi: join finished with status %d, reason %d, after %lu ms", status, reason, HAL_GetTick() - hwifi->join.startTick);
+	WIFI_JoinPost(hwifi, (status == WIFI_OK) ? WIFI_JOIN_CONNECTED : WIFI_JOIN_FAILED);
+
+	return WIFI_JOIN_STEP_IDLE;
+}
+
+
+/**
+  * @brief  Reports a join event with the pending reason and its timing.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  phase: Phase the join entered
+  * @retval None
+  */
+
+static void WIFI_JoinPost(WIFI_HandleTypeDef* hwifi, WIFI_JoinPhaseTypeDef phase){
+
+	WIFI_JoinTypeDef* join = &hwifi->join;
+	WIFI_JoinEventTypeDef event;
+	uint32_t now = HAL_GetTick();
+
+	event.phase = phase;
+	event.reason = join->reason;
+	event.elapsed = now - join->startTick;
+	event.duration = now - join->eventTick;
+
+	join->eventTick = now;
+	join->reason = WIFI_JOIN_REASON_NONE;
+
+	if(join->callback != NULL) join->callback(hwifi, &event, join->context);
+}
+
+
+/**
+  * @brief  Queues a join command with a string argument.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  prefix: Command, e.g. "C1="
+  * @param  value: Argument, NULL for none
+  * @param  timeout: ms until the response has to be complete
+  * @retval WIFI_StatusTypeDef
+  */
+
+static WIFI_StatusTypeDef WIFI_JoinSubmitString(WIFI_HandleTypeDef* hwifi, const char* prefix, const char* value, uint32_t timeout){
+
+	WIFI_AsyncCommandTypeDef* slot = WIFI_AllocateAsyncCommand(hwifi, NULL, 0, NULL, WIFI_ASYNC_RX_SIZE, WIFI_JoinCompleted, NULL);
+	uint16_t valueLength = (value == NULL) ? 0 : strnlen(value, WIFI_CMD_STRING_MAX_LENGTH + 1);
+
+	if(slot == NULL) return WIFI_BUSY;
+
+	slot->sizeCmd = WIFI_FormatCommand(slot->cmd, sizeof(slot->cmd), prefix, value, valueLength) + 1;
+	if(slot->sizeCmd == 1){
+		WIFI_ReleaseAsyncCommand(slot);
+		return WIFI_ERROR;
+	}
+	slot->timeout = timeout;
+
+	hwifi->async.count++;
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Queues a join command with a number as argument.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  prefix: Command, e.g. "C3="
+  * @param  value: Argument
+  * @retval WIFI_StatusTypeDef
+  */
+
+static WIFI_StatusTypeDef WIFI_JoinSubmitUint(WIFI_HandleTypeDef* hwifi, const char* prefix, uint32_t value){
+
+	return WIFI_SubmitCommandUint(hwifi, prefix, value, WIFI_JoinCompleted, NULL);
+}
+
+
+/**
+  * @brief  Queues a join command with an IP address as argument.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  prefix: Command, e.g. "C6="
+  * @param  ip: Argument
+  * @retval WIFI_StatusTypeDef
+  */
+
+static WIFI_StatusTypeDef WIFI_JoinSubmitIP(WIFI_HandleTypeDef* hwifi, const char* prefix, const WIFI_IPAddressTypeDef* ip){
+
+#if WIFI_FOOTPRINT == WIFI_FOOTPRINT_SMALL
+	char address[WIFI_IP_STRING_SIZE];
+
+	WIFI_IPToString(*ip, address, sizeof(address));
+
+	return WIFI_JoinSubmitString(hwifi, prefix, address, WIFI_TIMEOUT_TIME);
+#else
+	return WIFI_JoinSubmitString(hwifi, prefix, *ip, WIFI_TIMEOUT_TIME);
+#endif
+}
+
+
+#ifdef WIFI_USE_TARGETED_JOIN
+/**
+  * @brief  Takes BSSID and channel of the joined access point from the
+  * 		link info response.
+  * @param  response: Parsed response
+  * @param  link: Filled with BSSID and channel
+  * @retval WIFI_StatusTypeDef
+  */
+
+static WIFI_StatusTypeDef WIFI_JoinParseLink(const WIFI_ResponseTypeDef* response, WIFI_LinkTypeDef* link){
+
+	char channel[4];
+
+	if(WIFI_LINK_BSSID_FIELD >= response->fieldCount) return WIFI_ERROR;
+	if(WIFI_CopyField(response, WIFI_LINK_CHANNEL_FIELD, channel, sizeof(channel)) != WIFI_OK) return WIFI_ERROR;
+
+	if(WIFI_StringToBSSID(response->fields[WIFI_LINK_BSSID_FIELD].start, response->fields[WIFI_LINK_BSSID_FIELD].length, link->bssid) != WIFI_OK) return WIFI_ERROR;
+	link->channel = strtoul(channel, NULL, 10);
+
+	return WIFI_OK;
+}
+#endif
+
+
+/**
+  * @brief  Adds the duration of a successful join to the histogram.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  start: HAL tick when the join started
+  * @retval None
+  */
+
+static void WIFI_JoinRecordTime(WIFI_HandleTypeDef* hwifi, uint32_t start){
+
+	static const uint32_t bounds[WIFI_JOIN_TIME_BUCKET_COUNT - 1] = WIFI_JOIN_TIME_BUCKETS;
+	uint32_t duration = HAL_GetTick() - start;
+	uint8_t bucket = 0;
+
+	while(bucket < WIFI_JOIN_TIME_BUCKET_COUNT - 1 && duration > bounds[bucket]) bucket++;
+
+	hwifi->stats.joinTime[bucket]++;
+	hwifi->stats.joinTimeSum += duration;
+}
+
+
+/**
+  * @brief  Caches the addresses assigned by DHCP, which are read from the
+  * 		network settings since the join response only contains the IP
+  * 		address.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  response: Parsed network settings
+  * @retval None
+  */
+
+static void WIFI_LeaseCapture(WIFI_HandleTypeDef* hwifi, const WIFI_ResponseTypeDef* response){
+
+	WIFI_LeaseTypeDef* lease = &hwifi->lease;
+
+	if(WIFI_CopyIPField(response, WIFI_SETTINGS_MASK_FIELD, &lease->networkMask) != WIFI_OK ||
+			WIFI_CopyIPField(response, WIFI_SETTINGS_GATEWAY_FIELD, &lease->defaultGateway) != WIFI_OK ||
+			WIFI_CopyIPField(response, WIFI_SETTINGS_DNS_FIELD, &lease->primaryDNSServer) != WIFI_OK) return;
+
+	memcpy(&lease->ipAddress, &hwifi->ipAddress, sizeof(lease->ipAddress));
+	lease->obtainedTick = HAL_GetTick();
+	lease->leaseTime = WIFI_DHCP_LEASE_TIME;
+	lease->valid = SET;
+}
+
+
+/**
+  * @brief  Revalidates a reused DHCP lease in the background by queueing a
+  * 		ping to its gateway. Should be called from the main loop next to
+  * 		WIFI_Process().
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_LeaseProcess(WIFI_HandleTypeDef* hwifi){
+
+	const char* gateway;
+
+	if(hwifi->lease.revalidate != SET || hwifi->async.count > 0) return WIFI_OK;
+
+#if WIFI_FOOTPRINT == WIFI_FOOTPRINT_SMALL
+	char address[WIFI_IP_STRING_SIZE];
+
+	WIFI_IPToString(hwifi->lease.defaultGateway, address, sizeof(address));
+	gateway = address;
+#else
+	gateway = hwifi->lease.defaultGateway;
+#endif
+
+	// Set the ping target, then ping
+	if(WIFI_SubmitCommandString(hwifi, "T1=", gateway, NULL, NULL) != WIFI_OK) return WIFI_BUSY;
+	if(WIFI_SubmitCommandString(hwifi, "T0", NULL, WIFI_LeaseRevalidated, NULL) != WIFI_OK) return WIFI_BUSY;
+
+	hwifi->lease.revalidate = RESET;
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Drops the cached DHCP lease, e.g. after an address conflict, so
+  * 		the next join requests a new one.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval None
+  */
+
+void WIFI_LeaseInvalidate(WIFI_HandleTypeDef* hwifi){
+
+	hwifi->lease.valid = RESET;
+	hwifi->lease.revalidate = RESET;
+}
+
+
+/**
+  * @brief  Completes the ping of WIFI_LeaseProcess(). If the gateway did not
+  * 		answer, the lease is dropped.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  status: Transfer status of the ping
+  * @param  response: Ping response
+  * @param  context: Unused
+  * @retval None
+  */
+
+static void WIFI_LeaseRevalidated(WIFI_HandleTypeDef* hwifi, WIFI_StatusTypeDef status, char* response, void* context){
+
+	WIFI_ResponseTypeDef parsed;
+
+	if(status == WIFI_OK && WIFI_ParseResponse(response, strlen(response) + 1, &parsed) == WIFI_OK){
+		hwifi->stats.leaseRevalidations++;
+	}else{
+		hwifi->stats.leaseRejects++;
+		WIFI_LeaseInvalidate(hwifi);
+	}
+
+#ifdef WIFI_USE_POOL
+	pool_free(response);
+#endif
+}
+
+
+/**
+  * @brief  Takes the IP address assigned by DHCP from the join response.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  response: Parsed join response
+  * @retval WIFI_StatusTypeDef
+  */
+
+static WIFI_StatusTypeDef WIFI_JoinParseIP(WIFI_HandleTypeDef* hwifi, WIFI_ResponseTypeDef* response){
+
+	// If the module's IP address was assigned by DHCP, then parse it
+	// from the response and save it in the Wifi handle.
+	if(hwifi->DHCP == SET){
+		// The IP address is the second field of the join response
+		return WIFI_CopyIPField(response, 1, &hwifi->ipAddress);
+	}
+
+	return WIFI_OK;
+}
+
+/**
+  * @brief  Initialises the module for using the MQTT Protocol
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_MQTTClientInit(WIFI_HandleTypeDef* hwifi){
+
+	STACK_SCOPE(WIFI_MQTTClientInit);
+
+	// Set publish topic
+	WIFI_SendCommandString(hwifi, "PM=0,", hwifi->mqtt.publishTopic);
+
+	// Set subscribe topic
+	WIFI_SendCommandString(hwifi, "PM=1,", hwifi->mqtt.subscribeTopic);
+
+	// Set security mode
+	WIFI_SendCommandUint(hwifi, "PM=2,", hwifi->mqtt.securityMode);
+
+	if(hwifi->mqtt.securityMode == WIFI_MQTT_SECURITY_USER_PW){
+
+		// Set user name
+		WIFI_SendCommandString(hwifi, "PM=3,", hwifi->mqtt.userName);
+
+		// Set password
+		WIFI_SendCommandString(hwifi, "PM=4,", hwifi->mqtt.password);
+
+	} else if(hwifi->mqtt.securityMode == WIFI_MQTT_SECURITY_CERT) {
+		// TODO: Add certificate functionality
+	}
+
+	// Set keep alive time
+	WIFI_SendCommandUint(hwifi, "PM=6,", hwifi->mqtt.keepAlive);
+
+	// Set communication socket
+	WIFI_SelectSocket(hwifi, 0);
+
+	// Set transport protocol
+	WIFI_SendCommandUint(hwifi, "P1=", WIFI_MQTT_PROTOCOL);
+
+	// Set port
+	WIFI_SendCommandUint(hwifi, "P2=", hwifi->port);
+
+	// Set remote IP
+	WIFI_SendCommandString(hwifi, "D0=", hwifi->remoteIpAddress);
+
+	// Set read packet size
+	WIFI_SetReadPacketSize(hwifi, WIFI_READ_PACKET_SIZE);
+
+	// Set read timeout
+	WIFI_SetReadTimeout(hwifi, WIFI_READ_TIMEOUT);
+
+	return WIFI_OK;
+}
+
+/**
+  * @brief  Builds up a connection with the MQTT server and publishes a message.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  message: A char buffer, where the message is contained.
+  * @param  sizeMessage: Message buffer size.
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_MQTTPublish(WIFI_HandleTypeDef* hwifi, char* message, uint16_t sizeMessage){
+
+	STACK_SCOPE(WIFI_MQTTPublish);
+
+	WIFI_StatusTypeDef status;
+
+	// Start client connection
+	if(WIFI_SocketOpen(hwifi, 0, WIFI_SOCKET_CLIENT) != WIFI_OK) return WIFI_ERROR;
+
+	// Send message
+	status = WIFI_SocketSend(hwifi, 0, message, strnlen(message, sizeMessage));
+
+	// Stop client connection, also when sending failed
+	if(WIFI_SocketClose(hwifi, 0) != WIFI_OK) return WIFI_ERROR;
+
+	return status;
+}
+
+/**
+  * @brief  Opens a socket on the Wifi module, either as client connection
+  * 		or as server. The socket must be configured beforehand and stays
+  * 		owned by the driver until WIFI_SocketClose() is called.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  socket: Module socket number (0 to WIFI_MAX_SOCKETS-1)
+  * @param  role: Whether the socket connects as client or listens as server
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SocketOpen(WIFI_HandleTypeDef* hwifi, uint8_t socket, WIFI_SocketRoleTypeDef role){
+
+	STACK_SCOPE(WIFI_SocketOpen);
+
+	WIFI_ResponseTypeDef response;
+
+	if(socket >= WIFI_MAX_SOCKETS || WIFI_IS_SOCKET_OPEN(hwifi, socket)) return WIFI_ERROR;
+
+	if(WIFI_SelectSocket(hwifi, socket) != WIFI_OK) return WIFI_ERROR;
+
+	if(WIFI_SendCommandUint(hwifi, (role == WIFI_SOCKET_SERVER) ? "P5=" : "P6=", 1) != WIFI_OK) return WIFI_ERROR;
+
+	if(WIFI_ParseResponse(wifiRxBuffer, WIFI_RX_BUFFER_SIZE, &response) != WIFI_OK) return WIFI_ERROR;
+
+	if(role == WIFI_SOCKET_SERVER) hwifi->serverSockets |= (1 << socket);
+	else hwifi->clientSockets |= (1 << socket);
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Closes a socket that was opened with WIFI_SocketOpen(). Closing
+  * 		a socket that is not open does nothing, so it is safe to call on
+  * 		every exit path.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  socket: Module socket number
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SocketClose(WIFI_HandleTypeDef* hwifi, uint8_t socket){
+
+	STACK_SCOPE(WIFI_SocketClose);
+
+	const char* prefix;
+
+	if(socket >= WIFI_MAX_SOCKETS || !WIFI_IS_SOCKET_OPEN(hwifi, socket)) return WIFI_OK;
+
+	prefix = (hwifi->serverSockets & (1 << socket)) ? "P5=" : "P6=";
+
+	// The socket is released in any case, the module drops it on errors as well
+	hwifi->serverSockets &= ~(1 << socket);
+	hwifi->clientSockets &= ~(1 << socket);
+
+	if(WIFI_SelectSocket(hwifi, socket) != WIFI_OK) return WIFI_ERROR;
+
+	return WIFI_SendCommandUint(hwifi, prefix, 0);
+}
+
+
+/**
+  * @brief  Closes all sockets that are owned by the driver.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SocketCloseAll(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_StatusTypeDef status = WIFI_OK;
+
+	for(uint8_t socket = 0; socket < WIFI_MAX_SOCKETS; socket++){
+		if(WIFI_SocketClose(hwifi, socket) != WIFI_OK) status = WIFI_ERROR;
+	}
+
+	return status;
+}
+
+
+/**
+  * @brief  Sends data over an open socket. The data is transmitted straight
+  * 		from the caller's buffer behind the S3 command header.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  socket: Module socket number
+  * @param  data: A char buffer, where the data to be sent is saved in.
+  * @param  length: Number of bytes to send
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SocketSend(WIFI_HandleTypeDef* hwifi, uint8_t socket, const char* data, uint16_t length){
+
+	STACK_SCOPE(WIFI_SocketSend);
+
+	char bCmd[WIFI_CMD_BUFFER_SIZE(WIFI_CMD_UINT_MAX_LENGTH)];
+	uint16_t cmdLength;
+	WIFI_ResponseTypeDef response;
+
+	if(socket >= WIFI_MAX_SOCKETS || !WIFI_IS_SOCKET_OPEN(hwifi, socket)) return WIFI_ERROR;
+
+	if(WIFI_SelectSocket(hwifi, socket) != WIFI_OK) return WIFI_ERROR;
+
+	cmdLength = WIFI_FormatCommandUint(bCmd, sizeof(bCmd), "S3=", length);
+	if(cmdLength == 0) return WIFI_ERROR;
+
+	if(WIFI_SendATCommandData(hwifi, bCmd, cmdLength + 1, data, length, wifiRxBuffer, WIFI_RX_BUFFER_SIZE) != WIFI_OK) return WIFI_ERROR;
+
+	return WIFI_ParseResponse(wifiRxBuffer, WIFI_RX_BUFFER_SIZE, &response);
+}
+
+
+/**
+  * @brief  Reads pending data of an open socket. The payload is received
+  * 		straight into buffer, without being trimmed or parsed, so binary
+  * 		data is kept as is. It is followed by a \0 for text protocols,
+  * 		so at most size - 1 and WIFI_MAX_READ_PACKET_SIZE bytes are read
+  * 		per call.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  socket: Module socket number
+  * @param  buffer: A char buffer, where the received data will be saved in.
+  * @param  size: Buffer size
+  * @param  received: Number of received bytes
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SocketReceive(WIFI_HandleTypeDef* hwifi, uint8_t socket, char* buffer, uint16_t size, uint16_t* received){
+
+	STACK_SCOPE(WIFI_SocketReceive);
+
+	uint16_t packetSize;
+
+	*received = 0;
+
+	if(socket >= WIFI_MAX_SOCKETS || !WIFI_IS_SOCKET_OPEN(hwifi, socket) || size < 2) return WIFI_ERROR;
+
+	// The module does not accept a larger read packet size
+	packetSize = size - 1;
+	if(packetSize > WIFI_MAX_READ_PACKET_SIZE) packetSize = WIFI_MAX_READ_PACKET_SIZE;
+
+	if(WIFI_SelectSocket(hwifi, socket) != WIFI_OK) return WIFI_ERROR;
+
+	if(WIFI_SetReadPacketSize(hwifi, packetSize) != WIFI_OK) return WIFI_ERROR;
+
+	if(WIFI_ReceivePayload(hwifi, buffer, packetSize, received) != WIFI_OK) return WIFI_ERROR;
+
+	buffer[*received] = '\0';
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Sets the maximum number of bytes the module returns per read.
+  * 		The command is skipped if the size is already set.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  size: Read packet size in bytes
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SetReadPacketSize(WIFI_HandleTypeDef* hwifi, uint16_t size){
+
+	if(hwifi->readPacketSize == size) return WIFI_OK;
+
+	if(WIFI_SendCommandUint(hwifi, "R1=", size) != WIFI_OK) return WIFI_ERROR;
+
+	hwifi->readPacketSize = size;
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Sets the time R0 waits for data. The command is skipped if the
+  * 		timeout is already set.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  timeout: ms, at most WIFI_MAX_READ_TIMEOUT, since the driver
+  * 		gives up on R0 after WIFI_TIMEOUT_TIME
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SetReadTimeout(WIFI_HandleTypeDef* hwifi, uint32_t timeout){
+
+	if(timeout > WIFI_MAX_READ_TIMEOUT) timeout = WIFI_MAX_READ_TIMEOUT;
+
+	if(hwifi->readTimeout == timeout) return WIFI_OK;
+
+	if(WIFI_SendCommandUint(hwifi, "R2=", timeout) != WIFI_OK) return WIFI_ERROR;
+
+	hwifi->readTimeout = timeout;
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Opens a TCP client connection on WIFI_TCP_SOCKET. A host name is
+  * 		resolved by the module first, and so is anything that is not a
+  * 		complete IPv4 address.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  host: Host name or IPv4 address
+  * @param  port: Remote port
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_TCPConnect(WIFI_HandleTypeDef* hwifi, const char* host, uint16_t port){
+
+	STACK_SCOPE(WIFI_TCPConnect);
+
+	WIFI_ResponseTypeDef response;
+	char address[WIFI_IP_STRING_SIZE];
+	uint32_t ip;
+	uint16_t length;
+
+	if(host == NULL || host[0] == '\0') return WIFI_ERROR;
+	if(WIFI_IS_SOCKET_OPEN(hwifi, WIFI_TCP_SOCKET)) return WIFI_ERROR;
+
+	length = strlen(host);
+
+	// Only a complete IPv4 address is used as is, anything else is looked up
+	if(WIFI_StringToIP(host, length, &ip) == WIFI_OK){
+		memcpy(address, host, length + 1);
+	}else{
+		if(WIFI_SendCommandString(hwifi, "D0=", host) != WIFI_OK) return WIFI_ERROR;
+		if(WIFI_ParseResponse(wifiRxBuffer, WIFI_RX_BUFFER_SIZE, &response) != WIFI_OK || response.fieldCount == 0) return WIFI_ERROR;
+		if(WIFI_StringToIP(response.fields[0].start, response.fields[0].length, &ip) != WIFI_OK) return WIFI_ERROR;
+		memcpy(address, response.fields[0].start, response.fields[0].length);
+		address[response.fields[0].length] = '\0';
+	}
+
+	// Set communication socket
+	if(WIFI_SelectSocket(hwifi, WIFI_TCP_SOCKET) != WIFI_OK) return WIFI_ERROR;
+
+	// Set transport protocol
+	if(WIFI_SendCommandUint(hwifi, "P1=", WIFI_TCP_PROTOCOL) != WIFI_OK) return WIFI_ERROR;
+
+	// Set remote IP and port
+	if(WIFI_SendCommandString(hwifi, "P3=", address) != WIFI_OK) return WIFI_ERROR;
+	if(WIFI_SendCommandUint(hwifi, "P4=", port) != WIFI_OK) return WIFI_ERROR;
+
+	return WIFI_SocketOpen(hwifi, WIFI_TCP_SOCKET, WIFI_SOCKET_CLIENT);
+}
+
+
+/**
+  * @brief  Closes the connection of WIFI_TCPConnect().
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_TCPClose(WIFI_HandleTypeDef* hwifi){
+
+	return WIFI_SocketClose(hwifi, WIFI_TCP_SOCKET);
+}
+
+
+/**
+  * @brief  Sends data over the connection of WIFI_TCPConnect(). Data longer
+  * 		than WIFI_MAX_SEND_SIZE is split into several S3 commands, each
+  * 		transmitted straight from the caller's buffer.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  buffer: Data to send
+  * @param  length: Number of bytes to send
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_Send(WIFI_HandleTypeDef* hwifi, const char* buffer, uint32_t length){
+
+	STACK_SCOPE(WIFI_Send);
+
+	uint16_t chunk;
+
+	for(uint32_t sent = 0; sent < length; sent += chunk){
+		chunk = (length - sent > WIFI_MAX_SEND_SIZE) ? WIFI_MAX_SEND_SIZE : length - sent;
+		if(WIFI_SocketSend(hwifi, WIFI_TCP_SOCKET, buffer + sent, chunk) != WIFI_OK) return WIFI_ERROR;
+	}
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Receives data of the connection of WIFI_TCPConnect() with as many
+  * 		R0 commands as needed. Each payload is received straight into
+  * 		its place in the caller's buffer. Each R0 waits at most for the
+  * 		time that is left, but no longer than WIFI_MAX_READ_TIMEOUT.
+  * 		Returns once length bytes were received or timeout ms passed.
+  * 		Bytes of the buffer behind the received data may be overwritten.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  buffer: A char buffer, where the received data will be saved in.
+  * @param  length: Number of bytes to receive at most
+  * @param  timeout: ms
+  * @param  received: Number of received bytes
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_Recv(WIFI_HandleTypeDef* hwifi, char* buffer, uint32_t length, uint32_t timeout, uint32_t* received){
+
+	STACK_SCOPE(WIFI_Recv);
+
+	uint32_t start = HAL_GetTick();
+	uint32_t elapsed;
+	uint32_t remaining;
+	uint16_t chunk;
+	uint16_t count;
+
+	*received = 0;
+
+	if(!WIFI_IS_SOCKET_OPEN(hwifi, WIFI_TCP_SOCKET)) return WIFI_ERROR;
+
+	if(WIFI_SelectSocket(hwifi, WIFI_TCP_SOCKET) != WIFI_OK) return WIFI_ERROR;
+
+	while(*received < length){
+		elapsed = HAL_GetTick() - start;
+		if(elapsed >= timeout) break;
+
+		remaining = timeout - elapsed;
+		chunk = (length - *received > WIFI_MAX_READ_PACKET_SIZE) ? WIFI_MAX_READ_PACKET_SIZE : length - *received;
+
+		if(WIFI_SetReadTimeout(hwifi, remaining) != WIFI_OK) return WIFI_ERROR;
+		if(WIFI_SetReadPacketSize(hwifi, chunk) != WIFI_OK) return WIFI_ERROR;
+		if(WIFI_ReceivePayload(hwifi, buffer + *received, chunk, &count) != WIFI_OK) return WIFI_ERROR;
+
+		*received += count;
+
+		// The read waited for all of the remaining time without data
+		if(count == 0 && remaining <= WIFI_MAX_READ_TIMEOUT) break;
+	}
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Sends R0 and receives the payload of the response straight into
+  * 		buffer, through WIFI_Transaction().
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  buffer: Payload buffer
+  * @param  size: Read packet size that is set, i.e. the longest payload
+  * @param  received: Number of payload bytes
+  * @retval WIFI_StatusTypeDef
+  */
+
+static WIFI_StatusTypeDef WIFI_ReceivePayload(WIFI_HandleTypeDef* hwifi, char* buffer, uint16_t size, uint16_t* received){
+
+	STACK_SCOPE(WIFI_ReceivePayload);
+
+	char bCmd[] = "R0\r";
+	WIFI_PayloadTypeDef rx = { .buffer = buffer, .size = size, .received = 0 };
+	WIFI_StatusTypeDef status;
+
+	status = WIFI_Transaction(hwifi, bCmd, sizeof(bCmd) - 1, NULL, 0, WIFI_PayloadReceive, &rx);
+	*received = (status == WIFI_OK) ? rx.received : 0;
+
+	return status;
+}
+
+
+/**
+  * @brief  Receiver of WIFI_ReceivePayload(). The leading "\r\n" is dropped,
+  * 		the whole words of the payload go straight into the caller's
+  * 		buffer, and the bytes behind them are kept in a small tail
+  * 		buffer. Either way WIFI_MSG_READ_END has to follow the payload.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  context: WIFI_PayloadTypeDef
+  * @retval WIFI_StatusTypeDef
+  */
 
-		// Set module's primary DNS server
-		msgLength = sprintf(wifiTxBuffer, "C9=%s\r", hwifi->primaryDNSServer);
-		WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+static WIFI_StatusTypeDef WIFI_PayloadReceive(WIFI_HandleTypeDef* hwifi, void* context){
 
+	WIFI_PayloadTypeDef* rx = context;
+	char prefix[2];
+	char tail[WIFI_RESPONSE_OVERHEAD + 2];
+	uint16_t words = rx->size & ~1;
+	uint16_t cnt = 0;
+	uint16_t tailCnt = 0;
+	uint16_t dropped = 0;
+	uint16_t end = sizeof(WIFI_MSG_READ_END) - 1;
+	WIFI_StatusTypeDef status;
+
+	// The first word is the "\r\n" in front of the payload
+	status = WIFI_SPI_ReceiveBlock(hwifi, prefix, sizeof(prefix), &cnt);
+	if(status == WIFI_OK && (cnt != sizeof(prefix) || prefix[0] != '\r' || prefix[1] != '\n')) status = WIFI_ERROR;
+
+	if(status == WIFI_OK) status = WIFI_SPI_ReceiveBlock(hwifi, rx->buffer, words, &cnt);
+	if(status == WIFI_OK && cnt == words) status = WIFI_SPI_ReceiveBlock(hwifi, tail, sizeof(tail), &tailCnt);
+
+	// The response is longer than the read packet size allows
+	if(status == WIFI_OK && WIFI_IS_CMDDATA_READY()){
+		WIFI_SPI_ReceiveWords(hwifi, NULL, 0, &dropped);
+		if(currentStats != NULL) currentStats->bytesRx += dropped;
+		status = WIFI_ERROR;
 	}
 
-	// Join the network
-	msgLength = sprintf(wifiTxBuffer, "C0\r");
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	if(status != WIFI_OK) return status;
 
-	// If there was an error, call the error handler
-	if(strstr(wifiRxBuffer, "ERROR") != NULL) Error_Handler();
+	cnt += tailCnt;
 
-	// If the module's IP address was assigned by DHCP, then parse it
-	// from the response and save it in the Wifi handle.
-	if(hwifi->DHCP == SET){
-		// The IP address is between the first and second comma
-		char* startPos = strstr(wifiRxBuffer, ",");
-		char* endPos = strstr(startPos+1, ",");
+	// Drop the padding, the end marker closes with a space
+	while(cnt > 0 && ((cnt - 1 < words) ? rx->buffer[cnt - 1] : tail[cnt - 1 - words]) == (char) WIFI_RX_PADDING) cnt--;
 
-		// Check whether the commas have been found
-		if(startPos == NULL || endPos == NULL) Error_Handler();
+	if(cnt < end || cnt - end > rx->size) return WIFI_ERROR;
 
-		// Copy the IP address from the response buffer into the Wifi handle
-		// For n set IP_length+1, because the ending char \0 must be considered
-		snprintf(hwifi->ipAddress, endPos - startPos, startPos+1);
+	for(uint16_t i = 0; i < end; i++){
+		uint16_t index = cnt - end + i;
+		if(((index < words) ? rx->buffer[index] : tail[index - words]) != WIFI_MSG_READ_END[i]) return WIFI_ERROR;
 	}
 
+	// A payload of odd size ends with the first byte of the tail
+	if(cnt - end > words) rx->buffer[words] = tail[0];
+
+	rx->received = cnt - end;
+
 	return WIFI_OK;
 }
 
+
 /**
-  * @brief  Initialises the module for using the MQTT Protocol
+  * @brief  Selects the socket that the following P, S and R commands refer
+  * 		to. The command is skipped if the socket is already selected.
   * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  socket: Module socket number
   * @retval WIFI_StatusTypeDef
   */
 
-WIFI_StatusTypeDef WIFI_MQTTClientInit(WIFI_HandleTypeDef* hwifi){
+static WIFI_StatusTypeDef WIFI_SelectSocket(WIFI_HandleTypeDef* hwifi, uint8_t socket){
 
-	int msgLength = 0;
+	if(hwifi->activeSocket == socket) return WIFI_OK;
 
-	// Set publish topic
-	msgLength = sprintf(wifiTxBuffer, "PM=0,%s\r", hwifi->mqtt.publishTopic);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	if(WIFI_SendCommandUint(hwifi, "P0=", socket) != WIFI_OK) return WIFI_ERROR;
 
-	// Set subscribe topic
-	msgLength = sprintf(wifiTxBuffer, "PM=1,%s\r", hwifi->mqtt.subscribeTopic);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	hwifi->activeSocket = socket;
 
-	// Set security mode
-	msgLength = sprintf(wifiTxBuffer, "PM=2,%d\r", hwifi->mqtt.securityMode);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	return WIFI_OK;
+}
 
-	if(hwifi->mqtt.securityMode == WIFI_MQTT_SECURITY_USER_PW){
 
-		// Set user name
-		msgLength = sprintf(wifiTxBuffer, "PM=3,%s\r", hwifi->mqtt.userName);
-		WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+/**
+  * @brief  Copies the command statistics of the driver.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  stats: Snapshot of the statistics
+  * @retval None
+  */
 
-		// Set password
-		msgLength = sprintf(wifiTxBuffer, "PM=4,%s\r", hwifi->mqtt.password);
-		WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+void WIFI_GetStats(WIFI_HandleTypeDef* hwifi, WIFI_StatsTypeDef* stats){
 
-	} else if(hwifi->mqtt.securityMode == WIFI_MQTT_SECURITY_CERT) {
-		// TODO: Add certificate functionality
-	}
+	memcpy(stats, &hwifi->stats, sizeof(WIFI_StatsTypeDef));
+}
 
-	// Set keep alive time
-	msgLength = sprintf(wifiTxBuffer, "PM=6,%u\r", hwifi->mqtt.keepAlive);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
 
-	// Set communication socket
-	msgLength = sprintf(wifiTxBuffer, "P0=0\r");
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+/**
+  * @brief  Clears the command statistics of the driver.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval None
+  */
 
-	// Set transport protocol
-	msgLength = sprintf(wifiTxBuffer, "P1=%d\r", WIFI_MQTT_PROTOCOL);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+void WIFI_ResetStats(WIFI_HandleTypeDef* hwifi){
 
-	// Set port
-	msgLength = sprintf(wifiTxBuffer, "P2=%u\r", hwifi->port);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	memset(&hwifi->stats, 0, sizeof(WIFI_StatsTypeDef));
+}
 
-	// Set remote IP
-	msgLength = sprintf(wifiTxBuffer, "D0=%s\r", hwifi->remoteAddress);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
 
-	// Set read packet size
-	msgLength = sprintf(wifiTxBuffer, "R1=%d\r", WIFI_READ_PACKET_SIZE);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+/**
+  * @brief  Deepest stack usage since stack_paint() was called at boot. The
+  * 		peak depth of each driver API is recorded by its STACK_SCOPE()
+  * 		probe, see stack_get_probe() and stack_dump().
+  * @retval Used stack in bytes
+  */
 
-	// Set read timeout
-	msgLength = sprintf(wifiTxBuffer, "R2=%d\r", WIFI_READ_TIMEOUT);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+uint32_t WIFI_StackHighWater(void){
+
+	return stack_high_water();
+}
+
+
+/**
+  * @brief  Reads the CMD/DATA READY line, used as wake-up condition of the
+  * 		low power waits.
+  * @retval SET if the module is ready, RESET otherwise
+  */
+
+FlagStatus WIFI_IsCmdDataReady(void){
+
+	return WIFI_IS_CMDDATA_READY() ? SET : RESET;
+}
+
+
+/**
+  * @brief  Spins until the module raises CMD/DATA READY.
+  * @param  timeout: Timeout in ms
+  * @retval WIFI_OK if the module is ready, WIFI_TIMEOUT otherwise
+  */
+
+WIFI_StatusTypeDef WIFI_WaitCmdDataReady(uint32_t timeout){
+
+	uint32_t start = HAL_GetTick();
+
+	while(!WIFI_IS_CMDDATA_READY()){
+		if(HAL_GetTick() - start >= timeout) return WIFI_TIMEOUT;
+	}
 
 	return WIFI_OK;
 }
 
+
+/**
+  * @brief  Selects the statistics of a command by its first two chars and
+  * 		counts the transaction. Receive and parse times of the command
+  * 		are added to it until the next command starts.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  bCmd: Command
+  * @param  sizeTx: Number of transmitted bytes
+  * @retval Statistics of the command class
+  */
+
+static WIFI_CmdStatsTypeDef* WIFI_StartStats(WIFI_HandleTypeDef* hwifi, const char* bCmd, uint16_t sizeTx){
+
+	WIFI_CmdClassTypeDef cmdClass = WIFI_CMD_CLASS_OTHER;
+
+	switch(bCmd[0]){
+	case 'C': cmdClass = WIFI_CMD_CLASS_C; break;
+	case 'P': cmdClass = (bCmd[1] == 'M') ? WIFI_CMD_CLASS_PM : WIFI_CMD_CLASS_P; break;
+	case 'S': if(bCmd[1] == '3') cmdClass = WIFI_CMD_CLASS_S3; break;
+	case 'R': if(bCmd[1] == '0') cmdClass = WIFI_CMD_CLASS_R0; break;
+	case 'M': if(bCmd[1] == 'R') cmdClass = WIFI_CMD_CLASS_MR; break;
+	default: break;
+	}
+
+	hwifi->power.lastActivity = HAL_GetTick();
+	if(hwifi->boot.firstCommandTick == 0) hwifi->boot.firstCommandTick = hwifi->power.lastActivity;
+
+	currentStats = &hwifi->stats.cmd[cmdClass];
+	currentStats->count++;
+	currentStats->bytesTx += sizeTx;
+
+	return currentStats;
+}
+
+
 /**
-  * @brief  Builds up a connection with the MQTT server and publishes a message.
+  * @brief  Reserves the next free slot of the command queue. The slot only
+  * 		becomes visible to WIFI_Process() once async.count is increased.
   * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
-  * @param  message: A char buffer, where the message is contained.
-  * @param  sizeMessage: Message buffer size.
+  * @param  data: Payload buffer (may be NULL)
+  * @param  sizeData: Number of payload bytes
+  * @param  bRx: Response buffer, wifiRxBuffer or a pool block is used if NULL
+  * @param  sizeRx: Response buffer size
+  * @param  callback: Completion callback (may be NULL)
+  * @param  context: Passed through to the callback
+  * @retval Queue slot, NULL if the queue or the pool is full
+  */
+
+static WIFI_AsyncCommandTypeDef* WIFI_AllocateAsyncCommand(WIFI_HandleTypeDef* hwifi, const char* data, uint16_t sizeData, char* bRx, uint16_t sizeRx, WIFI_CallbackTypeDef callback, void* context){
+
+	WIFI_AsyncCommandTypeDef* slot;
+
+	if(hwifi->async.count >= WIFI_ASYNC_QUEUE_SIZE) return NULL;
+
+	if(hwifi->async.count + 1 > hwifi->stats.queueHighWater) hwifi->stats.queueHighWater = hwifi->async.count + 1;
+
+	slot = &hwifi->async.queue[(hwifi->async.head + hwifi->async.count) % WIFI_ASYNC_QUEUE_SIZE];
+	slot->data = data;
+	slot->sizeData = sizeData;
+	slot->bRx = bRx;
+	slot->sizeRx = sizeRx;
+	slot->pooled = RESET;
+	slot->timeout = WIFI_TIMEOUT_TIME;
+	slot->callback = callback;
+	slot->context = context;
+
+	if(bRx == NULL){
+#ifdef WIFI_USE_POOL
+		// Every queued command gets its own response buffer, which is handed to the callback
+		slot->bRx = pool_alloc(sizeRx);
+		if(slot->bRx == NULL) return NULL;
+		slot->sizeRx = pool_block_size(slot->bRx);
+		slot->pooled = SET;
+#else
+		slot->bRx = wifiRxBuffer;
+		slot->sizeRx = WIFI_RX_BUFFER_SIZE;
+#endif
+	}
+
+	return slot;
+}
+
+
+/**
+  * @brief  Returns the response buffer of a queue slot to the pool, if it
+  * 		was taken from there.
+  * @param  slot: Queue slot
+  * @retval None
+  */
+
+static void WIFI_ReleaseAsyncCommand(WIFI_AsyncCommandTypeDef* slot){
+
+#ifdef WIFI_USE_POOL
+	if(slot->pooled == SET) pool_free(slot->bRx);
+#endif
+	slot->pooled = RESET;
+}
+
+
+/**
+  * @brief  Compares the first length chars of str with prefix, without
+  * 		calling strncmp() from flash. It is placed in SRAM together with
+  * 		WIFI_SplitResponse(), which calls it.
+  * @param  str: Chars to compare
+  * @param  prefix: Expected chars
+  * @param  length: Number of chars to compare
+  * @retval 1 if they match, 0 otherwise
+  */
+
+WIFI_RAMFUNC static uint8_t WIFI_MatchPrefix(const char* str, const char* prefix, uint16_t length){
+
+	for(uint16_t i = 0; i < length; i++){
+		if(str[i] != prefix[i]) return 0;
+	}
+
+	return 1;
+}
+
+
+/**
+  * @brief  Splits a module response for WIFI_ParseResponse().
+  * @param  buffer: A char buffer, where the received response is saved in.
+  * @param  size: Buffer size
+  * @param  response: Parsed response
+  * @retval None
+  */
+
+WIFI_RAMFUNC static void WIFI_SplitResponse(const char* buffer, uint16_t size, WIFI_ResponseTypeDef* response){
+
+	uint16_t end = 0;
+	uint16_t payloadStart = 0;
+	uint16_t payloadEnd = 0;
+	uint16_t lineStart = 0;
+	uint8_t i = 0;
+
+	response->status = WIFI_RESPONSE_INCOMPLETE;
+	response->payload = buffer;
+	response->payloadLength = 0;
+	response->fieldCount = 1;
+	response->fields[0].start = buffer;
+
+	// Find the end of the response and remember where each field starts
+	for(end = 0; end < size && buffer[end] != '\0'; end++){
+		if(buffer[end] == ',' && response->fieldCount < WIFI_MAX_RESPONSE_FIELDS){
+			response->fields[response->fieldCount++].start = &buffer[end + 1];
+		}
+	}
+
+	// Strip the prompt and the line break in front of it
+	payloadEnd = end;
+	if(payloadEnd >= 2 && WIFI_MatchPrefix(&buffer[payloadEnd - 2], WIFI_MSG_PROMPT, 2)) payloadEnd -= 2;
+	while(payloadEnd > 0 && (buffer[payloadEnd - 1] == '\r' || buffer[payloadEnd - 1] == '\n')) payloadEnd--;
+
+	// The status trailer is the last line of the response
+	lineStart = payloadEnd;
+	while(lineStart > 0 && buffer[lineStart - 1] != '\n') lineStart--;
+
+	if(payloadEnd - lineStart == sizeof(WIFI_MSG_STATUS_OK) - 1
+			&& WIFI_MatchPrefix(&buffer[lineStart], WIFI_MSG_STATUS_OK, sizeof(WIFI_MSG_STATUS_OK) - 1)){
+		response->status = WIFI_RESPONSE_OK;
+	}
+	else if(payloadEnd - lineStart >= sizeof(WIFI_MSG_STATUS_ERROR) - 1
+			&& WIFI_MatchPrefix(&buffer[lineStart], WIFI_MSG_STATUS_ERROR, sizeof(WIFI_MSG_STATUS_ERROR) - 1)){
+		response->status = WIFI_RESPONSE_ERROR;
+	}
+	else{
+		// No status trailer, so the payload is unterminated
+		lineStart = payloadEnd;
+	}
+
+	// Cut the status line and the line breaks around the payload
+	payloadEnd = lineStart;
+	while(payloadEnd > 0 && (buffer[payloadEnd - 1] == '\r' || buffer[payloadEnd - 1] == '\n')) payloadEnd--;
+	while(payloadStart < payloadEnd && (buffer[payloadStart] == '\r' || buffer[payloadStart] == '\n')) payloadStart++;
+
+	response->payload = &buffer[payloadStart];
+	response->payloadLength = payloadEnd - payloadStart;
+
+	// Drop fields that were found in the trailer and calculate the field lengths
+	response->fields[0].start = response->payload;
+	for(i = 1; i < response->fieldCount; i++){
+		if(response->fields[i].start > &buffer[payloadEnd]) break;
+	}
+	response->fieldCount = i;
+
+	for(i = 0; i < response->fieldCount; i++){
+		const char* fieldEnd = (i + 1 < response->fieldCount) ? response->fields[i + 1].start - 1 : &buffer[payloadEnd];
+		response->fields[i].length = fieldEnd - response->fields[i].start;
+	}
+}
+
+
+/**
+  * @brief  Classifies a module response and splits its payload into comma
+  * 		separated fields in a single pass. The fields point into buffer,
+  * 		so nothing is copied and buffer must outlive the response.
+  * @param  buffer: A char buffer, where the received response is saved in.
+  * @param  size: Buffer size
+  * @param  response: Parsed response (status, payload and field spans)
+  * @retval WIFI_OK if the module answered with OK, WIFI_ERROR otherwise
+  */
+
+WIFI_StatusTypeDef WIFI_ParseResponse(const char* buffer, uint16_t size, WIFI_ResponseTypeDef* response){
+
+	uint32_t start = profiler_counter();
+	PROFILE_SCOPE(WIFI_ParseResponse);
+
+	WIFI_SplitResponse(buffer, size, response);
+
+	if(currentStats != NULL){
+		if(response->status != WIFI_RESPONSE_OK) currentStats->errors++;
+		currentStats->parseCycles += profiler_counter() - start;
+	}
+
+	return (response->status == WIFI_RESPONSE_OK) ? WIFI_OK : WIFI_ERROR;
+}
+
+
+/**
+  * @brief  Copies a field of a parsed response as c string into dst.
+  * @param  response: Parsed response
+  * @param  index: Index of the field, starting with 0
+  * @param  dst: A char buffer, where the field will be saved in.
+  * @param  size: Destination buffer size (including \0)
   * @retval WIFI_StatusTypeDef
   */
 
-WIFI_StatusTypeDef WIFI_MQTTPublish(WIFI_HandleTypeDef* hwifi, char* message, uint16_t sizeMessage){
+WIFI_StatusTypeDef WIFI_CopyField(const WIFI_ResponseTypeDef* response, uint8_t index, char* dst, uint16_t size){
 
-	int msgLength = 0;
+	if(index >= response->fieldCount || response->fields[index].length >= size) return WIFI_ERROR;
 
-	// Start client connection
-	msgLength = sprintf(wifiTxBuffer, "P6=1\r");
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	memcpy(dst, response->fields[index].start, response->fields[index].length);
+	dst[response->fields[index].length] = '\0';
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Formats an IPv4 address stored by WIFI_IP() in dotted notation.
+  * @param  ip: IP address
+  * @param  dst: A char buffer, where the address will be saved in.
+  * @param  size: Destination buffer size, at least WIFI_IP_STRING_SIZE
+  * @retval Length of the address, 0 if dst is too small
+  */
+
+uint16_t WIFI_IPToString(uint32_t ip, char* dst, uint16_t size){
+
+	int length = snprintf(dst, size, "%u.%u.%u.%u", (unsigned)(ip & 0xFF), (unsigned)((ip >> 8) & 0xFF),
+			(unsigned)((ip >> 16) & 0xFF), (unsigned)(ip >> 24));
+
+	return (length < 0 || length >= size) ? 0 : length;
+}
+
+
+/**
+  * @brief  Parses an IPv4 address in dotted notation.
+  * @param  src: A char buffer, which contains the address (not necessarily \0 terminated).
+  * @param  length: Address length
+  * @param  ip: Filled with the address in the format of WIFI_IP()
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_StringToIP(const char* src, uint16_t length, uint32_t* ip){
+
+	uint32_t value = 0;
+	uint16_t octet = 0;
+	uint8_t digits = 0;
+	uint8_t dots = 0;
+
+	for(uint16_t i = 0; i <= length; i++){
+		if(i == length || src[i] == '.'){
+			if(digits == 0 || octet > 255) return WIFI_ERROR;
+			value |= (uint32_t) octet << (8 * dots);
+			if(i < length && ++dots > 3) return WIFI_ERROR;
+			octet = 0;
+			digits = 0;
+		}
+		else if(src[i] >= '0' && src[i] <= '9' && digits < 3){
+			octet = octet * 10 + (src[i] - '0');
+			digits++;
+		}
+		else{
+			return WIFI_ERROR;
+		}
+	}
+
+	if(dots != 3) return WIFI_ERROR;
+
+	*ip = value;
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Formats a BSSID in the notation AA:BB:CC:DD:EE:FF.
+  * @param  bssid: The 6 bytes of the BSSID
+  * @param  dst: A char buffer, where the BSSID will be saved in.
+  * @param  size: Destination buffer size, at least WIFI_BSSID_STRING_SIZE
+  * @retval Length of the BSSID, 0 if dst is too small
+  */
+
+uint16_t WIFI_BSSIDToString(const uint8_t* bssid, char* dst, uint16_t size){
+
+	static const char hex[] = "0123456789ABCDEF";
+	uint16_t length = 0;
+
+	if(size < WIFI_BSSID_STRING_SIZE) return 0;
+
+	for(uint8_t i = 0; i < 6; i++){
+		if(i > 0) dst[length++] = ':';
+		dst[length++] = hex[bssid[i] >> 4];
+		dst[length++] = hex[bssid[i] & 0x0F];
+	}
+	dst[length] = '\0';
+
+	return length;
+}
+
+
+/**
+  * @brief  Parses a BSSID in the notation AA:BB:CC:DD:EE:FF.
+  * @param  src: A char buffer, which contains the BSSID (not necessarily \0 terminated).
+  * @param  length: BSSID length
+  * @param  bssid: Filled with the 6 bytes of the BSSID
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_StringToBSSID(const char* src, uint16_t length, uint8_t* bssid){
+
+	uint8_t value[6] = { 0 };
+
+	if(length != sizeof("00:00:00:00:00:00") - 1) return WIFI_ERROR;
 
-	// Send response
-	msgLength = sprintf(wifiTxBuffer, "S3=%d\r%s", strlen(message), message);
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+	for(uint16_t i = 0; i < length; i++){
+		char c = src[i];
 
-	// Stop client connection
-	msgLength = sprintf(wifiTxBuffer, "P6=0\r");
-	WIFI_SendATCommand(hwifi, wifiTxBuffer, msgLength+1, wifiRxBuffer, WIFI_RX_BUFFER_SIZE);
+		// Every third char separates two bytes
+		if(i % 3 == 2){
+			if(c != ':') return WIFI_ERROR;
+			continue;
+		}
+
+		if(c >= '0' && c <= '9') c -= '0';
+		else if(c >= 'A' && c <= 'F') c -= 'A' - 10;
+		else if(c >= 'a' && c <= 'f') c -= 'a' - 10;
+		else return WIFI_ERROR;
+
+		value[i / 3] = (value[i / 3] << 4) | c;
+	}
+
+	memcpy(bssid, value, sizeof(value));
 
 	return WIFI_OK;
 }
 
+
+/**
+  * @brief  Copies an IP address field of a parsed response into the handle
+  * 		representation of the selected footprint profile.
+  * @param  response: Parsed response
+  * @param  index: Index of the field, starting with 0
+  * @param  ip: Destination address
+  * @retval WIFI_StatusTypeDef
+  */
+
+static WIFI_StatusTypeDef WIFI_CopyIPField(const WIFI_ResponseTypeDef* response, uint8_t index, WIFI_IPAddressTypeDef* ip){
+
+#if WIFI_FOOTPRINT == WIFI_FOOTPRINT_SMALL
+	if(index >= response->fieldCount) return WIFI_ERROR;
+
+	return WIFI_StringToIP(response->fields[index].start, response->fields[index].length, ip);
+#else
+	return WIFI_CopyField(response, index, *ip, sizeof(*ip));
+#endif
+}
+
+
+/**
+  * @brief  Checks whether token occurs in the payload of a parsed response.
+  * @param  response: Parsed response
+  * @param  token: C string to search for
+  * @retval SET if the token was found, RESET otherwise
+  */
+
+FlagStatus WIFI_PayloadContains(const WIFI_ResponseTypeDef* response, const char* token){
+
+	uint16_t tokenLength = strlen(token);
+
+	for(uint16_t i = 0; i + tokenLength <= response->payloadLength; i++){
+		if(!strncmp(&response->payload[i], token, tokenLength)) return SET;
+	}
+
+	return RESET;
+}
+
+
+/**
+  * @brief  Checks whether a parsed response carries no message, which is
+  * 		the case for a bare OK or an empty [SOMA][EOMA] frame.
+  * @param  response: Parsed response
+  * @retval SET if the payload is empty, RESET otherwise
+  */
+
+static FlagStatus WIFI_IsPayloadEmpty(const WIFI_ResponseTypeDef* response){
+
+	static const char emptyFrame[] = "[SOMA][EOMA]";
+
+	if(response->payloadLength == 0) return SET;
+
+	if(response->payloadLength == sizeof(emptyFrame) - 1
+			&& !strncmp(response->payload, emptyFrame, sizeof(emptyFrame) - 1)) return SET;
+
+	return RESET;
+}
+
+
+/**
+  * @brief  Assembles prefix, argument and the terminating \r into a command
+  * 		buffer, which is usually sized with WIFI_CMD_BUFFER_SIZE().
+  * @param  bCmd: A char buffer, where the command will be written in.
+  * @param  size: Command buffer size
+  * @param  prefix: Command prefix, at most WIFI_CMD_PREFIX_MAX_LENGTH chars
+  * @param  arg: Argument chars, not necessarily \0 terminated (may be NULL)
+  * @param  argLength: Number of argument chars
+  * @retval Command length excluding \0, 0 if the command does not fit
+  */
+
+static uint16_t WIFI_FormatCommand(char* bCmd, uint16_t size, const char* prefix, const char* arg, uint16_t argLength){
+
+	uint16_t prefixLength = strnlen(prefix, WIFI_CMD_PREFIX_MAX_LENGTH + 1);
+
+	if(prefixLength > WIFI_CMD_PREFIX_MAX_LENGTH || prefixLength + argLength + sizeof("\r") > size) return 0;
+
+	memcpy(bCmd, prefix, prefixLength);
+	if(argLength > 0) memcpy(&bCmd[prefixLength], arg, argLength);
+	bCmd[prefixLength + argLength] = '\r';
+	bCmd[prefixLength + argLength + 1] = '\0';
+
+	return prefixLength + argLength + 1;
+}
+
+
+/**
+  * @brief  Assembles a command with a numeric argument into a command buffer.
+  * @param  bCmd: A char buffer, where the command will be written in.
+  * @param  size: Command buffer size
+  * @param  prefix: Command prefix, at most WIFI_CMD_PREFIX_MAX_LENGTH chars
+  * @param  value: Argument, which is appended in decimal
+  * @retval Command length excluding \0, 0 if the command does not fit
+  */
+
+static uint16_t WIFI_FormatCommandUint(char* bCmd, uint16_t size, const char* prefix, uint32_t value){
+
+	char bValue[WIFI_CMD_UINT_MAX_LENGTH];
+	char* pValue = &bValue[WIFI_CMD_UINT_MAX_LENGTH];
+
+	// Write the digits back to front, so no format parsing is needed
+	do{
+		*--pValue = '0' + (value % 10);
+		value /= 10;
+	}while(value != 0);
+
+	return WIFI_FormatCommand(bCmd, size, prefix, pValue, &bValue[WIFI_CMD_UINT_MAX_LENGTH] - pValue);
+}
+
+
 /**
   * @brief  Trims a given character from beginning and end of a c string.
+  * 		A string that fills its buffer without a \0 loses its last
+  * 		char to the terminator.
   * @param  str: C string
-  * @param  strSize: C string size
-  * @param  size: Character to trim
+  * @param  strSize: C string buffer size
+  * @param  c: Character to trim
   * @retval None
   */
 
-void trimstr(char* str, uint32_t strSize, char c){
+WIFI_RAMFUNC void trimstr(char* str, uint32_t strSize, char c){
 
 	uint32_t trimPos = 0;
 	uint32_t endPos = 0;
 
+	if(strSize == 0) return;
+
 	// Find end of string a.k.a. first occurrence of '\0'
-	for(uint32_t i = 0; i < strSize; i++){
-		if( str[i] != '\0' ) continue;
-		else{
-			endPos = i;
-			break;
-		}
-	}
+	while(endPos < strSize && str[endPos] != '\0') endPos++;
 
-	/**
-	 * If c is at the end of the string, replace it with '\0'.
-	 * Repeat until a char emerges that is not c.
-	 */
-	for(uint32_t i = endPos -1; i > 0; i--){
-		if( str[i] == c ){
-			str[i] = '\0';
-			endPos = i;
-		}
-		else break;
-	}
+	// Keep the terminator inside the buffer
+	if(endPos == strSize) endPos--;
+
+	// Drop c from the end of the string
+	while(endPos > 0 && str[endPos - 1] == c) endPos--;
+
+	// Find the position of the first char in the string that is not c
+	while(trimPos < endPos && str[trimPos] == c) trimPos++;
 
-	// Find the position of the first char in the string that is not c.
-	for(uint32_t i = 0; i < strSize; i++){
-		if(str[i] == c){
-			trimPos = i + 1;
-		}else break;
+	// Trim leading c, copied in place so no library code from flash is needed
+	for(uint32_t i = trimPos; i < endPos; i++){
+		str[i - trimPos] = str[i];
 	}
-	// Trim leading c
-	snprintf( str, endPos + 1 - trimPos, &str[trimPos] );
+	str[endPos - trimPos] = '\0';
 }
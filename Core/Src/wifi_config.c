@@ -0,0 +1,291 @@
+/* Includes ------------------------------------------------------------------*/
+#include "wifi.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+#define WIFI_CONFIG_FNV_OFFSET 2166136261u
+#define WIFI_CONFIG_FNV_PRIME 16777619u
+#define WIFI_CONFIG_RECORD_COUNT (WIFI_CONFIG_FLASH_SIZE / sizeof(uint64_t))
+
+
+/* Private prototypes --------------------------------------------------------*/
+static uint32_t WIFI_ConfigHash(uint32_t hash, const void* data, uint16_t size);
+static uint32_t WIFI_ConfigHashString(uint32_t hash, const char* str);
+static uint32_t WIFI_ConfigHashIP(uint32_t hash, const WIFI_IPAddressTypeDef* ip);
+static uint64_t WIFI_FlashLogRead(uint32_t address);
+static WIFI_StatusTypeDef WIFI_FlashLogAppend(uint32_t address, uint64_t record);
+static WIFI_StatusTypeDef WIFI_FlashLogPage(uint32_t address, FLASH_EraseInitTypeDef* erase);
+
+
+/**
+  * @brief  Calculates the FNV-1a hash over the network settings of the
+  * 		handle, i.e. everything WIFI_JoinNetwork() sends before C0.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval Fingerprint of the configuration
+  */
+
+uint32_t WIFI_ConfigFingerprint(WIFI_HandleTypeDef* hwifi){
+
+	uint32_t hash = WIFI_CONFIG_FNV_OFFSET;
+	uint8_t securityType = hwifi->securityType;
+	uint8_t dhcp = hwifi->DHCP;
+
+	hash = WIFI_ConfigHashString(hash, hwifi->ssid);
+	hash = WIFI_ConfigHashString(hash, hwifi->passphrase);
+	hash = WIFI_ConfigHash(hash, &securityType, sizeof(securityType));
+	hash = WIFI_ConfigHash(hash, &dhcp, sizeof(dhcp));
+
+	// The static addresses are only sent without DHCP
+	if(hwifi->DHCP != SET){
+		hash = WIFI_ConfigHashIP(hash, &hwifi->ipAddress);
+		hash = WIFI_ConfigHashIP(hash, &hwifi->networkMask);
+		hash = WIFI_ConfigHashIP(hash, &hwifi->defaultGateway);
+		hash = WIFI_ConfigHashIP(hash, &hwifi->primaryDNSServer);
+	}
+
+	return hash;
+}
+
+
+/**
+  * @brief  Reads the fingerprint of the configuration that was last saved
+  * 		in the module.
+  * @param  fingerprint: Filled with the saved fingerprint
+  * @retval WIFI_OK if a valid fingerprint is stored, WIFI_ERROR otherwise
+  */
+
+WIFI_StatusTypeDef WIFI_ConfigLoad(uint32_t* fingerprint){
+
+	uint64_t record = WIFI_FlashLogRead(WIFI_CONFIG_FLASH_ADDRESS);
+
+	// A record holds the fingerprint and its complement, an invalidated one does not
+	if((uint32_t) record != (uint32_t) ~(record >> 32)) return WIFI_ERROR;
+
+	*fingerprint = (uint32_t) record;
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Stores the fingerprint of the configuration saved in the module.
+  * @param  fingerprint: Fingerprint from WIFI_ConfigFingerprint()
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_ConfigStore(uint32_t fingerprint){
+
+	return WIFI_FlashLogAppend(WIFI_CONFIG_FLASH_ADDRESS, ((uint64_t) ~fingerprint << 32) | fingerprint);
+}
+
+
+/**
+  * @brief  Marks the stored fingerprint as invalid, so the next join
+  * 		configures the module from scratch.
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_ConfigInvalidate(void){
+
+	return WIFI_FlashLogAppend(WIFI_CONFIG_FLASH_ADDRESS, 0);
+}
+
+
+#ifdef WIFI_USE_TARGETED_JOIN
+/**
+  * @brief  Reads the BSSID and channel of the access point of the last
+  * 		successful join.
+  * @param  link: Filled with the cached link
+  * @retval WIFI_OK if a valid link is cached, WIFI_ERROR otherwise
+  */
+
+WIFI_StatusTypeDef WIFI_LinkLoad(WIFI_LinkTypeDef* link){
+
+	uint64_t record = WIFI_FlashLogRead(WIFI_LINK_FLASH_ADDRESS);
+
+	// Erased and invalidated records have no valid channel
+	link->channel = (uint8_t)(record >> 48);
+	if(link->channel == 0 || link->channel == 0xFF) return WIFI_ERROR;
+
+	for(uint8_t i = 0; i < sizeof(link->bssid); i++){
+		link->bssid[i] = (uint8_t)(record >> (8 * i));
+	}
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Caches the BSSID and channel of the joined access point. Nothing
+  * 		is written if they did not change.
+  * @param  link: Link of the current join
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_LinkStore(const WIFI_LinkTypeDef* link){
+
+	WIFI_LinkTypeDef cached;
+	uint64_t record = (uint64_t) link->channel << 48;
+
+	if(WIFI_LinkLoad(&cached) == WIFI_OK && !memcmp(&cached, link, sizeof(cached))) return WIFI_OK;
+
+	for(uint8_t i = 0; i < sizeof(link->bssid); i++){
+		record |= (uint64_t) link->bssid[i] << (8 * i);
+	}
+
+	return WIFI_FlashLogAppend(WIFI_LINK_FLASH_ADDRESS, record);
+}
+
+
+/**
+  * @brief  Drops the cached link, so the next join scans all channels.
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_LinkInvalidate(void){
+
+	WIFI_LinkTypeDef cached;
+
+	if(WIFI_LinkLoad(&cached) != WIFI_OK) return WIFI_OK;
+
+	return WIFI_FlashLogAppend(WIFI_LINK_FLASH_ADDRESS, 0);
+}
+#endif
+
+
+/**
+  * @brief  Reads the last record of a flash page. The records are appended,
+  * 		so the last written one is the current one.
+  * @param  address: Page address
+  * @retval Record, UINT64_MAX if the page is empty
+  */
+
+static uint64_t WIFI_FlashLogRead(uint32_t address){
+
+	const volatile uint64_t* records = (const volatile uint64_t*)(uintptr_t) address;
+	uint64_t record = UINT64_MAX;
+
+	for(uint16_t i = 0; i < WIFI_CONFIG_RECORD_COUNT && records[i] != UINT64_MAX; i++){
+		record = records[i];
+	}
+
+	return record;
+}
+
+
+/**
+  * @brief  Appends a record to a flash page. The page is only erased when it
+  * 		is full, which spreads the wear over its records.
+  * @param  address: Page address
+  * @param  record: Record, must not be UINT64_MAX
+  * @retval WIFI_StatusTypeDef
+  */
+
+static WIFI_StatusTypeDef WIFI_FlashLogAppend(uint32_t address, uint64_t record){
+
+	const volatile uint64_t* records = (const volatile uint64_t*)(uintptr_t) address;
+	FLASH_EraseInitTypeDef erase;
+	HAL_StatusTypeDef status = HAL_OK;
+	uint32_t pageError;
+	uint16_t i = 0;
+
+	if(WIFI_FlashLogPage(address, &erase) != WIFI_OK) return WIFI_ERROR;
+
+	while(i < WIFI_CONFIG_RECORD_COUNT && records[i] != UINT64_MAX) i++;
+
+	HAL_FLASH_Unlock();
+	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+
+	if(i == WIFI_CONFIG_RECORD_COUNT){
+		status = HAL_FLASHEx_Erase(&erase, &pageError);
+		i = 0;
+	}
+
+	if(status == HAL_OK){
+		status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, address + i * sizeof(uint64_t), record);
+	}
+
+	HAL_FLASH_Lock();
+
+	return (status == HAL_OK) ? WIFI_OK : WIFI_ERROR;
+}
+
+
+/**
+  * @brief  Finds the physical bank and page of a flash log page. The running
+  * 		image is always mapped at FLASH_BASE, so a page in the lower half
+  * 		is refused. With FB_MODE set (booted from bank 2), the upper half
+  * 		is bank 1.
+  * @param  address: Page address
+  * @param  erase: Filled with the erase of the page
+  * @retval WIFI_ERROR if the address is no page of the upper half
+  */
+
+static WIFI_StatusTypeDef WIFI_FlashLogPage(uint32_t address, FLASH_EraseInitTypeDef* erase){
+
+	if(address < FLASH_BASE + FLASH_BANK_SIZE || address >= FLASH_BASE + 2 * FLASH_BANK_SIZE) return WIFI_ERROR;
+	if((address - FLASH_BASE) % FLASH_PAGE_SIZE) return WIFI_ERROR;
+
+	erase->TypeErase = FLASH_TYPEERASE_PAGES;
+	erase->Banks = READ_BIT(SYSCFG->MEMRMP, SYSCFG_MEMRMP_FB_MODE) ? FLASH_BANK_1 : FLASH_BANK_2;
+	erase->Page = (address - FLASH_BASE - FLASH_BANK_SIZE) / FLASH_PAGE_SIZE;
+	erase->NbPages = 1;
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Continues an FNV-1a hash over a buffer.
+  * @param  hash: Hash so far
+  * @param  data: Buffer
+  * @param  size: Buffer size
+  * @retval Hash
+  */
+
+static uint32_t WIFI_ConfigHash(uint32_t hash, const void* data, uint16_t size){
+
+	const uint8_t* bytes = data;
+
+	for(uint16_t i = 0; i < size; i++){
+		hash ^= bytes[i];
+		hash *= WIFI_CONFIG_FNV_PRIME;
+	}
+
+	return hash;
+}
+
+
+/**
+  * @brief  Continues the hash over a string including its terminator, so
+  * 		the boundary between two strings is part of the hash.
+  * @param  hash: Hash so far
+  * @param  str: String, NULL is hashed like an empty string
+  * @retval Hash
+  */
+
+static uint32_t WIFI_ConfigHashString(uint32_t hash, const char* str){
+
+	if(str == NULL) str = "";
+
+	return WIFI_ConfigHash(hash, str, strlen(str) + 1);
+}
+
+
+/**
+  * @brief  Continues the hash over an IP address in either footprint
+  * 		profile.
+  * @param  hash: Hash so far
+  * @param  ip: IP address
+  * @retval Hash
+  */
+
+static uint32_t WIFI_ConfigHashIP(uint32_t hash, const WIFI_IPAddressTypeDef* ip){
+
+#if WIFI_FOOTPRINT == WIFI_FOOTPRINT_SMALL
+	return WIFI_ConfigHash(hash, ip, sizeof(*ip));
+#else
+	// Bytes after the terminator are undefined
+	return WIFI_ConfigHash(hash, *ip, strnlen(*ip, sizeof(*ip)));
+#endif
+}
@@ -0,0 +1,548 @@
+/* Includes ------------------------------------------------------------------*/
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include "wifi.h"
+#include "binlog.h"
+#include "helper_functions.h"
+#include "spi_trace.h"
+#include "stack_monitor.h"
+#ifdef WIFI_USE_POOL
+#include "pool.h"
+#endif
+
+
+/* Structs -------------------------------------------------------------------*/
+/**
+ * The response is rendered line by line into a small chunk, which is sent
+ * with S3 whenever the next line does not fit anymore. So the complete
+ * response never has to be kept in memory.
+ */
+typedef struct
+{
+  WIFI_HandleTypeDef* hwifi;
+  uint8_t socket;
+  WIFI_StatusTypeDef status;
+  uint16_t length;
+  char chunk[WIFI_METRICS_CHUNK_SIZE];
+} WIFI_MetricsWriterTypeDef;
+
+
+/* Variables -----------------------------------------------------------------*/
+static const char* const cmdClassNames[WIFI_CMD_CLASS_COUNT] = { "C", "P", "PM", "S3", "R0", "MR", "other" };
+
+
+/* Private prototypes --------------------------------------------------------*/
+static void WIFI_MetricsFlush(WIFI_MetricsWriterTypeDef* writer);
+static void WIFI_MetricsPrint(WIFI_MetricsWriterTypeDef* writer, const char* format, ...);
+static void WIFI_MetricsPrintCounter(WIFI_MetricsWriterTypeDef* writer, const char* name, const char* label, uint64_t value);
+static void WIFI_MetricsPrintClasses(WIFI_MetricsWriterTypeDef* writer, const char* name, const char* help, size_t offset, uint8_t is64);
+#ifdef PROFILER_ENABLED
+static void WIFI_MetricsPrintProbes(WIFI_MetricsWriterTypeDef* writer);
+#endif
+#ifdef WIFI_USE_POOL
+static void WIFI_MetricsPrintPool(WIFI_MetricsWriterTypeDef* writer);
+#endif
+static void WIFI_MetricsPrintJoinTime(WIFI_MetricsWriterTypeDef* writer);
+static void WIFI_MetricsPrintPower(WIFI_MetricsWriterTypeDef* writer);
+static void WIFI_MetricsPrintRoam(WIFI_MetricsWriterTypeDef* writer);
+static void WIFI_MetricsPrintQuality(WIFI_MetricsWriterTypeDef* writer);
+#ifdef STACK_MONITOR_ENABLED
+static void WIFI_MetricsPrintStack(WIFI_MetricsWriterTypeDef* writer);
+#endif
+#ifdef WIFI_USE_LOWPOWER
+static void WIFI_MetricsPrintLowPower(WIFI_MetricsWriterTypeDef* writer);
+#endif
+
+
+/**
+  * @brief  Checks whether an HTTP request is a GET of the given route.
+  * @param  request: A char buffer, where the HTTP request is contained.
+  * @param  length: Request length
+  * @param  path: Route, e.g. WIFI_METRICS_PATH
+  * @retval SET if the request is GET path, RESET otherwise
+  */
+
+FlagStatus WIFI_IsHttpGet(const char* request, uint16_t length, const char* path){
+
+	uint16_t pathLength = strlen(path);
+
+	if(length < pathLength + 5 || strncmp(request, "GET ", 4) || strncmp(&request[4], path, pathLength)) return RESET;
+
+	// The path must end here, e.g. not match /metricsfoo
+	return (request[pathLength + 4] == ' ' || request[pathLength + 4] == '?') ? SET : RESET;
+}
+
+
+/**
+  * @brief  Sends the driver statistics in the Prometheus text format over an
+  * 		open server socket. The response is streamed in chunks of
+  * 		WIFI_METRICS_CHUNK_SIZE bytes.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  socket: Module socket number of the accepted connection
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_MetricsRespond(WIFI_HandleTypeDef* hwifi, uint8_t socket){
+
+	WIFI_MetricsWriterTypeDef writer;
+
+	writer.hwifi = hwifi;
+	writer.socket = socket;
+	writer.status = WIFI_OK;
+	writer.length = 0;
+
+	WIFI_MetricsPrint(&writer, "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+
+	WIFI_MetricsPrintClasses(&writer, "wifi_commands_total", "AT commands sent", offsetof(WIFI_CmdStatsTypeDef, count), 0);
+	WIFI_MetricsPrintClasses(&writer, "wifi_command_errors_total", "AT commands that failed", offsetof(WIFI_CmdStatsTypeDef, errors), 0);
+	WIFI_MetricsPrintClasses(&writer, "wifi_tx_bytes_total", "Bytes sent to the module", offsetof(WIFI_CmdStatsTypeDef, bytesTx), 0);
+	WIFI_MetricsPrintClasses(&writer, "wifi_rx_bytes_total", "Bytes received from the module", offsetof(WIFI_CmdStatsTypeDef, bytesRx), 0);
+	WIFI_MetricsPrintClasses(&writer, "wifi_wait_cycles_total", "Cycles spent waiting for CMD/DATA READY", offsetof(WIFI_CmdStatsTypeDef, waitCycles), 1);
+	WIFI_MetricsPrintClasses(&writer, "wifi_nss_cycles_total", "Cycles spent in NSS delays", offsetof(WIFI_CmdStatsTypeDef, nssCycles), 1);
+	WIFI_MetricsPrintClasses(&writer, "wifi_transfer_cycles_total", "Cycles spent in SPI transfers", offsetof(WIFI_CmdStatsTypeDef, transferCycles), 1);
+	WIFI_MetricsPrintClasses(&writer, "wifi_parse_cycles_total", "Cycles spent parsing responses", offsetof(WIFI_CmdStatsTypeDef, parseCycles), 1);
+
+	WIFI_MetricsPrint(&writer, "# TYPE wifi_joins_total counter\n");
+	WIFI_MetricsPrintCounter(&writer, "wifi_joins_total", NULL, hwifi->stats.joins);
+	WIFI_MetricsPrint(&writer, "# TYPE wifi_join_errors_total counter\n");
+	WIFI_MetricsPrintCounter(&writer, "wifi_join_errors_total", NULL, hwifi->stats.joinErrors);
+	WIFI_MetricsPrint(&writer, "# TYPE wifi_profile_joins_total counter\n");
+	WIFI_MetricsPrintCounter(&writer, "wifi_profile_joins_total", NULL, hwifi->stats.profileJoins);
+#ifdef WIFI_USE_TARGETED_JOIN
+	WIFI_MetricsPrint(&writer, "# TYPE wifi_link_cache_total counter\n");
+	WIFI_MetricsPrintCounter(&writer, "wifi_link_cache_total", "{result=\"hit\"}", hwifi->stats.linkHits);
+	WIFI_MetricsPrintCounter(&writer, "wifi_link_cache_total", "{result=\"miss\"}", hwifi->stats.linkMisses);
+#endif
+	WIFI_MetricsPrint(&writer, "# TYPE wifi_lease_joins_total counter\n");
+	WIFI_MetricsPrintCounter(&writer, "wifi_lease_joins_total", NULL, hwifi->stats.leaseJoins);
+	WIFI_MetricsPrint(&writer, "# TYPE wifi_lease_checks_total counter\n");
+	WIFI_MetricsPrintCounter(&writer, "wifi_lease_checks_total", "{result=\"ok\"}", hwifi->stats.leaseRevalidations);
+	WIFI_MetricsPrintCounter(&writer, "wifi_lease_checks_total", "{result=\"reject\"}", hwifi->stats.leaseRejects);
+	WIFI_MetricsPrintJoinTime(&writer);
+	WIFI_MetricsPrint(&writer, "# TYPE wifi_console_dropped_bytes_total counter\n");
+	WIFI_MetricsPrintCounter(&writer, "wifi_console_dropped_bytes_total", NULL, console_dropped_bytes());
+	WIFI_MetricsPrint(&writer, "# TYPE wifi_log_dropped_records_total counter\n");
+	WIFI_MetricsPrintCounter(&writer, "wifi_log_dropped_records_total", NULL, blog_dropped_records());
+	WIFI_MetricsPrint(&writer, "# TYPE wifi_rx_high_water_bytes gauge\n");
+	WIFI_MetricsPrintCounter(&writer, "wifi_rx_high_water_bytes", NULL, hwifi->stats.rxHighWater);
+	WIFI_MetricsPrint(&writer, "# TYPE wifi_queue_high_water gauge\n");
+	WIFI_MetricsPrintCounter(&writer, "wifi_queue_high_water", NULL, hwifi->stats.queueHighWater);
+	WIFI_MetricsPrint(&writer, "# TYPE wifi_stack_high_water_bytes gauge\n");
+	WIFI_MetricsPrintCounter(&writer, "wifi_stack_high_water_bytes", NULL, WIFI_StackHighWater());
+	WIFI_MetricsPrint(&writer, "# TYPE wifi_boot_ready_ms gauge\n");
+	WIFI_MetricsPrintCounter(&writer, "wifi_boot_ready_ms", NULL, hwifi->boot.readyTime);
+	WIFI_MetricsPrint(&writer, "# TYPE wifi_boot_first_command_ms gauge\n");
+	WIFI_MetricsPrintCounter(&writer, "wifi_boot_first_command_ms", NULL, hwifi->boot.firstCommandTick);
+
+	WIFI_MetricsPrintPower(&writer);
+	WIFI_MetricsPrintRoam(&writer);
+	WIFI_MetricsPrintQuality(&writer);
+
+#ifdef STACK_MONITOR_ENABLED
+	WIFI_MetricsPrintStack(&writer);
+#endif
+
+#ifdef WIFI_USE_LOWPOWER
+	WIFI_MetricsPrintLowPower(&writer);
+#endif
+
+#ifdef WIFI_USE_POOL
+	WIFI_MetricsPrintPool(&writer);
+#endif
+
+#ifdef PROFILER_ENABLED
+	WIFI_MetricsPrintProbes(&writer);
+#endif
+
+	WIFI_MetricsFlush(&writer);
+
+	return writer.status;
+}
+
+
+#ifdef SPI_TRACE_ENABLED
+/**
+  * @brief  Sends the SPI trace in the format of spi_trace_dump() over an open
+  * 		server socket. The recording is paused meanwhile, so the S3
+  * 		frames of the response do not overwrite the trace.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  socket: Module socket number of the accepted connection
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_TraceRespond(WIFI_HandleTypeDef* hwifi, uint8_t socket){
+
+	WIFI_MetricsWriterTypeDef writer;
+	SPI_TRACE_RecordTypeDef record;
+	uint8_t data[SPI_TRACE_MAX_PAYLOAD];
+	uint32_t cursor;
+
+	writer.hwifi = hwifi;
+	writer.socket = socket;
+	writer.status = WIFI_OK;
+	writer.length = 0;
+
+	spi_trace_pause(ENABLE);
+	cursor = spi_trace_start();
+
+	WIFI_MetricsPrint(&writer, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\n");
+	WIFI_MetricsPrint(&writer, "# spi trace %lu Hz, %lu overwritten\n", (unsigned long) SystemCoreClock, (unsigned long) spi_trace_overwritten());
+
+	while(writer.status == WIFI_OK && spi_trace_read(&cursor, &record, data)){
+		char hex[2 * 16 + 1];
+
+		WIFI_MetricsPrint(&writer, "%lu %c %u ", (unsigned long) record.timestamp, record.direction, record.length);
+
+		// The stored bytes do not fit into one chunk line, so print them in pieces
+		for(uint8_t i = 0; i < record.storedLength; i += 16){
+			uint8_t n = (record.storedLength - i < 16) ? record.storedLength - i : 16;
+
+			for(uint8_t j = 0; j < n; j++){
+				snprintf(&hex[2 * j], 3, "%02x", data[i + j]);
+			}
+			WIFI_MetricsPrint(&writer, "%s", hex);
+		}
+		WIFI_MetricsPrint(&writer, "\n");
+	}
+
+	WIFI_MetricsFlush(&writer);
+	spi_trace_pause(DISABLE);
+
+	return writer.status;
+}
+#endif
+
+
+/**
+  * @brief  Sends the rendered part of the response.
+  * @param  writer: Metrics writer
+  * @retval None
+  */
+
+static void WIFI_MetricsFlush(WIFI_MetricsWriterTypeDef* writer){
+
+	if(writer->length == 0 || writer->status != WIFI_OK) return;
+
+	writer->status = WIFI_SocketSend(writer->hwifi, writer->socket, writer->chunk, writer->length);
+	writer->length = 0;
+}
+
+
+/**
+  * @brief  Renders a line into the chunk, the chunk is sent first if the
+  * 		line does not fit anymore. Lines must be shorter than the chunk.
+  * @param  writer: Metrics writer
+  * @param  format: printf format string
+  * @retval None
+  */
+
+static void WIFI_MetricsPrint(WIFI_MetricsWriterTypeDef* writer, const char* format, ...){
+
+	va_list args;
+	int length;
+
+	for(uint8_t attempt = 0; attempt < 2 && writer->status == WIFI_OK; attempt++){
+		va_start(args, format);
+		length = vsnprintf(&writer->chunk[writer->length], sizeof(writer->chunk) - writer->length, format, args);
+		va_end(args);
+
+		if(length < 0) return;
+
+		if(writer->length + (size_t) length < sizeof(writer->chunk)){
+			writer->length += length;
+			return;
+		}
+
+		// Did not fit, send what is there and render the line again
+		WIFI_MetricsFlush(writer);
+	}
+}
+
+
+/**
+  * @brief  Renders a sample line. 64bit values are split, because the
+  * 		newlib nano printf does not support %llu.
+  * @param  writer: Metrics writer
+  * @param  name: Metric name
+  * @param  label: Label set including braces (may be NULL)
+  * @param  value: Sample value
+  * @retval None
+  */
+
+static void WIFI_MetricsPrintCounter(WIFI_MetricsWriterTypeDef* writer, const char* name, const char* label, uint64_t value){
+
+	unsigned long high = value / 1000000000UL;
+	unsigned long low = value % 1000000000UL;
+
+	if(label == NULL) label = "";
+
+	if(high > 0) WIFI_MetricsPrint(writer, "%s%s %lu%09lu\n", name, label, high, low);
+	else WIFI_MetricsPrint(writer, "%s%s %lu\n", name, label, low);
+}
+
+
+/**
+  * @brief  Renders a counter of all command classes.
+  * @param  writer: Metrics writer
+  * @param  name: Metric name
+  * @param  help: Metric description
+  * @param  offset: Offset of the counter in WIFI_CmdStatsTypeDef
+  * @param  is64: Whether the counter is a uint64_t instead of a uint32_t
+  * @retval None
+  */
+
+static void WIFI_MetricsPrintClasses(WIFI_MetricsWriterTypeDef* writer, const char* name, const char* help, size_t offset, uint8_t is64){
+
+	char label[16];
+
+	WIFI_MetricsPrint(writer, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+
+	for(uint8_t i = 0; i < WIFI_CMD_CLASS_COUNT; i++){
+		const uint8_t* stats = (const uint8_t*) &writer->hwifi->stats.cmd[i];
+		uint64_t value = is64 ? *(const uint64_t*)(stats + offset) : *(const uint32_t*)(stats + offset);
+
+		snprintf(label, sizeof(label), "{class=\"%s\"}", cmdClassNames[i]);
+		WIFI_MetricsPrintCounter(writer, name, label, value);
+	}
+}
+
+
+#ifdef PROFILER_ENABLED
+/**
+  * @brief  Renders the profiler probes as latency histograms in cycles.
+  * @param  writer: Metrics writer
+  * @retval None
+  */
+
+static void WIFI_MetricsPrintProbes(WIFI_MetricsWriterTypeDef* writer){
+
+	const PROFILER_ProbeTypeDef* probe;
+	char label[64];
+
+	WIFI_MetricsPrint(writer, "# TYPE wifi_probe_cycles histogram\n");
+
+	for(uint8_t id = 0; (probe = profiler_get_probe(id)) != NULL; id++){
+		uint32_t cumulative = 0;
+
+		// Bucket n holds durations below 2^n, Prometheus buckets are cumulative
+		for(uint8_t j = 0; j < PROFILER_HISTOGRAM_BUCKETS - 1; j++){
+			cumulative += probe->histogram[j];
+			snprintf(label, sizeof(label), "{probe=\"%s\",le=\"%lu\"}", probe->name, (1UL << j) - 1);
+			WIFI_MetricsPrintCounter(writer, "wifi_probe_cycles_bucket", label, cumulative);
+		}
+
+		snprintf(label, sizeof(label), "{probe=\"%s\",le=\"+Inf\"}", probe->name);
+		WIFI_MetricsPrintCounter(writer, "wifi_probe_cycles_bucket", label, probe->count);
+		snprintf(label, sizeof(label), "{probe=\"%s\"}", probe->name);
+		WIFI_MetricsPrintCounter(writer, "wifi_probe_cycles_sum", label, probe->sum);
+		WIFI_MetricsPrintCounter(writer, "wifi_probe_cycles_count", label, probe->count);
+	}
+}
+#endif
+
+
+#ifdef WIFI_USE_POOL
+/**
+  * @brief  Renders the usage of the packet pool per size class.
+  * @param  writer: Metrics writer
+  * @retval None
+  */
+
+static void WIFI_MetricsPrintPool(WIFI_MetricsWriterTypeDef* writer){
+
+	POOL_StatsTypeDef stats;
+	char label[16];
+
+	WIFI_MetricsPrint(writer, "# TYPE wifi_pool_blocks gauge\n# TYPE wifi_pool_used_blocks gauge\n# TYPE wifi_pool_high_water gauge\n");
+	WIFI_MetricsPrint(writer, "# TYPE wifi_pool_allocations_total counter\n# TYPE wifi_pool_exhausted_total counter\n");
+
+	for(uint8_t c = 0; c < pool_class_count(); c++){
+		pool_get_stats(c, &stats);
+		snprintf(label, sizeof(label), "{size=\"%u\"}", stats.blockSize);
+		WIFI_MetricsPrintCounter(writer, "wifi_pool_blocks", label, stats.blocks);
+		WIFI_MetricsPrintCounter(writer, "wifi_pool_used_blocks", label, stats.used);
+		WIFI_MetricsPrintCounter(writer, "wifi_pool_high_water", label, stats.highWater);
+		WIFI_MetricsPrintCounter(writer, "wifi_pool_allocations_total", label, stats.allocations);
+		WIFI_MetricsPrintCounter(writer, "wifi_pool_exhausted_total", label, stats.exhausted);
+	}
+}
+#endif
+
+
+/**
+  * @brief  Writes the join time histogram with cumulative buckets.
+  * @param  writer: Metrics writer
+  * @retval None
+  */
+
+static void WIFI_MetricsPrintJoinTime(WIFI_MetricsWriterTypeDef* writer){
+
+	static const uint32_t bounds[WIFI_JOIN_TIME_BUCKET_COUNT - 1] = WIFI_JOIN_TIME_BUCKETS;
+	WIFI_StatsTypeDef* stats = &writer->hwifi->stats;
+	uint32_t count = 0;
+	char label[sizeof("{le=\"4294967295\"}")];
+
+	WIFI_MetricsPrint(writer, "# TYPE wifi_join_duration_ms histogram\n");
+
+	for(uint8_t i = 0; i < WIFI_JOIN_TIME_BUCKET_COUNT; i++){
+		count += stats->joinTime[i];
+		if(i < WIFI_JOIN_TIME_BUCKET_COUNT - 1) snprintf(label, sizeof(label), "{le=\"%lu\"}", (unsigned long) bounds[i]);
+		else snprintf(label, sizeof(label), "{le=\"+Inf\"}");
+		WIFI_MetricsPrintCounter(writer, "wifi_join_duration_ms_bucket", label, count);
+	}
+
+	WIFI_MetricsPrintCounter(writer, "wifi_join_duration_ms_sum", NULL, stats->joinTimeSum);
+	WIFI_MetricsPrintCounter(writer, "wifi_join_duration_ms_count", NULL, count);
+}
+
+
+/**
+  * @brief  Writes the power save transitions, wake latency and the time
+  * 		spent awake and dozing of the module.
+  * @param  writer: Metrics writer
+  * @retval None
+  */
+
+static void WIFI_MetricsPrintPower(WIFI_MetricsWriterTypeDef* writer){
+
+	WIFI_PowerStatsTypeDef stats;
+
+	WIFI_GetPowerStats(writer->hwifi, &stats);
+
+	WIFI_MetricsPrint(writer, "# TYPE wifi_power_dozes_total counter\n");
+	WIFI_MetricsPrintCounter(writer, "wifi_power_dozes_total", NULL, stats.dozes);
+	WIFI_MetricsPrint(writer, "# TYPE wifi_power_wakes_total counter\n");
+	WIFI_MetricsPrintCounter(writer, "wifi_power_wakes_total", "{cause=\"scheduled\"}", stats.scheduledWakes);
+	WIFI_MetricsPrintCounter(writer, "wifi_power_wakes_total", "{cause=\"demand\"}", stats.demandWakes);
+	WIFI_MetricsPrint(writer, "# TYPE wifi_power_wake_cycles_total counter\n");
+	WIFI_MetricsPrintCounter(writer, "wifi_power_wake_cycles_total", NULL, stats.sumWakeLatency);
+	WIFI_MetricsPrint(writer, "# TYPE wifi_power_wake_cycles_max gauge\n");
+	WIFI_MetricsPrintCounter(writer, "wifi_power_wake_cycles_max", NULL, stats.maxWakeLatency);
+	WIFI_MetricsPrint(writer, "# TYPE wifi_power_state_ms_total counter\n");
+	WIFI_MetricsPrintCounter(writer, "wifi_power_state_ms_total", "{state=\"awake\"}", stats.awakeTime);
+	WIFI_MetricsPrintCounter(writer, "wifi_power_state_ms_total", "{state=\"dozing\"}", stats.dozeTime);
+}
+
+
+/**
+  * @brief  Writes the roam scans and results, the failed rejoins and the
+  * 		time offline per roam.
+  * @param  writer: Metrics writer
+  * @retval None
+  */
+
+static void WIFI_MetricsPrintRoam(WIFI_MetricsWriterTypeDef* writer){
+
+	WIFI_RoamTypeDef* roam = &writer->hwifi->roam;
+
+	WIFI_MetricsPrint(writer, "# TYPE wifi_roam_scans_total counter\n");
+	WIFI_MetricsPrintCounter(writer, "wifi_roam_scans_total", NULL, roam->stats.scans);
+	WIFI_MetricsPrint(writer, "# TYPE wifi_roams_total counter\n");
+	WIFI_MetricsPrintCounter(writer, "wifi_roams_total", "{result=\"ok\"}", roam->stats.roams);
+	WIFI_MetricsPrintCounter(writer, "wifi_roams_total", "{result=\"failed\"}", roam->stats.failures);
+	WIFI_MetricsPrintCounter(writer, "wifi_roams_total", "{result=\"mismatch\"}", roam->stats.mismatches);
+	WIFI_MetricsPrint(writer, "# TYPE wifi_roam_rejoin_failures_total counter\n");
+	WIFI_MetricsPrintCounter(writer, "wifi_roam_rejoin_failures_total", NULL, roam->stats.rejoinFailures);
+	WIFI_MetricsPrint(writer, "# TYPE wifi_roam_offline_ms_total counter\n");
+	WIFI_MetricsPrintCounter(writer, "wifi_roam_offline_ms_total", NULL, roam->stats.sumOffline);
+	WIFI_MetricsPrint(writer, "# TYPE wifi_roam_offline_ms_last gauge\n");
+	WIFI_MetricsPrintCounter(writer, "wifi_roam_offline_ms_last", NULL, roam->stats.lastOffline);
+	WIFI_MetricsPrint(writer, "# TYPE wifi_roam_offline_ms_max gauge\n");
+	WIFI_MetricsPrintCounter(writer, "wifi_roam_offline_ms_max", NULL, roam->stats.maxOffline);
+}
+
+
+/**
+  * @brief  Writes the summary of the RSSI window and the connection status
+  * 		samples. Mean and trend are rendered with one decimal.
+  * @param  writer: Metrics writer
+  * @retval None
+  */
+
+static void WIFI_MetricsPrintQuality(WIFI_MetricsWriterTypeDef* writer){
+
+	WIFI_QualityTypeDef* quality = &writer->hwifi->quality;
+	WIFI_QualityReportTypeDef report;
+
+	WIFI_GetQuality(writer->hwifi, &report);
+
+	WIFI_MetricsPrint(writer, "# TYPE wifi_connected gauge\n");
+	WIFI_MetricsPrintCounter(writer, "wifi_connected", NULL, report.connected);
+	WIFI_MetricsPrint(writer, "# TYPE wifi_disconnects_total counter\n");
+	WIFI_MetricsPrintCounter(writer, "wifi_disconnects_total", NULL, quality->disconnects);
+	WIFI_MetricsPrint(writer, "# TYPE wifi_quality_samples_total counter\n");
+	WIFI_MetricsPrintCounter(writer, "wifi_quality_samples_total", "{kind=\"status\"}", quality->statusSamples);
+	WIFI_MetricsPrintCounter(writer, "wifi_quality_samples_total", "{kind=\"disconnected\"}", quality->disconnectedSamples);
+	WIFI_MetricsPrintCounter(writer, "wifi_quality_samples_total", "{kind=\"rssi\"}", quality->rssiSamples);
+
+	// Without samples there is nothing to summarise
+	if(report.count == 0) return;
+
+	WIFI_MetricsPrint(writer, "# TYPE wifi_rssi_dbm gauge\n");
+	WIFI_MetricsPrint(writer, "wifi_rssi_dbm{stat=\"min\"} %d\n", report.min);
+	WIFI_MetricsPrint(writer, "wifi_rssi_dbm{stat=\"max\"} %d\n", report.max);
+	WIFI_MetricsPrint(writer, "wifi_rssi_dbm{stat=\"mean\"} %s%d.%d\n", (report.mean < 0) ? "-" : "", abs(report.mean) / 10, abs(report.mean) % 10);
+	WIFI_MetricsPrint(writer, "# TYPE wifi_rssi_trend_db gauge\n");
+	WIFI_MetricsPrint(writer, "wifi_rssi_trend_db %s%d.%d\n", (report.trend < 0) ? "-" : "", abs(report.trend) / 10, abs(report.trend) % 10);
+}
+
+
+#ifdef STACK_MONITOR_ENABLED
+/**
+  * @brief  Renders the peak stack depth of the driver APIs and the upper
+  * 		bound of the calls that could not be measured.
+  * @param  writer: Metrics writer
+  * @retval None
+  */
+
+static void WIFI_MetricsPrintStack(WIFI_MetricsWriterTypeDef* writer){
+
+	const STACK_ProbeTypeDef* probe;
+	char label[48];
+
+	WIFI_MetricsPrint(writer, "# TYPE wifi_stack_depth_bytes gauge\n");
+
+	for(uint8_t id = 0; (probe = stack_get_probe(id)) != NULL; id++){
+		snprintf(label, sizeof(label), "{api=\"%s\"}", probe->name);
+		WIFI_MetricsPrintCounter(writer, "wifi_stack_depth_bytes", label, probe->maxDepth);
+	}
+
+	WIFI_MetricsPrint(writer, "# TYPE wifi_stack_depth_bound_bytes gauge\n");
+
+	for(uint8_t id = 0; (probe = stack_get_probe(id)) != NULL; id++){
+		snprintf(label, sizeof(label), "{api=\"%s\"}", probe->name);
+		WIFI_MetricsPrintCounter(writer, "wifi_stack_depth_bound_bytes", label, probe->maxBound);
+	}
+}
+#endif
+
+
+#ifdef WIFI_USE_LOWPOWER
+/**
+  * @brief  Renders the residency of the low power modes.
+  * @param  writer: Metrics writer
+  * @retval None
+  */
+
+static void WIFI_MetricsPrintLowPower(WIFI_MetricsWriterTypeDef* writer){
+
+	static const char* const modeNames[LOWPOWER_MODE_COUNT] = { "run", "sleep", "stop2" };
+	LOWPOWER_StatsTypeDef stats;
+	char label[16];
+
+	lowpower_get_stats(&stats);
+
+	WIFI_MetricsPrint(writer, "# TYPE mcu_idle_entries_total counter\n# TYPE mcu_idle_residency_ms_total counter\n");
+
+	for(uint8_t i = 0; i < LOWPOWER_MODE_COUNT; i++){
+		snprintf(label, sizeof(label), "{mode=\"%s\"}", modeNames[i]);
+		WIFI_MetricsPrintCounter(writer, "mcu_idle_entries_total", label, stats.entries[i]);
+		WIFI_MetricsPrintCounter(writer, "mcu_idle_residency_ms_total", label, stats.residency[i]);
+	}
+
+	WIFI_MetricsPrint(writer, "# TYPE mcu_idle_wakeups_total counter\n");
+	WIFI_MetricsPrintCounter(writer, "mcu_idle_wakeups_total", "{cause=\"condition\"}", stats.wakeByCondition);
+	WIFI_MetricsPrintCounter(writer, "mcu_idle_wakeups_total", "{cause=\"deadline\"}", stats.wakeByDeadline);
+}
+#endif
@@ -0,0 +1,186 @@
+/* Includes ------------------------------------------------------------------*/
+#include "wifi.h"
+
+
+/* Private prototypes --------------------------------------------------------*/
+static void WIFI_PowerSetState(WIFI_HandleTypeDef* hwifi, WIFI_PowerStateTypeDef state);
+
+
+/**
+  * @brief  Sets the power save level of the module.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  level: Power save level
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SetPowerSave(WIFI_HandleTypeDef* hwifi, WIFI_PowerSaveTypeDef level){
+
+	WIFI_ResponseTypeDef response;
+	WIFI_PowerStateTypeDef previous = hwifi->power.state;
+
+	// Mark the wake-up as running, so the command itself does not wake the module again
+	if(level == WIFI_POWERSAVE_OFF && previous == WIFI_POWER_DOZING) hwifi->power.state = WIFI_POWER_WAKING;
+
+	if(WIFI_SendCommandUint(hwifi, WIFI_CMD_POWER_SAVE, level) != WIFI_OK
+			|| WIFI_ParseResponse(wifiRxBuffer, WIFI_RX_BUFFER_SIZE, &response) != WIFI_OK){
+		// Without the OK the module keeps its previous state
+		hwifi->power.state = previous;
+		return WIFI_ERROR;
+	}
+
+	WIFI_PowerSetState(hwifi, (level == WIFI_POWERSAVE_OFF) ? WIFI_POWER_AWAKE : WIFI_POWER_DOZING);
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Sets the number of DTIM beacons the module sleeps through in
+  * 		power save. Longer intervals save more energy, but delay frames
+  * 		sent to the module.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  interval: DTIM listen interval
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_SetListenInterval(WIFI_HandleTypeDef* hwifi, uint8_t interval){
+
+	WIFI_ResponseTypeDef response;
+
+	if(WIFI_SendCommandUint(hwifi, WIFI_CMD_LISTEN_INTERVAL, interval) != WIFI_OK) return WIFI_ERROR;
+
+	return WIFI_ParseResponse(wifiRxBuffer, WIFI_RX_BUFFER_SIZE, &response);
+}
+
+
+/**
+  * @brief  Configures the power policy of WIFI_PowerProcess().
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  level: Level used while idle, WIFI_POWERSAVE_OFF disables the policy
+  * @param  idleTimeout: ms without commands until power save is enabled
+  * @param  wakeLead: ms the module is woken before a scheduled transfer
+  * @retval None
+  */
+
+void WIFI_PowerPolicyConfig(WIFI_HandleTypeDef* hwifi, WIFI_PowerSaveTypeDef level, uint32_t idleTimeout, uint32_t wakeLead){
+
+	hwifi->power.level = level;
+	hwifi->power.idleTimeout = idleTimeout;
+	hwifi->power.wakeLead = wakeLead;
+}
+
+
+/**
+  * @brief  Announces the next transfer, e.g. a periodic MQTT publish. The
+  * 		module is woken wakeLead ms earlier, so the transfer does not wait
+  * 		for the wake-up.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  tick: HAL tick of the transfer
+  * @retval None
+  */
+
+void WIFI_PowerSchedule(WIFI_HandleTypeDef* hwifi, uint32_t tick){
+
+	hwifi->power.wakeAt = tick - hwifi->power.wakeLead;
+	hwifi->power.wakeScheduled = SET;
+}
+
+
+/**
+  * @brief  Runs the power policy, should be called from the main loop. Puts
+  * 		the module into power save after idleTimeout and wakes it ahead of
+  * 		a scheduled transfer. Nothing is done while commands are queued.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_PowerProcess(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_PowerTypeDef* power = &hwifi->power;
+	uint32_t now = HAL_GetTick();
+
+	if(power->level == WIFI_POWERSAVE_OFF || hwifi->async.count > 0) return WIFI_OK;
+
+	if(power->state == WIFI_POWER_DOZING){
+		// Signed difference, so the scheduled tick may lie in the past
+		if(power->wakeScheduled == SET && (int32_t)(now - power->wakeAt) >= 0){
+			if(WIFI_PowerWake(hwifi) != WIFI_OK) return WIFI_ERROR;
+			power->wakeScheduled = RESET;
+			power->stats.scheduledWakes++;
+		}
+		return WIFI_OK;
+	}
+
+	// Stay awake if a transfer is due soon anyway
+	if(power->wakeScheduled == SET && (int32_t)(power->wakeAt - now) < (int32_t) power->idleTimeout) return WIFI_OK;
+
+	if(now - power->lastActivity < power->idleTimeout) return WIFI_OK;
+
+	if(WIFI_SetPowerSave(hwifi, power->level) != WIFI_OK) return WIFI_ERROR;
+	power->stats.dozes++;
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Wakes the module from power save. The time until the module
+  * 		answers the wake command is recorded as wake latency.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_PowerWake(WIFI_HandleTypeDef* hwifi){
+
+	if(hwifi->power.state != WIFI_POWER_DOZING) return WIFI_OK;
+
+	hwifi->power.wakePending = SET;
+	hwifi->power.wakeStart = profiler_counter();
+
+	if(WIFI_SetPowerSave(hwifi, WIFI_POWERSAVE_OFF) != WIFI_OK){
+		hwifi->power.wakePending = RESET;
+		return WIFI_ERROR;
+	}
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Reads the power statistics, the time of the current state is
+  * 		included.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  stats: Filled with the statistics
+  * @retval None
+  */
+
+void WIFI_GetPowerStats(WIFI_HandleTypeDef* hwifi, WIFI_PowerStatsTypeDef* stats){
+
+	uint32_t current = HAL_GetTick() - hwifi->power.stateSince;
+
+	memcpy(stats, &hwifi->power.stats, sizeof(*stats));
+
+	if(hwifi->power.state != WIFI_POWER_AWAKE) stats->dozeTime += current;
+	else stats->awakeTime += current;
+}
+
+
+/**
+  * @brief  Changes the power state and accounts the time of the old state.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  state: New state
+  * @retval None
+  */
+
+static void WIFI_PowerSetState(WIFI_HandleTypeDef* hwifi, WIFI_PowerStateTypeDef state){
+
+	uint32_t now = HAL_GetTick();
+
+	if(hwifi->power.state == state) return;
+
+	if(hwifi->power.state != WIFI_POWER_AWAKE) hwifi->power.stats.dozeTime += now - hwifi->power.stateSince;
+	else hwifi->power.stats.awakeTime += now - hwifi->power.stateSince;
+
+	hwifi->power.state = state;
+	hwifi->power.stateSince = now;
+}
@@ -0,0 +1,192 @@
+/* Includes ------------------------------------------------------------------*/
+#include <stdlib.h>
+
+#include "wifi.h"
+#include "binlog.h"
+#ifdef WIFI_USE_POOL
+#include "pool.h"
+#endif
+
+
+/* Private prototypes --------------------------------------------------------*/
+static void WIFI_QualityStatusSampled(WIFI_HandleTypeDef* hwifi, WIFI_StatusTypeDef status, char* response, void* context);
+static void WIFI_QualityRssiSampled(WIFI_HandleTypeDef* hwifi, WIFI_StatusTypeDef status, char* response, void* context);
+
+
+/**
+  * @brief  Sets the interval of the link quality sampler.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  sampleInterval: ms between samples, 0 disables the sampler
+  * @retval None
+  */
+
+void WIFI_QualityConfig(WIFI_HandleTypeDef* hwifi, uint32_t sampleInterval){
+
+	hwifi->quality.sampleInterval = sampleInterval;
+}
+
+
+/**
+  * @brief  Samples the link quality, should be called from the main loop
+  * 		next to WIFI_Process(). A sample queues the connection status and,
+  * 		while joined, the RSSI as two separate commands. Each is only
+  * 		queued while the queue is empty, so a data command waits for at
+  * 		most one sampling transaction. While the module dozes, the next
+  * 		sample is announced with WIFI_PowerSchedule(), so the power policy
+  * 		wakes it ahead of time. If it still dozes when the sample is due,
+  * 		e.g. because the schedule was taken, it is woken on demand.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_QualityProcess(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_QualityTypeDef* quality = &hwifi->quality;
+	uint32_t now = HAL_GetTick();
+
+	if(quality->sampleInterval == 0 || hwifi->async.count > 0) return WIFI_OK;
+
+	// A join or roam owns the module meanwhile
+	if(hwifi->join.step != WIFI_JOIN_STEP_IDLE || hwifi->roam.state != WIFI_ROAM_IDLE) return WIFI_OK;
+
+	// Queued commands do not wake the module, so the sampler does
+	if(hwifi->power.state == WIFI_POWER_DOZING){
+		if(quality->rssiPending == RESET && now - quality->sampleTick < quality->sampleInterval){
+			if(hwifi->power.wakeScheduled == RESET) WIFI_PowerSchedule(hwifi, quality->sampleTick + quality->sampleInterval);
+			return WIFI_OK;
+		}
+		if(WIFI_PowerWake(hwifi) != WIFI_OK) return WIFI_ERROR;
+		hwifi->power.stats.demandWakes++;
+	}
+
+	if(quality->rssiPending == SET){
+		if(WIFI_SubmitCommandString(hwifi, WIFI_CMD_RSSI, NULL, WIFI_QualityRssiSampled, NULL) != WIFI_OK) return WIFI_BUSY;
+		quality->rssiPending = RESET;
+		return WIFI_OK;
+	}
+
+	if(now - quality->sampleTick < quality->sampleInterval) return WIFI_OK;
+
+	if(WIFI_SubmitCommandString(hwifi, WIFI_CMD_CONNECTION_STATUS, NULL, WIFI_QualityStatusSampled, NULL) != WIFI_OK) return WIFI_BUSY;
+	quality->sampleTick = now;
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Summarises the RSSI window. The trend is the least squares slope
+  * 		over the samples in the window.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  report: Filled with the summary, all zero without samples
+  * @retval None
+  */
+
+void WIFI_GetQuality(WIFI_HandleTypeDef* hwifi, WIFI_QualityReportTypeDef* report){
+
+	WIFI_QualityTypeDef* quality = &hwifi->quality;
+	uint8_t n = quality->count;
+	int32_t sum = 0;
+	int32_t weighted = 0;
+	int32_t denominator;
+	int8_t rssi;
+
+	memset(report, 0, sizeof(*report));
+	report->connected = quality->connected;
+	report->count = n;
+
+	if(n == 0) return;
+
+	report->min = INT8_MAX;
+	report->max = INT8_MIN;
+
+	// Oldest sample first, i.e. at the head once the window wrapped
+	for(uint8_t i = 0; i < n; i++){
+		rssi = quality->window[(quality->head + i) % WIFI_QUALITY_WINDOW];
+		if(rssi < report->min) report->min = rssi;
+		if(rssi > report->max) report->max = rssi;
+		sum += rssi;
+		weighted += (int32_t) i * rssi;
+	}
+
+	report->mean = sum * 10 / n;
+
+	// slope = (n*sum(i*x) - sum(i)*sum(x)) / (n*sum(i^2) - sum(i)^2), with i = 0..n-1
+	denominator = (int32_t) n * n * ((int32_t) n * n - 1) / 12;
+	if(denominator > 0){
+		report->trend = ((int32_t) n * weighted - (int32_t) n * (n - 1) / 2 * sum) * 10 / denominator;
+	}
+}
+
+
+/**
+  * @brief  Records the connection status. A joined module gets its RSSI
+  * 		sampled next.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  status: Transfer status of the command
+  * @param  response: Response of the command
+  * @param  context: Unused
+  * @retval None
+  */
+
+static void WIFI_QualityStatusSampled(WIFI_HandleTypeDef* hwifi, WIFI_StatusTypeDef status, char* response, void* context){
+
+	WIFI_QualityTypeDef* quality = &hwifi->quality;
+	WIFI_ResponseTypeDef parsed;
+	FlagStatus connected;
+
+	if(status == WIFI_OK && WIFI_ParseResponse(response, strlen(response) + 1, &parsed) == WIFI_OK && parsed.fieldCount > 0){
+		connected = (parsed.fields[0].start[0] == '1') ? SET : RESET;
+
+		quality->statusSamples++;
+		if(connected == RESET) quality->disconnectedSamples++;
+		if(connected == RESET && quality->connected == SET){
+			quality->disconnects++;
+			BLOG("wifi: link lost, %lu disconnects", quality->disconnects);
+		}
+
+		quality->connected = connected;
+		quality->rssiPending = connected;
+	}
+
+#ifdef WIFI_USE_POOL
+	pool_free(response);
+#endif
+}
+
+
+/**
+  * @brief  Adds an RSSI sample to the window and passes it to the roaming
+  * 		policy.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  status: Transfer status of the command
+  * @param  response: Response of the command
+  * @param  context: Unused
+  * @retval None
+  */
+
+static void WIFI_QualityRssiSampled(WIFI_HandleTypeDef* hwifi, WIFI_StatusTypeDef status, char* response, void* context){
+
+	WIFI_QualityTypeDef* quality = &hwifi->quality;
+	WIFI_ResponseTypeDef parsed;
+	int8_t rssi;
+
+	if(status == WIFI_OK && WIFI_ParseResponse(response, strlen(response) + 1, &parsed) == WIFI_OK && parsed.fieldCount > 0){
+		rssi = strtol(parsed.fields[0].start, NULL, 10);
+
+		quality->rssiSamples++;
+		if(quality->count < WIFI_QUALITY_WINDOW){
+			quality->window[(quality->head + quality->count++) % WIFI_QUALITY_WINDOW] = rssi;
+		}else{
+			// Overwrite the oldest sample
+			quality->window[quality->head] = rssi;
+			quality->head = (quality->head + 1) % WIFI_QUALITY_WINDOW;
+		}
+
+		WIFI_RoamSample(hwifi, rssi);
+	}
+
+#ifdef WIFI_USE_POOL
+	pool_free(response);
+#endif
+}
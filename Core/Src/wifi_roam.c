@@ -0,0 +1,234 @@
+/* Includes ------------------------------------------------------------------*/
+#include "wifi.h"
+#include "binlog.h"
+
+
+/* Private prototypes --------------------------------------------------------*/
+static WIFI_StatusTypeDef WIFI_RoamScan(WIFI_HandleTypeDef* hwifi);
+static WIFI_StatusTypeDef WIFI_RoamRejoin(WIFI_HandleTypeDef* hwifi);
+static void WIFI_RoamReopen(WIFI_HandleTypeDef* hwifi);
+
+
+/**
+  * @brief  Configures the roaming policy of WIFI_RoamProcess() and enables
+  * 		it. A threshold of 0 dBm disables it. The RSSI is taken from the
+  * 		samples of WIFI_QualityProcess(). A roam joins the candidate by
+  * 		its BSSID, so it needs WIFI_USE_TARGETED_JOIN.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  threshold: dBm, a weaker signal starts a scan for the same SSID
+  * @param  hysteresis: dB above the threshold the signal has to recover
+  * 		until another scan is armed
+  * @param  margin: dB a candidate has to be stronger than the joined access point
+  * @retval WIFI_ERROR if roaming is enabled without WIFI_USE_TARGETED_JOIN,
+  * 		it stays disabled then
+  */
+
+WIFI_StatusTypeDef WIFI_RoamConfig(WIFI_HandleTypeDef* hwifi, int8_t threshold, uint8_t hysteresis, uint8_t margin){
+
+	WIFI_RoamTypeDef* roam = &hwifi->roam;
+
+#ifndef WIFI_USE_TARGETED_JOIN
+	// C0 would join by SSID and could land on the same weak access point
+	if(threshold < 0){
+		roam->enabled = RESET;
+		return WIFI_ERROR;
+	}
+#endif
+
+	roam->enabled = (threshold < 0) ? SET : RESET;
+	roam->threshold = threshold;
+	roam->hysteresis = hysteresis;
+	roam->margin = margin;
+	roam->armed = SET;
+	roam->weakSamples = 0;
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Runs the roaming policy, should be called from the main loop next
+  * 		to WIFI_Process() and WIFI_QualityProcess(). When the signal
+  * 		stayed below the threshold, the SSID is scanned, and a stronger
+  * 		access point is joined. The sockets that were open are reopened
+  * 		afterwards.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_RoamProcess(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_RoamTypeDef* roam = &hwifi->roam;
+
+	switch(roam->state){
+
+	case WIFI_ROAM_SCAN:
+		// The scan blocks, so it waits for the queue to drain
+		if(hwifi->async.count > 0) return WIFI_OK;
+		return WIFI_RoamScan(hwifi);
+
+	case WIFI_ROAM_JOINING:
+		if(hwifi->join.step != WIFI_JOIN_STEP_IDLE) return WIFI_OK;
+		if(hwifi->join.result != WIFI_OK) return WIFI_RoamRejoin(hwifi);
+
+		// The module joined another access point of the SSID, so the link did not improve
+		if(hwifi->join.confirmed != SET){
+			roam->stats.mismatches++;
+			BLOG("wifi: roam joined another access point than the candidate");
+			WIFI_RoamReopen(hwifi);
+			return WIFI_ERROR;
+		}
+
+		roam->stats.roams++;
+		BLOG("wifi: roamed to channel %u", hwifi->join.link.channel);
+		WIFI_RoamReopen(hwifi);
+
+		// The window described the previous access point
+		hwifi->quality.count = 0;
+		hwifi->quality.head = 0;
+		return WIFI_OK;
+
+	case WIFI_ROAM_REJOINING:
+		if(hwifi->join.step != WIFI_JOIN_STEP_IDLE) return WIFI_OK;
+		if(hwifi->join.result != WIFI_OK){
+			roam->state = WIFI_ROAM_IDLE;
+			roam->stats.rejoinFailures++;
+			BLOG("wifi: rejoin after a failed roam failed with status %d", hwifi->join.result);
+			return WIFI_ERROR;
+		}
+
+		WIFI_RoamReopen(hwifi);
+		return WIFI_OK;
+
+	// Waiting for weak samples
+	default: return WIFI_OK;
+	}
+}
+
+
+/**
+  * @brief  Evaluates an RSSI sample of the joined access point. A scan is
+  * 		started after WIFI_ROAM_WEAK_SAMPLES consecutive samples below
+  * 		the threshold, so a short fade does not scan. After a scan, the
+  * 		next one waits until the signal recovered by the hysteresis or
+  * 		WIFI_ROAM_BACKOFF_TIME passed.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  rssi: Sample in dBm
+  * @retval None
+  */
+
+void WIFI_RoamSample(WIFI_HandleTypeDef* hwifi, int8_t rssi){
+
+	WIFI_RoamTypeDef* roam = &hwifi->roam;
+
+	if(roam->enabled != SET || roam->state != WIFI_ROAM_IDLE) return;
+
+	roam->rssi = rssi;
+
+	if(rssi >= roam->threshold + roam->hysteresis) roam->armed = SET;
+
+	if(rssi >= roam->threshold){
+		roam->weakSamples = 0;
+	}else if(roam->armed == SET || HAL_GetTick() - roam->scanTick >= WIFI_ROAM_BACKOFF_TIME){
+		if(++roam->weakSamples >= WIFI_ROAM_WEAK_SAMPLES) roam->state = WIFI_ROAM_SCAN;
+	}
+}
+
+
+/**
+  * @brief  Scans the SSID for an access point that is stronger than the
+  * 		joined one by the margin and joins it. The sockets are closed
+  * 		before the disconnect and remembered for WIFI_RoamReopen(). The
+  * 		cached access point is only replaced once the join succeeded.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval WIFI_StatusTypeDef
+  */
+
+static WIFI_StatusTypeDef WIFI_RoamScan(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_RoamTypeDef* roam = &hwifi->roam;
+	WIFI_ScanResultTypeDef results[WIFI_ROAM_CANDIDATES];
+	WIFI_ScanFilterTypeDef filter;
+	WIFI_LinkTypeDef link;
+	uint8_t count;
+	uint8_t i;
+
+	filter.ssid = hwifi->ssid;
+	filter.minRssi = (roam->rssi + roam->margin > INT8_MAX) ? INT8_MAX : roam->rssi + roam->margin;
+
+	roam->stats.scans++;
+	roam->scanTick = HAL_GetTick();
+	roam->armed = RESET;
+	roam->weakSamples = 0;
+	roam->state = WIFI_ROAM_IDLE;
+
+	if(WIFI_Scan(hwifi, &filter, results, WIFI_ROAM_CANDIDATES, &count) != WIFI_OK) return WIFI_ERROR;
+
+	// The results are sorted, take the strongest that is not the joined access point
+	for(i = 0; i < count && !memcmp(results[i].bssid, hwifi->join.link.bssid, sizeof(link.bssid)); i++);
+	if(i == count) return WIFI_OK;
+
+	roam->clientSockets = hwifi->clientSockets;
+	roam->serverSockets = hwifi->serverSockets;
+	WIFI_SocketCloseAll(hwifi);
+
+	roam->offlineTick = HAL_GetTick();
+	WIFI_SendCommand(hwifi, WIFI_CMD_DISCONNECT);
+
+	memcpy(link.bssid, results[i].bssid, sizeof(link.bssid));
+	link.channel = results[i].channel;
+
+	if(WIFI_JoinLinkAsync(hwifi, &link, NULL, NULL) != WIFI_OK) return WIFI_RoamRejoin(hwifi);
+
+	roam->state = WIFI_ROAM_JOINING;
+
+	return WIFI_OK;
+}
+
+
+/**
+  * @brief  Rejoins the previous access point after the join of the candidate
+  * 		failed. It is still the cached one, so the join targets it
+  * 		first. The sockets are reopened once it succeeded.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval WIFI_ERROR, since the roam failed
+  */
+
+static WIFI_StatusTypeDef WIFI_RoamRejoin(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_RoamTypeDef* roam = &hwifi->roam;
+
+	roam->stats.failures++;
+	BLOG("wifi: roam failed with status %d, rejoining", hwifi->join.result);
+
+	roam->state = (WIFI_JoinNetworkAsync(hwifi, NULL, NULL) == WIFI_OK) ? WIFI_ROAM_REJOINING : WIFI_ROAM_IDLE;
+
+	return WIFI_ERROR;
+}
+
+
+/**
+  * @brief  Reopens the sockets that were open before the roam with their
+  * 		previous role, their settings are kept by the module.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @retval None
+  */
+
+static void WIFI_RoamReopen(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_RoamTypeDef* roam = &hwifi->roam;
+	uint32_t offline;
+
+	roam->state = WIFI_ROAM_IDLE;
+
+	for(uint8_t socket = 0; socket < WIFI_MAX_SOCKETS; socket++){
+		if(roam->serverSockets & (1 << socket)) WIFI_SocketOpen(hwifi, socket, WIFI_SOCKET_SERVER);
+		else if(roam->clientSockets & (1 << socket)) WIFI_SocketOpen(hwifi, socket, WIFI_SOCKET_CLIENT);
+	}
+
+	offline = HAL_GetTick() - roam->offlineTick;
+	roam->stats.lastOffline = offline;
+	roam->stats.sumOffline += offline;
+	if(offline > roam->stats.maxOffline) roam->stats.maxOffline = offline;
+	BLOG("wifi: sockets reopened after %lu ms offline", offline);
+}
@@ -0,0 +1,240 @@
+/* Includes ------------------------------------------------------------------*/
+#include <stdlib.h>
+
+#include "wifi.h"
+#include "stack_monitor.h"
+
+
+/* Structs -------------------------------------------------------------------*/
+/**
+ * The scan response is parsed line by line while it is received, so only the
+ * current line and the selected results are kept in memory, and the response
+ * may be larger than wifiRxBuffer.
+ */
+typedef struct
+{
+  const WIFI_ScanFilterTypeDef* filter;
+  WIFI_ScanResultTypeDef* results;
+  uint8_t size;
+  uint8_t count;
+  uint16_t length;
+  FlagStatus overflow;			// The current line does not fit and is skipped
+  WIFI_ResponseStatusTypeDef status;
+  char line[WIFI_SCAN_LINE_SIZE];
+} WIFI_ScanParserTypeDef;
+
+
+/* Private prototypes --------------------------------------------------------*/
+static WIFI_StatusTypeDef WIFI_ScanReceive(WIFI_HandleTypeDef* hwifi, void* context);
+static void WIFI_ScanFeed(WIFI_ScanParserTypeDef* parser, char c);
+static void WIFI_ScanParseLine(WIFI_ScanParserTypeDef* parser);
+static uint8_t WIFI_ScanSplit(const char* line, uint16_t length, WIFI_FieldTypeDef* fields, uint8_t size);
+static void WIFI_ScanInsert(WIFI_ScanParserTypeDef* parser, const WIFI_ScanResultTypeDef* result);
+static WIFI_SecurityTypeTypeDef WIFI_ScanSecurity(const WIFI_FieldTypeDef* field);
+
+
+/**
+  * @brief  Scans for access points with F0. Each result line is parsed as
+  * 		soon as it is received. Results that do not pass the filter are
+  * 		dropped, and of the rest only the size strongest are kept, sorted
+  * 		by RSSI.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  filter: SSID and minimum RSSI, NULL for all access points
+  * @param  results: Filled with the strongest access points
+  * @param  size: Number of results
+  * @param  count: Filled with the number of results
+  * @retval WIFI_StatusTypeDef
+  */
+
+WIFI_StatusTypeDef WIFI_Scan(WIFI_HandleTypeDef* hwifi, const WIFI_ScanFilterTypeDef* filter, WIFI_ScanResultTypeDef* results, uint8_t size, uint8_t* count){
+
+	STACK_SCOPE(WIFI_Scan);
+
+	WIFI_ScanParserTypeDef parser = { .filter = filter, .results = results, .size = size, .status = WIFI_RESPONSE_INCOMPLETE };
+	char cmd[] = WIFI_CMD_SCAN "\r";
+	WIFI_StatusTypeDef status = WIFI_Transaction(hwifi, cmd, sizeof(cmd) - 1, NULL, 0, WIFI_ScanReceive, &parser);
+
+	*count = parser.count;
+
+	return status;
+}
+
+
+/**
+  * @brief  Receiver of WIFI_Scan(), parses the response block by block
+  * 		while it is received instead of buffering it.
+  * @param  hwifi: Wifi handle, which decides which Wifi instance is used.
+  * @param  context: Scan parser
+  * @retval WIFI_OK if the module answered with OK, WIFI_ERROR otherwise
+  */
+
+static WIFI_StatusTypeDef WIFI_ScanReceive(WIFI_HandleTypeDef* hwifi, void* context){
+
+	WIFI_ScanParserTypeDef* parser = context;
+	char block[WIFI_SCAN_BLOCK_SIZE];
+	uint16_t received = 0;
+
+	while(WIFI_IS_CMDDATA_READY()){
+		if(WIFI_SPI_ReceiveBlock(hwifi, block, sizeof(block), &received) != WIFI_OK) return WIFI_ERROR;
+		for(uint16_t i = 0; i < received; i++) WIFI_ScanFeed(parser, block[i]);
+	}
+
+	return (parser->status == WIFI_RESPONSE_OK) ? WIFI_OK : WIFI_ERROR;
+}
+
+
+/**
+  * @brief  Adds a received char to the current line and parses the line
+  * 		once it is complete.
+  * @param  parser: Scan parser
+  * @param  c: Received char
+  * @retval None
+  */
+
+static void WIFI_ScanFeed(WIFI_ScanParserTypeDef* parser, char c){
+
+	if(c == (char) WIFI_RX_PADDING || c == '\r') return;
+
+	if(c != '\n'){
+		if(parser->length < sizeof(parser->line)) parser->line[parser->length++] = c;
+		else parser->overflow = SET;
+		return;
+	}
+
+	if(parser->overflow == RESET) WIFI_ScanParseLine(parser);
+
+	parser->length = 0;
+	parser->overflow = RESET;
+}
+
+
+/**
+  * @brief  Parses a complete line of the scan response. Result lines start
+  * 		with '#', the response ends with a status line.
+  * @param  parser: Scan parser
+  * @retval None
+  */
+
+static void WIFI_ScanParseLine(WIFI_ScanParserTypeDef* parser){
+
+	WIFI_FieldTypeDef fields[WIFI_SCAN_CHANNEL_FIELD + 1];
+	WIFI_ScanResultTypeDef result;
+	const WIFI_ScanFilterTypeDef* filter = parser->filter;
+	char number[8];
+
+	if(parser->length == sizeof(WIFI_MSG_STATUS_OK) - 1 && !strncmp(parser->line, WIFI_MSG_STATUS_OK, parser->length)){
+		parser->status = WIFI_RESPONSE_OK;
+		return;
+	}
+	if(parser->length >= sizeof(WIFI_MSG_STATUS_ERROR) - 1 && !strncmp(parser->line, WIFI_MSG_STATUS_ERROR, sizeof(WIFI_MSG_STATUS_ERROR) - 1)){
+		parser->status = WIFI_RESPONSE_ERROR;
+		return;
+	}
+
+	if(parser->length == 0 || parser->line[0] != '#') return;
+	if(WIFI_ScanSplit(parser->line, parser->length, fields, WIFI_SCAN_CHANNEL_FIELD + 1) <= WIFI_SCAN_CHANNEL_FIELD) return;
+
+	// Filter before anything is copied
+	if(fields[WIFI_SCAN_RSSI_FIELD].length >= sizeof(number)) return;
+	memcpy(number, fields[WIFI_SCAN_RSSI_FIELD].start, fields[WIFI_SCAN_RSSI_FIELD].length);
+	number[fields[WIFI_SCAN_RSSI_FIELD].length] = '\0';
+	result.rssi = strtol(number, NULL, 10);
+
+	if(filter != NULL && result.rssi < filter->minRssi) return;
+	if(filter != NULL && filter->ssid != NULL && (fields[WIFI_SCAN_SSID_FIELD].length != strlen(filter->ssid) ||
+			strncmp(fields[WIFI_SCAN_SSID_FIELD].start, filter->ssid, fields[WIFI_SCAN_SSID_FIELD].length))) return;
+
+	// Weaker than all kept results
+	if(parser->count == parser->size && (parser->size == 0 || result.rssi <= parser->results[parser->size - 1].rssi)) return;
+
+	if(fields[WIFI_SCAN_SSID_FIELD].length >= sizeof(result.ssid)) return;
+	memcpy(result.ssid, fields[WIFI_SCAN_SSID_FIELD].start, fields[WIFI_SCAN_SSID_FIELD].length);
+	result.ssid[fields[WIFI_SCAN_SSID_FIELD].length] = '\0';
+
+	if(WIFI_StringToBSSID(fields[WIFI_SCAN_BSSID_FIELD].start, fields[WIFI_SCAN_BSSID_FIELD].length, result.bssid) != WIFI_OK) return;
+
+	if(fields[WIFI_SCAN_CHANNEL_FIELD].length >= sizeof(number)) return;
+	memcpy(number, fields[WIFI_SCAN_CHANNEL_FIELD].start, fields[WIFI_SCAN_CHANNEL_FIELD].length);
+	number[fields[WIFI_SCAN_CHANNEL_FIELD].length] = '\0';
+	result.channel = strtoul(number, NULL, 10);
+
+	result.security = WIFI_ScanSecurity(&fields[WIFI_SCAN_SECURITY_FIELD]);
+
+	WIFI_ScanInsert(parser, &result);
+}
+
+
+/**
+  * @brief  Splits a result line at commas. A quoted field, i.e. the SSID,
+  * 		may contain commas, its quotes are not part of the field.
+  * @param  line: Result line (not \0 terminated)
+  * @param  length: Line length
+  * @param  fields: Filled with the fields
+  * @param  size: Number of fields to split at most
+  * @retval Number of fields
+  */
+
+static uint8_t WIFI_ScanSplit(const char* line, uint16_t length, WIFI_FieldTypeDef* fields, uint8_t size){
+
+	uint8_t count = 0;
+	uint16_t i = 0;
+
+	while(i <= length && count < size){
+		uint16_t start = i;
+
+		if(i < length && line[i] == '"'){
+			// The field ends at a quote, which is followed by a comma or the line end
+			start = ++i;
+			while(i < length && !(line[i] == '"' && (i + 1 == length || line[i + 1] == ','))) i++;
+			fields[count].start = &line[start];
+			fields[count].length = i - start;
+			i += 2;
+		}else{
+			while(i < length && line[i] != ',') i++;
+			fields[count].start = &line[start];
+			fields[count].length = i - start;
+			i++;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+
+/**
+  * @brief  Inserts a result into the list sorted by RSSI. If the list is
+  * 		full, the weakest result is dropped.
+  * @param  parser: Scan parser
+  * @param  result: Result that is stronger than the weakest kept one
+  * @retval None
+  */
+
+static void WIFI_ScanInsert(WIFI_ScanParserTypeDef* parser, const WIFI_ScanResultTypeDef* result){
+
+	uint8_t i = (parser->count < parser->size) ? parser->count++ : parser->size - 1;
+
+	// Move weaker results down
+	while(i > 0 && parser->results[i - 1].rssi < result->rssi){
+		parser->results[i] = parser->results[i - 1];
+		i--;
+	}
+
+	parser->results[i] = *result;
+}
+
+
+/**
+  * @brief  Maps the security field of a result line, e.g. "WPA2 AES".
+  * @param  field: Security field
+  * @retval Security type
+  */
+
+static WIFI_SecurityTypeTypeDef WIFI_ScanSecurity(const WIFI_FieldTypeDef* field){
+
+	if(field->length >= 4 && !strncmp(field->start, "Open", 4)) return OPEN;
+	if(field->length >= 3 && !strncmp(field->start, "WEP", 3)) return WEP;
+	if(field->length == 8 && !strncmp(field->start, "WPA2 AES", 8)) return WPA2_AES;
+
+	return WPA_MIXED;
+}
@@ -0,0 +1,76 @@
+/*
+ * bench_parse.c
+ *
+ * Host microbenchmark of the response tokenizer, WIFI_StringToIP and trimstr.
+ * Times are taken with profiler_counter() in ns of the host, so they compare
+ * changes to the parsing code, but say nothing about cycles on the target.
+ * bench_parse [iterations]
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_hal.h"
+#include "profiler.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+#define BENCH(name, iterations, body)	do{\
+		uint32_t benchStart = profiler_counter();\
+		for(uint32_t benchIteration = 0; benchIteration < (iterations); benchIteration++){ body; }\
+		uint32_t benchTime = profiler_counter() - benchStart;\
+		printf("%-28s %8.1f ns/call\n", name, (double) benchTime / (iterations));\
+	}while(0)
+
+
+/* Variables -----------------------------------------------------------------*/
+static const char settings[] = "\r\nssid,pw,3,1,0,192.168.1.7,255.255.255.0,192.168.1.1,8.8.8.8,0.0.0.0,5,0,0,CN,1\r\nOK\r\n> ";
+static const char ok[] = "\r\nOK\r\n> ";
+static const char error[] = "\r\n-1\r\nERROR: Invalid parameters\r\n> ";
+
+// Keeps the compiler from dropping the benchmarked calls
+volatile uint32_t benchSink;
+
+
+int main(int argc, char** argv){
+
+	uint32_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000000;
+	WIFI_ResponseTypeDef response;
+	uint32_t ip;
+	static char padded[WIFI_RX_BUFFER_SIZE];
+	static char copy[WIFI_RX_BUFFER_SIZE];
+
+	// A receive buffer as it comes off the bus: response, odd padding and the zeroed rest
+	memset(padded, '\0', sizeof(padded));
+	memcpy(padded, settings, sizeof(settings) - 1);
+	padded[sizeof(settings) - 1] = (char) WIFI_RX_PADDING;
+
+	printf("host ns, not target cycles, %lu iterations\n", (unsigned long) iterations);
+
+	BENCH("WIFI_ParseResponse settings", iterations, {
+		benchSink += WIFI_ParseResponse(settings, sizeof(settings), &response);
+		benchSink += response.fieldCount;
+	});
+	BENCH("WIFI_ParseResponse ok", iterations, {
+		benchSink += WIFI_ParseResponse(ok, sizeof(ok), &response);
+	});
+	BENCH("WIFI_ParseResponse error", iterations, {
+		benchSink += WIFI_ParseResponse(error, sizeof(error), &response);
+	});
+	BENCH("WIFI_StringToIP", iterations, {
+		benchSink += WIFI_StringToIP("255.255.255.0", 13, &ip);
+		benchSink += ip;
+	});
+	BENCH("memcpy rx buffer (baseline)", iterations, {
+		memcpy(copy, padded, sizeof(copy));
+		benchSink += copy[benchIteration % sizeof(copy)];
+	});
+	BENCH("memcpy rx buffer + trimstr", iterations, {
+		memcpy(copy, padded, sizeof(copy));
+		trimstr(copy, sizeof(copy), (char) WIFI_RX_PADDING);
+		benchSink += copy[0];
+	});
+
+	return 0;
+}
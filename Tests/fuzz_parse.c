@@ -0,0 +1,187 @@
+/*
+ * fuzz_parse.c
+ *
+ * Fuzz target for the response tokenizer, WIFI_StringToIP and trimstr. It
+ * checks that nothing is read or written outside the input and that the
+ * results are consistent. Built with clang -fsanitize=fuzzer it is a
+ * libFuzzer target, otherwise a standalone driver mutates a corpus of module
+ * responses with a fixed seed: fuzz_parse [iterations] [seed]
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_hal.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+#define FUZZ_MAX_INPUT 512
+#define FUZZ_CHECK(condition)	do{ if(!(condition)){ fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); abort(); } }while(0)
+
+
+/* Target --------------------------------------------------------------------*/
+static void fuzz_parse(const char* data, uint16_t size){
+
+	WIFI_ResponseTypeDef response;
+	WIFI_StatusTypeDef status = WIFI_ParseResponse(data, size, &response);
+	const char* payloadEnd = response.payload + response.payloadLength;
+
+	FUZZ_CHECK((status == WIFI_OK) == (response.status == WIFI_RESPONSE_OK));
+	FUZZ_CHECK(response.payload >= data && payloadEnd <= data + size);
+	FUZZ_CHECK(response.fieldCount >= 1 && response.fieldCount <= WIFI_MAX_RESPONSE_FIELDS);
+	FUZZ_CHECK(response.fields[0].start == response.payload);
+
+	for(uint8_t i = 0; i < response.fieldCount; i++){
+		FUZZ_CHECK(response.fields[i].start >= response.payload);
+		FUZZ_CHECK(response.fields[i].start + response.fields[i].length <= payloadEnd);
+	}
+}
+
+static void fuzz_ip(const char* data, uint16_t size){
+
+	uint32_t ip = 0;
+	uint32_t again = 0;
+	char text[WIFI_IP_STRING_SIZE];
+	uint16_t length;
+
+	if(WIFI_StringToIP(data, size, &ip) != WIFI_OK) return;
+
+	// An accepted address survives the round trip through its dotted notation
+	length = WIFI_IPToString(ip, text, sizeof(text));
+	FUZZ_CHECK(length > 0 && length < sizeof(text));
+	FUZZ_CHECK(WIFI_StringToIP(text, length, &again) == WIFI_OK && again == ip);
+}
+
+static void fuzz_trim(const char* data, uint16_t size){
+
+	char* str;
+	char c;
+	uint32_t length = 0;
+
+	if(size == 0) return;
+
+	// Exactly sized, so a missing terminator is caught by the sanitizer
+	c = data[0];
+	str = malloc(size - 1 > 0 ? size - 1 : 1);
+	memcpy(str, &data[1], size - 1);
+	trimstr(str, size - 1, c);
+
+	if(size - 1 == 0){
+		free(str);
+		return;
+	}
+	while(length < (uint32_t) size - 1 && str[length] != '\0') length++;
+	FUZZ_CHECK(length < (uint32_t) size - 1);
+	if(length > 0 && c != '\0') FUZZ_CHECK(str[0] != c && str[length - 1] != c);
+
+	free(str);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size){
+
+	char* input;
+
+	if(size > FUZZ_MAX_INPUT) return 0;
+
+	// Exactly sized copies, so every overread is caught by the sanitizer
+	input = malloc(size > 0 ? size : 1);
+	memcpy(input, data, size);
+
+	fuzz_parse(input, size);
+	fuzz_ip(input, size);
+	fuzz_trim(input, size);
+
+	free(input);
+
+	return 0;
+}
+
+
+/* Standalone driver ---------------------------------------------------------*/
+#ifndef FUZZ_LIBFUZZER
+
+static const char* corpus[] = {
+	"\r\nOK\r\n> ",
+	"\r\nERROR\r\n> ",
+	"\r\n-1\r\nERROR: Invalid parameters\r\n> ",
+	"\r\n[JOIN   ] ssid,192.168.1.7,0,0\r\nOK\r\n> ",
+	"\r\nssid,pw,3,1,0,192.168.1.7,255.255.255.0,192.168.1.1,8.8.8.8,0.0.0.0,5,0,0,CN,1\r\nOK\r\n> ",
+	"\r\nAA:BB:CC:DD:EE:01,6\r\nOK\r\n> ",
+	"\r\n#001,\"home,net\",AA:BB:CC:DD:EE:01,-60,0,0,WPA2 AES,0,6\r\nOK\r\n> ",
+	"\r\n-62\r\nOK\r\n> ",
+	"\r\n,,,,,,,,,,,,,,,,,,,,,,,\r\nOK\r\n> ",
+	"192.168.1.7",
+	"255.255.255.255",
+	"0.0.0.0",
+	"\x15\x15\r\nOK\r\n> \x15",
+};
+
+static uint32_t rng = 1;
+
+static uint32_t fuzz_random(void){
+
+	// xorshift32
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+
+	return rng;
+}
+
+static size_t fuzz_mutate(uint8_t* data, size_t size){
+
+	static const char tokens[] = { ',', '.', '\r', '\n', '>', ' ', '0', '9', 'O', 'K', (char) WIFI_RX_PADDING, '\0' };
+	uint32_t mutations = 1 + fuzz_random() % 8;
+
+	while(mutations-- > 0){
+		uint32_t pos = (size > 0) ? fuzz_random() % size : 0;
+
+		switch(fuzz_random() % 5){
+		case 0: if(size > 0) data[pos] = fuzz_random(); break;
+		case 1: if(size > 0) data[pos] = tokens[fuzz_random() % sizeof(tokens)]; break;
+		case 2: size = pos; break;
+		case 3:
+			if(size < FUZZ_MAX_INPUT){
+				memmove(&data[pos + 1], &data[pos], size - pos);
+				data[pos] = tokens[fuzz_random() % sizeof(tokens)];
+				size++;
+			}
+			break;
+		default: if(size > 0){ memmove(&data[pos], &data[pos + 1], size - pos - 1); size--; } break;
+		}
+	}
+
+	return size;
+}
+
+int main(int argc, char** argv){
+
+	static uint8_t data[FUZZ_MAX_INPUT + 1];
+	uint32_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000000;
+	size_t size;
+
+	rng = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0x2545F491;
+	if(rng == 0) rng = 1;
+
+	for(uint32_t i = 0; i < iterations; i++){
+		if(i % 16 == 0){
+			// Random bytes of random length
+			size = fuzz_random() % (FUZZ_MAX_INPUT + 1);
+			for(size_t j = 0; j < size; j++) data[j] = fuzz_random();
+		}
+		else{
+			const char* seed = corpus[fuzz_random() % (sizeof(corpus) / sizeof(corpus[0]))];
+			size = strlen(seed);
+			memcpy(data, seed, size);
+			size = fuzz_mutate(data, size);
+		}
+		LLVMFuzzerTestOneInput(data, size);
+	}
+
+	printf("fuzz_parse: %lu inputs, no findings\n", (unsigned long) iterations);
+
+	return 0;
+}
+
+#endif
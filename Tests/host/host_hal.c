@@ -0,0 +1,250 @@
+/*
+ * host_hal.c
+ *
+ * HAL, flash profile and stack monitor stubs for the host test builds, see host_hal.h.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_hal.h"
+
+
+/* Variables -----------------------------------------------------------------*/
+SPI_HandleTypeDef hspi3;
+uint32_t SystemCoreClock = 80000000;
+
+const char* (*host_responder)(const char* command) = host_respond_ok;
+const char* (*host_raw_responder)(const char* command, uint32_t* length) = NULL;
+char host_tx[HOST_TX_LOG_SIZE];
+uint32_t host_txLength = 0;
+uint32_t host_errorHandlerCalls = 0;
+WIFI_LinkTypeDef host_link;
+uint8_t host_linkValid = 0;
+uint8_t host_busy = 0;
+uint32_t host_blogRecords = 0;
+const char* host_data = NULL;
+uint32_t host_dataLength = 0;
+
+static uint32_t tick = 0;
+static char command[WIFI_TX_BUFFER_SIZE];
+static uint32_t commandLength = 0;
+static char lastCommand[WIFI_TX_BUFFER_SIZE];
+static char response[HOST_RESPONSE_SIZE];
+static uint32_t responseLength = 0;
+static uint32_t responsePos = 0;
+static uint32_t payloadSkip = 0;
+static GPIO_PinState ready = GPIO_PIN_SET;
+
+
+/* Scripted module -----------------------------------------------------------*/
+/**
+ * @brief Clears the transmit log and the module state
+ */
+void host_reset(void){
+
+	host_responder = host_respond_ok;
+	host_raw_responder = NULL;
+	host_txLength = 0;
+	host_errorHandlerCalls = 0;
+	host_linkValid = 0;
+	host_busy = 0;
+	host_blogRecords = 0;
+	host_data = NULL;
+	host_dataLength = 0;
+	commandLength = 0;
+	responseLength = 0;
+	responsePos = 0;
+	payloadSkip = 0;
+	lastCommand[0] = '\0';
+	ready = GPIO_PIN_SET;
+}
+
+/**
+ * @brief Default responder, which acknowledges every command
+ */
+const char* host_respond_ok(const char* cmd){
+
+	(void) cmd;
+
+	return "OK";
+}
+
+/**
+ * @brief Last command seen by the module, without \r
+ */
+const char* host_last_command(void){
+
+	return lastCommand;
+}
+
+static void host_answer(const char* payload){
+
+	responseLength = snprintf(response, sizeof(response), "\r\n%s\r\n> ", payload);
+	if(responseLength >= sizeof(response)) responseLength = sizeof(response) - 1;
+	if(responseLength % 2) response[responseLength++] = (char) WIFI_RX_PADDING;
+	responsePos = 0;
+	ready = GPIO_PIN_SET;
+}
+
+// Answers R0 with host_data, which is framed like the module does and not read as a string
+static void host_answer_data(void){
+
+	responseLength = 0;
+	memcpy(response, "\r\n", 2);
+	responseLength += 2;
+	memcpy(response + responseLength, host_data, host_dataLength);
+	responseLength += host_dataLength;
+	memcpy(response + responseLength, WIFI_MSG_READ_END, sizeof(WIFI_MSG_READ_END) - 1);
+	responseLength += sizeof(WIFI_MSG_READ_END) - 1;
+	if(responseLength % 2) response[responseLength++] = (char) WIFI_RX_PADDING;
+	responsePos = 0;
+	ready = GPIO_PIN_SET;
+	host_data = NULL;
+}
+
+// Answers with bytes that already hold the framing, e.g. a recorded response
+static void host_answer_raw(const char* data, uint32_t length){
+
+	responseLength = (length < sizeof(response)) ? length : sizeof(response) - 1;
+	memcpy(response, data, responseLength);
+	if(responseLength % 2) response[responseLength++] = (char) WIFI_RX_PADDING;
+	responsePos = 0;
+	ready = GPIO_PIN_SET;
+}
+
+static void host_answer_command(const char* cmd){
+
+	const char* data;
+	uint32_t length = 0;
+
+	if(host_raw_responder != NULL){
+		data = host_raw_responder(cmd, &length);
+		host_answer_raw(data, length);
+		return;
+	}
+	host_answer(host_responder(cmd));
+}
+
+static void host_receive_byte(char c){
+
+	if(host_txLength < sizeof(host_tx)) host_tx[host_txLength++] = c;
+
+	// Payload of a send command, answered once it is complete
+	if(payloadSkip > 0){
+		if(--payloadSkip == 0){
+			if(host_raw_responder != NULL) host_answer_command(lastCommand);
+			else host_answer("OK");
+		}
+		return;
+	}
+	if(commandLength == 0 && c == (char) WIFI_TX_PADDING) return;
+
+	if(c != '\r'){
+		if(commandLength < sizeof(command) - 1) command[commandLength++] = c;
+		return;
+	}
+
+	command[commandLength] = '\0';
+	commandLength = 0;
+	memcpy(lastCommand, command, sizeof(lastCommand));
+
+	if(!strncmp(command, "S3=", 3) && atoi(&command[3]) > 0){
+		payloadSkip = atoi(&command[3]);
+		return;
+	}
+	if(host_raw_responder == NULL && host_data != NULL && !strcmp(command, "R0")){
+		host_answer_data();
+		return;
+	}
+	host_answer_command(command);
+}
+
+
+/* HAL -----------------------------------------------------------------------*/
+uint32_t HAL_GetTick(void){
+
+	return tick++;
+}
+
+void HAL_Delay(uint32_t delay){
+
+	tick += delay;
+}
+
+void Error_Handler(void){
+
+	host_errorHandlerCalls++;
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* port, uint16_t pin){
+
+	(void) port;
+	(void) pin;
+
+	return host_busy ? GPIO_PIN_RESET : ready;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state){
+
+	(void) port;
+	(void) pin;
+
+	// The module is ready for the next command once nothing is left to read
+	if(state == GPIO_PIN_SET && responseLength == 0 && payloadSkip == 0) ready = GPIO_PIN_SET;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef* hspi, uint8_t* data, uint16_t size, uint32_t timeout){
+
+	(void) hspi;
+	(void) timeout;
+
+	// The bus is clocked in 16bit words
+	for(uint32_t i = 0; i < 2u * size; i++) host_receive_byte((char) data[i]);
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef* hspi, uint8_t* data, uint16_t size, uint32_t timeout){
+
+	(void) hspi;
+	(void) timeout;
+
+	for(uint32_t i = 0; i < 2u * size; i += 2){
+		data[i] = (responsePos < responseLength) ? response[responsePos++] : (char) WIFI_RX_PADDING;
+		data[i + 1] = (responsePos < responseLength) ? response[responsePos++] : (char) WIFI_RX_PADDING;
+		if(responsePos >= responseLength){
+			responseLength = 0;
+			ready = GPIO_PIN_RESET;
+		}
+	}
+
+	return HAL_OK;
+}
+
+
+/* Flash profile and stack monitor ------------------------------------------*/
+// Weak, so a test can link wifi_config.c instead
+__attribute__((weak)) uint32_t WIFI_ConfigFingerprint(WIFI_HandleTypeDef* hwifi){ (void) hwifi; return 0; }
+__attribute__((weak)) WIFI_StatusTypeDef WIFI_ConfigLoad(uint32_t* fingerprint){ (void) fingerprint; return WIFI_ERROR; }
+__attribute__((weak)) WIFI_StatusTypeDef WIFI_ConfigStore(uint32_t fingerprint){ (void) fingerprint; return WIFI_OK; }
+__attribute__((weak)) WIFI_StatusTypeDef WIFI_ConfigInvalidate(void){ return WIFI_OK; }
+#ifdef WIFI_USE_TARGETED_JOIN
+__attribute__((weak)) WIFI_StatusTypeDef WIFI_LinkLoad(WIFI_LinkTypeDef* link){ *link = host_link; return host_linkValid ? WIFI_OK : WIFI_ERROR; }
+__attribute__((weak)) WIFI_StatusTypeDef WIFI_LinkStore(const WIFI_LinkTypeDef* link){ host_link = *link; host_linkValid = 1; return WIFI_OK; }
+__attribute__((weak)) WIFI_StatusTypeDef WIFI_LinkInvalidate(void){ host_linkValid = 0; return WIFI_OK; }
+#endif
+uint32_t stack_high_water(void){ return 0; }
+
+
+/* Binary log ----------------------------------------------------------------*/
+void blog_write(uint32_t id, const uint32_t* args, uint32_t nArgs){
+
+	(void) id;
+	(void) args;
+	(void) nArgs;
+
+	host_blogRecords++;
+}
@@ -0,0 +1,46 @@
+/*
+ * host_hal.h
+ *
+ * HAL stubs to run the driver on the host. The SPI bus is connected to a
+ * scripted module: every command terminated by \r is answered by
+ * host_responder, which returns the payload in front of the status trailer,
+ * e.g. "OK" or "1\r\nOK". If host_raw_responder is set, it answers instead
+ * with the complete response bytes, see host_replay.h. All transmitted bytes
+ * are logged in host_tx.
+ * The host test helpers in test.h are shared by the test programs.
+ */
+
+#ifndef HOST_HAL_H_
+#define HOST_HAL_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include "wifi.h"
+#include "binlog.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+#define HOST_TX_LOG_SIZE 8192
+#define HOST_RESPONSE_SIZE 2048
+
+
+/* Variables -----------------------------------------------------------------*/
+extern SPI_HandleTypeDef hspi3;
+extern const char* (*host_responder)(const char* command);
+extern const char* (*host_raw_responder)(const char* command, uint32_t* length);
+extern char host_tx[HOST_TX_LOG_SIZE];
+extern uint32_t host_txLength;
+extern uint32_t host_errorHandlerCalls;
+extern WIFI_LinkTypeDef host_link;		// Link cache in flash
+extern uint8_t host_linkValid;
+extern uint8_t host_busy;				// Holds CMD/DATA READY low
+extern uint32_t host_blogRecords;		// BLOG() records written
+extern const char* host_data;			// Payload of the next R0 answer, may hold any byte
+extern uint32_t host_dataLength;
+
+
+/* Prototypes ----------------------------------------------------------------*/
+void host_reset(void);
+const char* host_respond_ok(const char* command);
+const char* host_last_command(void);
+
+#endif /* HOST_HAL_H_ */
@@ -0,0 +1,205 @@
+/*
+ * host_replay.c
+ *
+ * Replay of a captured session on the scripted module, see host_replay.h.
+ * The reader only knows the JSON written by spi_trace.py: an object with an
+ * "exchanges" array of flat objects.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_replay.h"
+
+
+/* Structs -------------------------------------------------------------------*/
+typedef struct
+{
+  char command[WIFI_TX_BUFFER_SIZE];	// Header and payload, the header ends with \r
+  char response[HOST_RESPONSE_SIZE];	// Bytes on the bus, with the framing
+  uint32_t responseLength;
+  uint8_t replayable;
+} HOST_ExchangeTypeDef;
+
+
+/* Variables -----------------------------------------------------------------*/
+uint32_t host_replayMismatches = 0;
+uint32_t host_replayRefused = 0;
+
+static HOST_ExchangeTypeDef exchanges[HOST_REPLAY_EXCHANGES];
+static uint32_t exchangeCount = 0;
+static uint32_t next = 0;
+static const char error[] = "\r\nERROR\r\n> ";
+
+
+/* JSON ----------------------------------------------------------------------*/
+// Skips a string starting at its opening quote, returns the position after the closing quote
+static const char* host_replay_skip_string(const char* p){
+
+	for(p++; *p != '\0' && *p != '"'; p++){
+		if(*p == '\\' && p[1] != '\0') p++;
+	}
+
+	return (*p == '"') ? p + 1 : NULL;
+}
+
+// Decodes a string starting at its opening quote, \u escapes above 0xFF are not written by spi_trace.py
+static uint8_t host_replay_string(const char* p, char* dst, uint32_t size, uint32_t* length){
+
+	char hex[5] = {0};
+	char c;
+
+	*length = 0;
+	for(p++; *p != '"'; p++){
+		if(*p == '\0') return 0;
+		c = *p;
+		if(c == '\\'){
+			switch(*++p){
+			case 'n': c = '\n'; break;
+			case 'r': c = '\r'; break;
+			case 't': c = '\t'; break;
+			case 'b': c = '\b'; break;
+			case 'f': c = '\f'; break;
+			case 'u':
+				if(strlen(p) < 5) return 0;
+				memcpy(hex, p + 1, 4);
+				if(strtoul(hex, NULL, 16) > 0xFF) return 0;
+				c = (char) strtoul(hex, NULL, 16);
+				p += 4;
+				break;
+			case '\0': return 0;
+			default: c = *p; break;
+			}
+		}
+		if(*length >= size) return 0;
+		dst[(*length)++] = c;
+	}
+
+	return 1;
+}
+
+// Finds the value of a key in the object between p and end
+static const char* host_replay_value(const char* p, const char* end, const char* key){
+
+	uint32_t keyLength = strlen(key);
+
+	while(p != NULL && p < end){
+		if(*p != '"'){
+			p++;
+			continue;
+		}
+		if(!strncmp(p + 1, key, keyLength) && p[keyLength + 1] == '"'){
+			p += keyLength + 2;
+			while(*p == ' ' || *p == ':' || *p == '\n') p++;
+			return p;
+		}
+		p = host_replay_skip_string(p);
+	}
+
+	return NULL;
+}
+
+
+/* Replay --------------------------------------------------------------------*/
+/**
+ * @brief Loads the exchanges of a script and rewinds the replay
+ * @retval Number of exchanges, -1 if the script cannot be read
+ */
+int host_replay_load(const char* path){
+
+	FILE* file = fopen(path, "rb");
+	char* json;
+	const char* p;
+	const char* end;
+	const char* value;
+	long size;
+	int result;
+	uint32_t length;
+	HOST_ExchangeTypeDef* exchange;
+
+	if(file == NULL) return -1;
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	json = calloc(size + 1, 1);
+	if(json == NULL || fread(json, 1, size, file) != (size_t) size){
+		fclose(file);
+		free(json);
+		return -1;
+	}
+	fclose(file);
+
+	exchangeCount = 0;
+	next = 0;
+	host_replayMismatches = 0;
+	host_replayRefused = 0;
+
+	p = strstr(json, "\"exchanges\"");
+	if(p != NULL) p = strchr(p, '[');
+
+	while(p != NULL && (p = strpbrk(p, "{]")) != NULL && *p == '{'){
+		// Find the end of the object, braces may appear inside the strings
+		for(end = p + 1; end != NULL && *end != '}' && *end != '\0'; ){
+			end = (*end == '"') ? host_replay_skip_string(end) : end + 1;
+		}
+		if(end == NULL || *end != '}' || exchangeCount == HOST_REPLAY_EXCHANGES) break;
+
+		exchange = &exchanges[exchangeCount++];
+		memset(exchange, 0, sizeof(*exchange));
+
+		value = host_replay_value(p, end, "command");
+		if(value == NULL || *value != '"' || !host_replay_string(value, exchange->command, sizeof(exchange->command) - 1, &length)) break;
+		exchange->command[length] = '\0';
+
+		value = host_replay_value(p, end, "response");
+		if(value == NULL || *value != '"') break;
+		exchange->replayable = host_replay_string(value, exchange->response, sizeof(exchange->response), &exchange->responseLength);
+
+		value = host_replay_value(p, end, "replayable");
+		if(value == NULL || strncmp(value, "true", 4)) exchange->replayable = 0;
+
+		p = end + 1;
+	}
+
+	// The array has to end after the last exchange
+	result = (p == NULL || *p != ']') ? -1 : (int) exchangeCount;
+	free(json);
+
+	return result;
+}
+
+/**
+ * @brief Raw responder, which answers a command with the next exchange of the script
+ */
+const char* host_replay_respond(const char* command, uint32_t* length){
+
+	HOST_ExchangeTypeDef* exchange = &exchanges[next];
+	uint32_t commandLength = strlen(command);
+
+	*length = sizeof(error) - 1;
+
+	if(next >= exchangeCount || strncmp(exchange->command, command, commandLength) || exchange->command[commandLength] != '\r'){
+		host_replayMismatches++;
+		return error;
+	}
+	next++;
+
+	if(!exchange->replayable){
+		host_replayRefused++;
+		return error;
+	}
+
+	*length = exchange->responseLength;
+
+	return exchange->response;
+}
+
+/**
+ * @brief Number of exchanges that were not replayed yet
+ */
+uint32_t host_replay_remaining(void){
+
+	return exchangeCount - next;
+}
@@ -0,0 +1,32 @@
+/*
+ * host_replay.h
+ *
+ * Replays a session exported by Tools/spi_trace.py --script on the scripted
+ * module. Set host_raw_responder to host_replay_respond: each command must
+ * match the next exchange of the script and is answered with its recorded
+ * response bytes. Exchanges that the recorder truncated are answered with
+ * ERROR and counted in host_replayRefused.
+ */
+
+#ifndef HOST_REPLAY_H_
+#define HOST_REPLAY_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include "host_hal.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+#define HOST_REPLAY_EXCHANGES 64
+
+
+/* Variables -----------------------------------------------------------------*/
+extern uint32_t host_replayMismatches;	// Commands that did not match the script
+extern uint32_t host_replayRefused;		// Exchanges marked as not replayable
+
+
+/* Prototypes ----------------------------------------------------------------*/
+int host_replay_load(const char* path);
+const char* host_replay_respond(const char* command, uint32_t* length);
+uint32_t host_replay_remaining(void);
+
+#endif /* HOST_REPLAY_H_ */
@@ -0,0 +1,26 @@
+/*
+ * test.h
+ *
+ * Checks for the host tests. A failed check is reported with its location
+ * and the test goes on, TEST_RESULT() returns the exit code for main().
+ */
+
+#ifndef TEST_H_
+#define TEST_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+
+
+/* Variables -----------------------------------------------------------------*/
+static unsigned testChecks = 0;
+static unsigned testFailures = 0;
+
+
+/* Macros --------------------------------------------------------------------*/
+#define TEST_CHECK(condition)	do{ testChecks++; if(!(condition)){ testFailures++;\
+									printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); } }while(0)
+
+#define TEST_RESULT(name)		(printf("%s: %u checks, %u failed\n", name, testChecks, testFailures), testFailures ? 1 : 0)
+
+#endif /* TEST_H_ */
@@ -0,0 +1,109 @@
+/*
+ * test_async.c
+ *
+ * Checks the command queue run by WIFI_Process(): completion, the
+ * statistics of each command class, and timeouts while the module never
+ * becomes ready to take the command, queued or blocking.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+
+#include "host_hal.h"
+#include "test.h"
+
+
+/* Variables -----------------------------------------------------------------*/
+static WIFI_StatusTypeDef lastStatus;
+static uint32_t completions = 0;
+
+
+/* Helpers -------------------------------------------------------------------*/
+static void completed(WIFI_HandleTypeDef* hwifi, WIFI_StatusTypeDef status, char* response, void* context){
+
+	(void) hwifi;
+	(void) response;
+	(void) context;
+
+	lastStatus = status;
+	completions++;
+}
+
+static void run(WIFI_HandleTypeDef* hwifi){
+
+	while(WIFI_Process(hwifi) == WIFI_BUSY);
+}
+
+
+/* Tests ---------------------------------------------------------------------*/
+static void test_completion(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_CmdStatsTypeDef* stats = &hwifi->stats.cmd[WIFI_CMD_CLASS_P];
+
+	host_reset();
+	memset(&hwifi->stats, 0, sizeof(hwifi->stats));
+	completions = 0;
+
+	TEST_CHECK(WIFI_SubmitCommandUint(hwifi, "P2=", 8080, completed, NULL) == WIFI_OK);
+	run(hwifi);
+	TEST_CHECK(completions == 1 && lastStatus == WIFI_OK);
+	TEST_CHECK(stats->count == 1 && stats->errors == 0);
+	TEST_CHECK(stats->bytesTx == sizeof("P2=8080\r") - 1 && stats->bytesRx > 0);
+}
+
+static void test_ready_timeout(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_CmdStatsTypeDef* stats = &hwifi->stats.cmd[WIFI_CMD_CLASS_C];
+
+	host_reset();
+	memset(&hwifi->stats, 0, sizeof(hwifi->stats));
+	completions = 0;
+
+	// The module never gets ready to take the command
+	host_busy = 1;
+	TEST_CHECK(WIFI_SubmitCommandString(hwifi, "CS", NULL, completed, NULL) == WIFI_OK);
+	run(hwifi);
+	TEST_CHECK(completions == 1 && lastStatus == WIFI_TIMEOUT);
+	TEST_CHECK(host_txLength == 0);
+	TEST_CHECK(stats->count == 1 && stats->errors == 1);
+	TEST_CHECK(host_blogRecords == 1);
+	TEST_CHECK(hwifi->stats.cmd[WIFI_CMD_CLASS_OTHER].errors == 0);
+
+	// The queue keeps working once the module is back
+	host_busy = 0;
+	TEST_CHECK(WIFI_SubmitCommandString(hwifi, "CS", NULL, completed, NULL) == WIFI_OK);
+	run(hwifi);
+	TEST_CHECK(completions == 2 && lastStatus == WIFI_OK);
+	TEST_CHECK(stats->count == 2 && stats->errors == 1);
+}
+
+static void test_blocking_timeout(WIFI_HandleTypeDef* hwifi){
+
+	char cmd[] = "CS\r";
+
+	host_reset();
+	memset(&hwifi->stats, 0, sizeof(hwifi->stats));
+
+	// A blocking command gives up after WIFI_TIMEOUT_TIME instead of spinning forever
+	host_busy = 1;
+	TEST_CHECK(WIFI_SendATCommand(hwifi, cmd, sizeof(cmd), wifiRxBuffer, WIFI_RX_BUFFER_SIZE) == WIFI_TIMEOUT);
+	TEST_CHECK(host_txLength == 0);
+	TEST_CHECK(hwifi->stats.cmd[WIFI_CMD_CLASS_C].errors == 1);
+
+	host_busy = 0;
+	TEST_CHECK(WIFI_SendATCommand(hwifi, cmd, sizeof(cmd), wifiRxBuffer, WIFI_RX_BUFFER_SIZE) == WIFI_OK);
+}
+
+
+int main(void){
+
+	static WIFI_HandleTypeDef hwifi;
+
+	hwifi.handle = &hspi3;
+
+	test_completion(&hwifi);
+	test_ready_timeout(&hwifi);
+	test_blocking_timeout(&hwifi);
+
+	return TEST_RESULT("test_async");
+}
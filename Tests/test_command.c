@@ -0,0 +1,277 @@
+/*
+ * test_command.c
+ *
+ * Checks that the command builder puts the same bytes on the bus as the
+ * snprintf() formatting it replaced, for numeric arguments at the digit
+ * boundaries, for BSSIDs, and for the commands of a join, which only
+ * targets the cached access point with WIFI_USE_TARGETED_JOIN. Also
+ * checks that a response larger than the receive buffer is cut and drained,
+ * that a join response without address fails the join by its reason, and
+ * that the addresses of a join are read and sent alike in both footprint
+ * profiles.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+
+#include "host_hal.h"
+#include "test.h"
+
+
+/* Variables -----------------------------------------------------------------*/
+static char commands[32][WIFI_CMD_BUFFER_SIZE(WIFI_CMD_STRING_MAX_LENGTH)];
+static uint8_t commandCount = 0;
+static WIFI_JoinEventTypeDef lastEvent;
+
+
+/* Helpers -------------------------------------------------------------------*/
+// Bytes of a command as the old path clocked them out, padded to a 16bit word
+static uint32_t expected_bytes(char* dst, uint32_t size, const char* command){
+
+	uint32_t length = snprintf(dst, size, "%s\r", command);
+
+	if(length % 2) dst[length++] = (char) WIFI_TX_PADDING;
+
+	return length;
+}
+
+static const char* join_responder(const char* command){
+
+	if(commandCount < sizeof(commands) / sizeof(commands[0])){
+		snprintf(commands[commandCount++], sizeof(commands[0]), "%s", command);
+	}
+	if(!strcmp(command, "C0")) return "[JOIN   ] ssid,192.168.1.7,0,0\r\nOK";
+	if(!strcmp(command, WIFI_CMD_NETWORK_SETTINGS)){
+		return "ssid,passphrase,3,1,0,192.168.1.7,255.255.255.0,192.168.1.1,8.8.8.8,0.0.0.0,5,0,0,CN,1\r\nOK";
+	}
+#ifdef WIFI_USE_TARGETED_JOIN
+	if(!strcmp(command, WIFI_CMD_LINK_INFO)) return "AA:BB:CC:DD:EE:01,11\r\nOK";
+#endif
+
+	return "OK";
+}
+
+static const char* long_responder(const char* command){
+
+	(void) command;
+
+	return "0123456789abcdefghij\r\nOK";
+}
+
+static const char* no_address_responder(const char* command){
+
+	if(!strcmp(command, "C0")) return "[JOIN   ] ssid\r\nOK";
+
+	return "OK";
+}
+
+static void join_event(WIFI_HandleTypeDef* hwifi, const WIFI_JoinEventTypeDef* event, void* context){
+
+	(void) hwifi;
+	(void) context;
+
+	lastEvent = *event;
+}
+
+// Sets an address of the handle, a string in FULL and a uint32 in SMALL
+static void set_ip(WIFI_IPAddressTypeDef* ip, const char* address){
+
+#if WIFI_FOOTPRINT == WIFI_FOOTPRINT_SMALL
+	WIFI_StringToIP(address, strlen(address), ip);
+#else
+	snprintf(*ip, sizeof(*ip), "%s", address);
+#endif
+}
+
+static uint8_t ip_equals(const WIFI_IPAddressTypeDef* ip, const char* address){
+
+#if WIFI_FOOTPRINT == WIFI_FOOTPRINT_SMALL
+	uint32_t expected;
+
+	return WIFI_StringToIP(address, strlen(address), &expected) == WIFI_OK && *ip == expected;
+#else
+	return !strcmp(*ip, address);
+#endif
+}
+
+static uint8_t sent(const char* command){
+
+	for(uint8_t i = 0; i < commandCount; i++){
+		if(!strcmp(commands[i], command)) return 1;
+	}
+
+	return 0;
+}
+
+
+/* Tests ---------------------------------------------------------------------*/
+static void test_uint_commands(WIFI_HandleTypeDef* hwifi){
+
+	static const uint32_t values[] = { 0, 1, 9, 10, 99, 100, 999, 1000, 3000, 65535, 65536, 999999999, 1000000000, 4294967295u };
+	static const char* prefixes[] = { "P2=", "R1=", "PK=1,", "C3=" };
+	char command[WIFI_CMD_BUFFER_SIZE(WIFI_CMD_UINT_MAX_LENGTH)];
+	char expected[WIFI_CMD_BUFFER_SIZE(WIFI_CMD_UINT_MAX_LENGTH) + 1];
+	uint32_t length;
+
+	for(uint8_t p = 0; p < sizeof(prefixes) / sizeof(prefixes[0]); p++){
+		for(uint8_t v = 0; v < sizeof(values) / sizeof(values[0]); v++){
+			snprintf(command, sizeof(command), "%s%lu", prefixes[p], (unsigned long) values[v]);
+			length = expected_bytes(expected, sizeof(expected), command);
+
+			host_reset();
+			TEST_CHECK(WIFI_SendCommandUint(hwifi, prefixes[p], values[v]) == WIFI_OK);
+			TEST_CHECK(host_txLength == length && !memcmp(host_tx, expected, length));
+		}
+	}
+
+	// A prefix longer than WIFI_CMD_PREFIX_MAX_LENGTH is refused instead of truncated
+	host_reset();
+	TEST_CHECK(WIFI_SendCommandUint(hwifi, "PM=10,", 1) == WIFI_ERROR);
+	TEST_CHECK(host_txLength == 0);
+}
+
+static void test_bssid(void){
+
+	uint8_t bssid[6];
+	char text[WIFI_BSSID_STRING_SIZE];
+	char expected[WIFI_BSSID_STRING_SIZE];
+	uint8_t parsed[6];
+
+	for(uint32_t i = 0; i < 4096; i++){
+		for(uint8_t j = 0; j < 6; j++) bssid[j] = (i == 0) ? 0x00 : (i == 1) ? 0xFF : (uint8_t)(i * 37 + j * 101);
+		snprintf(expected, sizeof(expected), "%02X:%02X:%02X:%02X:%02X:%02X", bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5]);
+
+		TEST_CHECK(WIFI_BSSIDToString(bssid, text, sizeof(text)) == WIFI_BSSID_STRING_SIZE - 1);
+		TEST_CHECK(!strcmp(text, expected));
+		TEST_CHECK(WIFI_StringToBSSID(text, strlen(text), parsed) == WIFI_OK && !memcmp(parsed, bssid, 6));
+	}
+
+	TEST_CHECK(WIFI_BSSIDToString(bssid, text, WIFI_BSSID_STRING_SIZE - 1) == 0);
+}
+
+static void test_join_commands(WIFI_HandleTypeDef* hwifi){
+
+	char expected[WIFI_CMD_BUFFER_SIZE(WIFI_CMD_STRING_MAX_LENGTH)];
+
+	host_reset();
+	host_responder = join_responder;
+	commandCount = 0;
+
+	// A cached access point makes the targeted join send CB= and CN=
+	host_link = (WIFI_LinkTypeDef){ .bssid = { 0x0A, 0xB0, 0xC3, 0xD4, 0xE5, 0xFF }, .channel = 13 };
+	host_linkValid = 1;
+
+	TEST_CHECK(WIFI_JoinNetworkAsync(hwifi, NULL, NULL) == WIFI_OK);
+	while(WIFI_Process(hwifi) == WIFI_BUSY);
+	TEST_CHECK(hwifi->join.result == WIFI_OK);
+
+	snprintf(expected, sizeof(expected), "C3=%lu", (unsigned long) hwifi->securityType);
+	TEST_CHECK(sent(expected));
+	snprintf(expected, sizeof(expected), "C4=%lu", (unsigned long) hwifi->DHCP);
+	TEST_CHECK(sent(expected));
+#ifdef WIFI_USE_TARGETED_JOIN
+	snprintf(expected, sizeof(expected), WIFI_CMD_JOIN_BSSID "%02X:%02X:%02X:%02X:%02X:%02X", 0x0A, 0xB0, 0xC3, 0xD4, 0xE5, 0xFF);
+	TEST_CHECK(sent(expected));
+	snprintf(expected, sizeof(expected), WIFI_CMD_JOIN_CHANNEL "%lu", 13ul);
+	TEST_CHECK(sent(expected));
+	TEST_CHECK(hwifi->stats.linkHits == 1);
+#else
+	// Only the C commands of the AT reference are sent
+	for(uint8_t i = 0; i < commandCount; i++){
+		TEST_CHECK(strncmp(commands[i], "CB", 2) && strncmp(commands[i], "CN", 2) && strncmp(commands[i], "CW", 2));
+	}
+	TEST_CHECK(sent("C0"));
+	TEST_CHECK(hwifi->stats.linkHits == 0 && hwifi->stats.linkMisses == 0);
+#endif
+}
+
+static void test_join_no_address(WIFI_HandleTypeDef* hwifi){
+
+	host_reset();
+	host_responder = no_address_responder;
+
+	// The failure is reported by the result and the event, not the error handler
+	TEST_CHECK(WIFI_JoinNetwork(hwifi) == WIFI_ERROR);
+	TEST_CHECK(hwifi->join.result == WIFI_ERROR);
+	TEST_CHECK(host_errorHandlerCalls == 0);
+
+	TEST_CHECK(WIFI_JoinNetworkAsync(hwifi, join_event, NULL) == WIFI_OK);
+	while(WIFI_Process(hwifi) == WIFI_BUSY);
+	TEST_CHECK(lastEvent.phase == WIFI_JOIN_FAILED && lastEvent.reason == WIFI_JOIN_REASON_NO_ADDRESS);
+	TEST_CHECK(host_errorHandlerCalls == 0);
+}
+
+static void test_join_addresses(WIFI_HandleTypeDef* hwifi){
+
+	memset(&hwifi->lease, 0, sizeof(hwifi->lease));
+
+	// The address of the join response and the lease of the network settings are read
+	host_reset();
+	host_responder = join_responder;
+	commandCount = 0;
+	TEST_CHECK(WIFI_JoinNetwork(hwifi) == WIFI_OK);
+	TEST_CHECK(ip_equals(&hwifi->ipAddress, "192.168.1.7"));
+	TEST_CHECK(hwifi->lease.valid == SET);
+	TEST_CHECK(ip_equals(&hwifi->lease.networkMask, "255.255.255.0"));
+	TEST_CHECK(ip_equals(&hwifi->lease.defaultGateway, "192.168.1.1"));
+	TEST_CHECK(ip_equals(&hwifi->lease.primaryDNSServer, "8.8.8.8"));
+
+	// The next join configures the lease before C0
+	commandCount = 0;
+	TEST_CHECK(WIFI_JoinNetwork(hwifi) == WIFI_OK);
+	TEST_CHECK(sent("C6=192.168.1.7") && sent("C7=255.255.255.0") && sent("C8=192.168.1.1") && sent("C9=8.8.8.8"));
+
+	// Static addresses are sent as configured, the edges of the octets included
+	memset(&hwifi->lease, 0, sizeof(hwifi->lease));
+	hwifi->DHCP = RESET;
+	set_ip(&hwifi->ipAddress, "10.0.0.255");
+	set_ip(&hwifi->networkMask, "255.255.255.255");
+	set_ip(&hwifi->defaultGateway, "0.0.0.0");
+	set_ip(&hwifi->primaryDNSServer, "1.100.10.1");
+	commandCount = 0;
+	TEST_CHECK(WIFI_JoinNetwork(hwifi) == WIFI_OK);
+	TEST_CHECK(sent("C6=10.0.0.255") && sent("C7=255.255.255.255") && sent("C8=0.0.0.0") && sent("C9=1.100.10.1"));
+	TEST_CHECK(!sent(WIFI_CMD_NETWORK_SETTINGS));
+
+	hwifi->DHCP = SET;
+	memset(&hwifi->lease, 0, sizeof(hwifi->lease));
+}
+
+static void test_receive_overflow(WIFI_HandleTypeDef* hwifi){
+
+	char rx[8];
+	char cmd[] = WIFI_CMD_NETWORK_SETTINGS "\r";
+
+	host_reset();
+	host_responder = long_responder;
+
+	WIFI_SendATCommand(hwifi, cmd, sizeof(cmd), rx, sizeof(rx));
+	TEST_CHECK(!strcmp(rx, "\r\n0123"));
+	TEST_CHECK(hwifi->stats.rxHighWater >= strlen(long_responder(NULL)));
+
+	// The rest of the response was clocked out, so the next command is answered cleanly
+	host_responder = host_respond_ok;
+	TEST_CHECK(WIFI_SendATCommand(hwifi, cmd, sizeof(cmd), wifiRxBuffer, WIFI_RX_BUFFER_SIZE) == WIFI_OK);
+	TEST_CHECK(strstr(wifiRxBuffer, WIFI_MSG_STATUS_OK) != NULL);
+}
+
+
+int main(void){
+
+	static WIFI_HandleTypeDef hwifi;
+
+	hwifi.handle = &hspi3;
+	hwifi.ssid = "ssid";
+	hwifi.passphrase = "passphrase";
+	hwifi.securityType = 3;
+	hwifi.DHCP = SET;
+
+	test_uint_commands(&hwifi);
+	test_bssid();
+	test_join_commands(&hwifi);
+	test_join_no_address(&hwifi);
+	test_join_addresses(&hwifi);
+	test_receive_overflow(&hwifi);
+
+	return TEST_RESULT("test_command");
+}
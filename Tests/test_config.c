@@ -0,0 +1,105 @@
+/*
+ * test_config.c
+ *
+ * Checks the fingerprint of wifi_config.c over the static addresses of the
+ * handle, which are strings in the FULL and uint32 in the SMALL footprint
+ * profile. The flash log is not touched, its HAL calls are only stubbed for
+ * the link.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+
+#include "host_hal.h"
+#include "test.h"
+
+
+/* Helpers -------------------------------------------------------------------*/
+HAL_StatusTypeDef HAL_FLASH_Unlock(void){ return HAL_ERROR; }
+HAL_StatusTypeDef HAL_FLASH_Lock(void){ return HAL_ERROR; }
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uint32_t address, uint64_t data){ (void) type; (void) address; (void) data; return HAL_ERROR; }
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* erase, uint32_t* pageError){ (void) erase; (void) pageError; return HAL_ERROR; }
+
+// Sets an address of the handle, a string in FULL and a uint32 in SMALL
+static void set_ip(WIFI_IPAddressTypeDef* ip, const char* address){
+
+#if WIFI_FOOTPRINT == WIFI_FOOTPRINT_SMALL
+	WIFI_StringToIP(address, strlen(address), ip);
+#else
+	snprintf(*ip, sizeof(*ip), "%s", address);
+#endif
+}
+
+static void set_addresses(WIFI_HandleTypeDef* hwifi, const char* ip, const char* mask, const char* gateway, const char* dns){
+
+	set_ip(&hwifi->ipAddress, ip);
+	set_ip(&hwifi->networkMask, mask);
+	set_ip(&hwifi->defaultGateway, gateway);
+	set_ip(&hwifi->primaryDNSServer, dns);
+}
+
+
+/* Tests ---------------------------------------------------------------------*/
+static void test_static_addresses(WIFI_HandleTypeDef* hwifi){
+
+	uint32_t fingerprint;
+
+	hwifi->DHCP = RESET;
+	set_addresses(hwifi, "192.168.1.50", "255.255.255.0", "192.168.1.1", "8.8.8.8");
+	fingerprint = WIFI_ConfigFingerprint(hwifi);
+	TEST_CHECK(WIFI_ConfigFingerprint(hwifi) == fingerprint);
+
+	// Each address counts, down to its last octet
+	set_addresses(hwifi, "192.168.1.51", "255.255.255.0", "192.168.1.1", "8.8.8.8");
+	TEST_CHECK(WIFI_ConfigFingerprint(hwifi) != fingerprint);
+	set_addresses(hwifi, "192.168.1.50", "255.255.0.0", "192.168.1.1", "8.8.8.8");
+	TEST_CHECK(WIFI_ConfigFingerprint(hwifi) != fingerprint);
+	set_addresses(hwifi, "192.168.1.50", "255.255.255.0", "192.168.1.254", "8.8.8.8");
+	TEST_CHECK(WIFI_ConfigFingerprint(hwifi) != fingerprint);
+	set_addresses(hwifi, "192.168.1.50", "255.255.255.0", "192.168.1.1", "8.8.4.4");
+	TEST_CHECK(WIFI_ConfigFingerprint(hwifi) != fingerprint);
+
+	// Swapped addresses are another configuration
+	set_addresses(hwifi, "192.168.1.1", "255.255.255.0", "192.168.1.50", "8.8.8.8");
+	TEST_CHECK(WIFI_ConfigFingerprint(hwifi) != fingerprint);
+
+	set_addresses(hwifi, "192.168.1.50", "255.255.255.0", "192.168.1.1", "8.8.8.8");
+	TEST_CHECK(WIFI_ConfigFingerprint(hwifi) == fingerprint);
+
+#if WIFI_FOOTPRINT != WIFI_FOOTPRINT_SMALL
+	// Bytes after the terminator are not part of the address
+	hwifi->primaryDNSServer[sizeof(hwifi->primaryDNSServer) - 1] = 'x';
+	TEST_CHECK(WIFI_ConfigFingerprint(hwifi) == fingerprint);
+#endif
+}
+
+static void test_dhcp(WIFI_HandleTypeDef* hwifi){
+
+	uint32_t fingerprint;
+
+	// With DHCP the static addresses are not sent, so they do not count
+	hwifi->DHCP = SET;
+	set_addresses(hwifi, "192.168.1.50", "255.255.255.0", "192.168.1.1", "8.8.8.8");
+	fingerprint = WIFI_ConfigFingerprint(hwifi);
+	set_addresses(hwifi, "10.0.0.2", "255.0.0.0", "10.0.0.1", "1.1.1.1");
+	TEST_CHECK(WIFI_ConfigFingerprint(hwifi) == fingerprint);
+
+	hwifi->DHCP = RESET;
+	TEST_CHECK(WIFI_ConfigFingerprint(hwifi) != fingerprint);
+}
+
+
+int main(void){
+
+	static WIFI_HandleTypeDef hwifi;
+
+	hwifi.handle = &hspi3;
+	hwifi.ssid = "ssid";
+	hwifi.passphrase = "passphrase";
+	hwifi.securityType = 3;
+
+	test_static_addresses(&hwifi);
+	test_dhcp(&hwifi);
+
+	return TEST_RESULT("test_config");
+}
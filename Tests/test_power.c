@@ -0,0 +1,112 @@
+/*
+ * test_power.c
+ *
+ * Checks that the power state and the doze and wake counters of the power
+ * policy only change once the module acknowledged the power save command.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+
+#include "host_hal.h"
+#include "test.h"
+
+
+/* Variables -----------------------------------------------------------------*/
+static uint8_t refuse = 0;
+
+
+/* Helpers -------------------------------------------------------------------*/
+// Answers the power save command with ERROR while refuse is set
+static const char* power_responder(const char* command){
+
+	if(refuse && !strncmp(command, WIFI_CMD_POWER_SAVE, sizeof(WIFI_CMD_POWER_SAVE) - 1)) return WIFI_MSG_STATUS_ERROR;
+
+	return WIFI_MSG_STATUS_OK;
+}
+
+static void setup(WIFI_HandleTypeDef* hwifi){
+
+	host_reset();
+	host_responder = power_responder;
+	refuse = 0;
+	memset(&hwifi->power, 0, sizeof(hwifi->power));
+	WIFI_PowerPolicyConfig(hwifi, WIFI_POWERSAVE_ON, 100, 10);
+}
+
+
+/* Tests ---------------------------------------------------------------------*/
+static void test_doze(WIFI_HandleTypeDef* hwifi){
+
+	setup(hwifi);
+	HAL_Delay(200);
+
+	// A refused doze leaves the module awake and is not counted
+	refuse = 1;
+	TEST_CHECK(WIFI_PowerProcess(hwifi) == WIFI_ERROR);
+	TEST_CHECK(hwifi->power.state == WIFI_POWER_AWAKE);
+	TEST_CHECK(hwifi->power.stats.dozes == 0);
+
+	// The refused command restarted the idle time
+	refuse = 0;
+	HAL_Delay(200);
+	TEST_CHECK(WIFI_PowerProcess(hwifi) == WIFI_OK);
+	TEST_CHECK(hwifi->power.state == WIFI_POWER_DOZING);
+	TEST_CHECK(hwifi->power.stats.dozes == 1);
+}
+
+static void test_demand_wake(WIFI_HandleTypeDef* hwifi){
+
+	char cmd[] = WIFI_CMD_NETWORK_SETTINGS "\r";
+
+	setup(hwifi);
+	TEST_CHECK(WIFI_SetPowerSave(hwifi, WIFI_POWERSAVE_ON) == WIFI_OK);
+
+	// The command is not sent to a module that did not confirm the wake-up
+	refuse = 1;
+	TEST_CHECK(WIFI_SendATCommand(hwifi, cmd, sizeof(cmd), wifiRxBuffer, WIFI_RX_BUFFER_SIZE) == WIFI_ERROR);
+	TEST_CHECK(hwifi->power.state == WIFI_POWER_DOZING);
+	TEST_CHECK(hwifi->power.stats.demandWakes == 0);
+	TEST_CHECK(hwifi->power.wakePending == RESET);
+	TEST_CHECK(strcmp(host_last_command(), WIFI_CMD_NETWORK_SETTINGS));
+
+	refuse = 0;
+	TEST_CHECK(WIFI_SendATCommand(hwifi, cmd, sizeof(cmd), wifiRxBuffer, WIFI_RX_BUFFER_SIZE) == WIFI_OK);
+	TEST_CHECK(hwifi->power.state == WIFI_POWER_AWAKE);
+	TEST_CHECK(hwifi->power.stats.demandWakes == 1);
+	TEST_CHECK(!strcmp(host_last_command(), WIFI_CMD_NETWORK_SETTINGS));
+}
+
+static void test_scheduled_wake(WIFI_HandleTypeDef* hwifi){
+
+	setup(hwifi);
+	TEST_CHECK(WIFI_SetPowerSave(hwifi, WIFI_POWERSAVE_ON) == WIFI_OK);
+	WIFI_PowerSchedule(hwifi, HAL_GetTick());
+
+	// A failed scheduled wake is retried on the next call
+	refuse = 1;
+	TEST_CHECK(WIFI_PowerProcess(hwifi) == WIFI_ERROR);
+	TEST_CHECK(hwifi->power.state == WIFI_POWER_DOZING);
+	TEST_CHECK(hwifi->power.wakeScheduled == SET);
+	TEST_CHECK(hwifi->power.stats.scheduledWakes == 0);
+
+	refuse = 0;
+	TEST_CHECK(WIFI_PowerProcess(hwifi) == WIFI_OK);
+	TEST_CHECK(hwifi->power.state == WIFI_POWER_AWAKE);
+	TEST_CHECK(hwifi->power.wakeScheduled == RESET);
+	TEST_CHECK(hwifi->power.stats.scheduledWakes == 1);
+}
+
+
+int main(void){
+
+	static WIFI_HandleTypeDef hwifi;
+
+	hwifi.handle = &hspi3;
+
+	test_doze(&hwifi);
+	test_demand_wake(&hwifi);
+	test_scheduled_wake(&hwifi);
+
+	return TEST_RESULT("test_power");
+}
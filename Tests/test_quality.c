@@ -0,0 +1,91 @@
+/*
+ * test_quality.c
+ *
+ * Checks that the link quality sampler keeps sampling while the power
+ * policy lets the module doze between samples, with the default idle
+ * timeout shorter than the sample interval.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+
+#include "host_hal.h"
+#include "test.h"
+
+
+/* Variables -----------------------------------------------------------------*/
+static uint32_t statusSamples = 0;
+static uint8_t dozingSamples = 0;
+static WIFI_HandleTypeDef hwifi;
+
+
+/* Helpers -------------------------------------------------------------------*/
+static const char* quality_responder(const char* command){
+
+	if(!strcmp(command, WIFI_CMD_CONNECTION_STATUS)){
+		statusSamples++;
+		if(hwifi.power.state != WIFI_POWER_AWAKE) dozingSamples++;
+		return "1\r\nOK";
+	}
+	if(!strcmp(command, WIFI_CMD_RSSI)) return "-55\r\nOK";
+
+	return "OK";
+}
+
+// Runs the main loop for ms, one iteration per ms
+static void run(uint32_t ms){
+
+	uint32_t start = HAL_GetTick();
+
+	while(HAL_GetTick() - start < ms){
+		WIFI_Process(&hwifi);
+		WIFI_QualityProcess(&hwifi);
+		WIFI_PowerProcess(&hwifi);
+		HAL_Delay(1);
+	}
+}
+
+
+/* Tests ---------------------------------------------------------------------*/
+static void test_sampling_with_power_save(void){
+
+	host_reset();
+	host_responder = quality_responder;
+	WIFI_PowerPolicyConfig(&hwifi, WIFI_POWERSAVE_ON, WIFI_POWER_IDLE_TIMEOUT, WIFI_POWER_WAKE_LEAD);
+	WIFI_QualityConfig(&hwifi, WIFI_QUALITY_SAMPLE_INTERVAL);
+
+	run(10 * WIFI_QUALITY_SAMPLE_INTERVAL);
+
+	// The module dozes between the samples and is woken ahead of each of them
+	TEST_CHECK(statusSamples >= 9);
+	TEST_CHECK(hwifi.quality.rssiSamples >= 9);
+	TEST_CHECK(dozingSamples == 0);
+	TEST_CHECK(hwifi.power.stats.dozes >= 8);
+	TEST_CHECK(hwifi.power.stats.scheduledWakes >= 8);
+}
+
+static void test_taken_schedule(void){
+
+	uint32_t samples = statusSamples;
+
+	// The application holds the schedule far beyond the next sample, which is then woken on demand
+	WIFI_PowerSchedule(&hwifi, HAL_GetTick() + 100 * WIFI_QUALITY_SAMPLE_INTERVAL);
+	hwifi.power.stats.demandWakes = 0;
+
+	run(3 * WIFI_QUALITY_SAMPLE_INTERVAL);
+
+	TEST_CHECK(statusSamples - samples >= 2);
+	TEST_CHECK(hwifi.power.stats.demandWakes >= 1);
+	TEST_CHECK(hwifi.power.wakeScheduled == SET);
+}
+
+
+int main(void){
+
+	hwifi.handle = &hspi3;
+
+	test_sampling_with_power_save();
+	test_taken_schedule();
+
+	return TEST_RESULT("test_quality");
+}
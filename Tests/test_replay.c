@@ -0,0 +1,119 @@
+/*
+ * test_replay.c
+ *
+ * Round trip of a captured session. "capture <trace>" runs the session
+ * against a scripted module with the SPI trace enabled and dumps the trace,
+ * which Tools/spi_trace.py turns into a script. "replay <script>" runs the
+ * same session against the replay of that script and checks that the driver
+ * sees the same responses, except for the exchange the recorder truncated.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+
+#include "host_hal.h"
+#include "host_replay.h"
+#include "spi_trace.h"
+#include "test.h"
+
+
+/* Variables -----------------------------------------------------------------*/
+static const char version[] = "ISM43362-M3G-L44-SPI,C3.5.2.5.STM";
+static const char data[] = "\0\x15" "ab\r\nOK\r\n" "\x15";
+static char longLine[SPI_TRACE_MAX_PAYLOAD + 64];
+
+
+/* Helpers -------------------------------------------------------------------*/
+static const char* capture_responder(const char* command){
+
+	static char answer[sizeof(longLine) + 8];
+
+	if(!strcmp(command, "I?")){
+		snprintf(answer, sizeof(answer), "%s\r\nOK", version);
+		return answer;
+	}
+	if(!strcmp(command, "C?")){
+		snprintf(answer, sizeof(answer), "%s\r\nOK", longLine);
+		return answer;
+	}
+
+	return "OK";
+}
+
+// Runs the session, the long response of C? cannot be replayed
+static void session(WIFI_HandleTypeDef* hwifi, uint8_t replay){
+
+	char buffer[sizeof(longLine) + 32];
+	char versionCommand[] = "I?\r";
+	char settingsCommand[] = "C?\r";
+	uint16_t received = 0;
+
+	TEST_CHECK(WIFI_SendATCommand(hwifi, versionCommand, sizeof(versionCommand), buffer, sizeof(buffer)) == WIFI_OK);
+	TEST_CHECK(strstr(buffer, version) != NULL);
+
+	TEST_CHECK(WIFI_SocketOpen(hwifi, 1, WIFI_SOCKET_CLIENT) == WIFI_OK);
+
+	host_data = data;
+	host_dataLength = sizeof(data) - 1;
+	TEST_CHECK(WIFI_SocketReceive(hwifi, 1, buffer, sizeof(buffer), &received) == WIFI_OK);
+	TEST_CHECK(received == sizeof(data) - 1 && !memcmp(buffer, data, sizeof(data) - 1));
+
+	TEST_CHECK(WIFI_SocketSend(hwifi, 1, "hello", 5) == WIFI_OK);
+
+	TEST_CHECK(WIFI_SendATCommand(hwifi, settingsCommand, sizeof(settingsCommand), buffer, sizeof(buffer)) == WIFI_OK);
+	TEST_CHECK(strstr(buffer, replay ? "ERROR" : longLine) != NULL);
+
+	TEST_CHECK(WIFI_SocketClose(hwifi, 1) == WIFI_OK);
+}
+
+
+/* Tests ---------------------------------------------------------------------*/
+static int capture(WIFI_HandleTypeDef* hwifi, const char* path){
+
+	int result;
+
+	host_reset();
+	host_responder = capture_responder;
+	spi_trace_clear();
+
+	session(hwifi, 0);
+	TEST_CHECK(spi_trace_overwritten() == 0);
+	result = TEST_RESULT("test_replay capture");
+
+	fflush(stdout);
+	if(freopen(path, "w", stdout) == NULL) return 1;
+	spi_trace_dump();
+
+	return result;
+}
+
+static int replay(WIFI_HandleTypeDef* hwifi, const char* path){
+
+	host_reset();
+	host_raw_responder = host_replay_respond;
+	TEST_CHECK(host_replay_load(path) > 0);
+
+	session(hwifi, 1);
+	TEST_CHECK(host_replayMismatches == 0);
+	TEST_CHECK(host_replayRefused == 1);
+	TEST_CHECK(host_replay_remaining() == 0);
+
+	return TEST_RESULT("test_replay");
+}
+
+
+int main(int argc, char** argv){
+
+	static WIFI_HandleTypeDef hwifi;
+
+	hwifi.handle = &hspi3;
+	memset(longLine, 'x', sizeof(longLine) - 1);
+
+	if(argc == 3 && !strcmp(argv[1], "capture")) return capture(&hwifi, argv[2]);
+	if(argc == 3 && !strcmp(argv[1], "replay")) return replay(&hwifi, argv[2]);
+
+	printf("usage: test_replay capture <trace> | replay <script>\n");
+
+	return 1;
+}
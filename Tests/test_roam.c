@@ -0,0 +1,156 @@
+/*
+ * test_roam.c
+ *
+ * Checks a roam to a stronger access point, and that a candidate which
+ * fails to join leaves the cached access point alone, is followed by a
+ * rejoin of the previous one and gets the sockets back. A join that lands
+ * on another access point is not counted as a roam. Without
+ * WIFI_USE_TARGETED_JOIN, roaming cannot be enabled.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+
+#include "host_hal.h"
+#include "test.h"
+
+
+/* Variables -----------------------------------------------------------------*/
+#ifdef WIFI_USE_TARGETED_JOIN
+static const WIFI_LinkTypeDef previous = { .bssid = { 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0x01 }, .channel = 1 };
+static uint8_t candidateFails = 0;
+static uint8_t bssidIgnored = 0;		// The module joins by SSID and lands on the previous access point
+static char joinedBssid[WIFI_BSSID_STRING_SIZE];
+static char linkInfo[32];
+
+
+/* Helpers -------------------------------------------------------------------*/
+static const char* roam_responder(const char* command){
+
+	if(!strncmp(command, WIFI_CMD_JOIN_BSSID, sizeof(WIFI_CMD_JOIN_BSSID) - 1)){
+		snprintf(joinedBssid, sizeof(joinedBssid), "%s", command + sizeof(WIFI_CMD_JOIN_BSSID) - 1);
+	}
+	if(!strcmp(command, WIFI_CMD_SCAN)){
+		return "#001,\"ssid\",AA:BB:CC:DD:EE:02,-50,54.0,Infrastructure,WPA2 AES,2.4GHz,6\r\n"
+				"#002,\"ssid\",AA:BB:CC:DD:EE:01,-75,54.0,Infrastructure,WPA2 AES,2.4GHz,1\r\n"
+				"OK";
+	}
+	if(!strcmp(command, "C0")){
+		if(candidateFails && !strcmp(joinedBssid, "AA:BB:CC:DD:EE:02")) return "ERROR";
+		return "[JOIN   ] ssid,192.168.1.7,0,0\r\nOK";
+	}
+	if(!strcmp(command, WIFI_CMD_LINK_INFO)){
+		if(bssidIgnored || !strcmp(joinedBssid, "AA:BB:CC:DD:EE:01")) return "AA:BB:CC:DD:EE:01,1\r\nOK";
+		snprintf(linkInfo, sizeof(linkInfo), "%s,6\r\nOK", joinedBssid);
+		return linkInfo;
+	}
+
+	return "OK";
+}
+
+// Joins the previous access point with a client socket open and lets the signal fade
+static void setup(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_SocketCloseAll(hwifi);
+	host_reset();
+	host_responder = roam_responder;
+	host_link = previous;
+	host_linkValid = 1;
+	memset(&hwifi->roam, 0, sizeof(hwifi->roam));
+
+	TEST_CHECK(WIFI_JoinNetwork(hwifi) == WIFI_OK);
+	TEST_CHECK(WIFI_SocketOpen(hwifi, 0, WIFI_SOCKET_CLIENT) == WIFI_OK);
+
+	TEST_CHECK(WIFI_RoamConfig(hwifi, -60, 5, 10) == WIFI_OK);
+	for(uint8_t i = 0; i < WIFI_ROAM_WEAK_SAMPLES; i++) WIFI_RoamSample(hwifi, -75);
+	TEST_CHECK(hwifi->roam.state == WIFI_ROAM_SCAN);
+}
+
+static void run(WIFI_HandleTypeDef* hwifi){
+
+	for(uint32_t i = 0; i < 100000; i++){
+		WIFI_RoamProcess(hwifi);
+		if(WIFI_Process(hwifi) != WIFI_BUSY && hwifi->roam.state == WIFI_ROAM_IDLE) break;
+	}
+}
+
+
+/* Tests ---------------------------------------------------------------------*/
+static void test_roam(WIFI_HandleTypeDef* hwifi){
+
+	setup(hwifi);
+	candidateFails = 0;
+	bssidIgnored = 0;
+	run(hwifi);
+
+	TEST_CHECK(hwifi->roam.stats.roams == 1 && hwifi->roam.stats.failures == 0);
+	TEST_CHECK(hwifi->roam.stats.mismatches == 0);
+	TEST_CHECK(!strcmp(joinedBssid, "AA:BB:CC:DD:EE:02"));
+	TEST_CHECK(host_linkValid && host_link.bssid[5] == 0x02 && host_link.channel == 6);
+	TEST_CHECK(WIFI_IS_SOCKET_OPEN(hwifi, 0));
+}
+
+static void test_roam_failure(WIFI_HandleTypeDef* hwifi){
+
+	setup(hwifi);
+	candidateFails = 1;
+	bssidIgnored = 0;
+	run(hwifi);
+
+	TEST_CHECK(hwifi->roam.stats.roams == 0 && hwifi->roam.stats.failures == 1);
+	TEST_CHECK(hwifi->roam.stats.rejoinFailures == 0);
+
+	// The previous access point stays cached and is joined again
+	TEST_CHECK(host_linkValid && !memcmp(&host_link, &previous, sizeof(previous)));
+	TEST_CHECK(!strcmp(joinedBssid, "AA:BB:CC:DD:EE:01"));
+	TEST_CHECK(hwifi->join.result == WIFI_OK);
+	TEST_CHECK(WIFI_IS_SOCKET_OPEN(hwifi, 0));
+}
+
+static void test_roam_mismatch(WIFI_HandleTypeDef* hwifi){
+
+	setup(hwifi);
+	candidateFails = 0;
+	bssidIgnored = 1;
+	run(hwifi);
+
+	// The module is back on the weak access point, which is what CW reports
+	TEST_CHECK(hwifi->roam.stats.roams == 0 && hwifi->roam.stats.mismatches == 1);
+	TEST_CHECK(hwifi->join.result == WIFI_OK && hwifi->join.confirmed == RESET);
+	TEST_CHECK(host_linkValid && !memcmp(&host_link, &previous, sizeof(previous)));
+	TEST_CHECK(WIFI_IS_SOCKET_OPEN(hwifi, 0));
+}
+#else
+static void test_roam_unavailable(WIFI_HandleTypeDef* hwifi){
+
+	TEST_CHECK(WIFI_RoamConfig(hwifi, -60, 5, 10) == WIFI_ERROR);
+	TEST_CHECK(hwifi->roam.enabled == RESET);
+
+	for(uint8_t i = 0; i < WIFI_ROAM_WEAK_SAMPLES; i++) WIFI_RoamSample(hwifi, -75);
+	TEST_CHECK(hwifi->roam.state == WIFI_ROAM_IDLE);
+
+	TEST_CHECK(WIFI_RoamConfig(hwifi, 0, 5, 10) == WIFI_OK);
+}
+#endif
+
+
+int main(void){
+
+	static WIFI_HandleTypeDef hwifi;
+
+	hwifi.handle = &hspi3;
+	hwifi.ssid = "ssid";
+	hwifi.passphrase = "passphrase";
+	hwifi.securityType = 3;
+	hwifi.DHCP = SET;
+
+#ifdef WIFI_USE_TARGETED_JOIN
+	test_roam(&hwifi);
+	test_roam_failure(&hwifi);
+	test_roam_mismatch(&hwifi);
+#else
+	test_roam_unavailable(&hwifi);
+#endif
+
+	return TEST_RESULT("test_roam");
+}
@@ -0,0 +1,81 @@
+/*
+ * test_scan.c
+ *
+ * Checks that WIFI_Scan() runs as a regular transaction, i.e. with the
+ * statistics of its command class, and that the response, which is larger
+ * than a receive block, is parsed while it streams in.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+
+#include "host_hal.h"
+#include "test.h"
+
+
+/* Helpers -------------------------------------------------------------------*/
+static const char* scan_responder(const char* command){
+
+	if(strcmp(command, WIFI_CMD_SCAN)) return "OK";
+
+	return "#001,\"weak\",AA:BB:CC:DD:EE:01,-80,54.0,Infrastructure,WPA2 AES,2.4GHz,1\r\n"
+			"#002,\"home\",AA:BB:CC:DD:EE:02,-45,54.0,Infrastructure,WPA2 AES,2.4GHz,6\r\n"
+			"#003,\"cafe, upstairs\",AA:BB:CC:DD:EE:03,-60,54.0,Infrastructure,Open,2.4GHz,11\r\n"
+			"#004,\"home\",AA:BB:CC:DD:EE:04,-70,54.0,Infrastructure,WPA2 AES,5GHz,36\r\n"
+			"OK";
+}
+
+
+/* Tests ---------------------------------------------------------------------*/
+static void test_scan(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_ScanResultTypeDef results[2];
+	WIFI_CmdStatsTypeDef* stats = &hwifi->stats.cmd[WIFI_CMD_CLASS_OTHER];
+	uint8_t count = 0;
+
+	host_reset();
+	host_responder = scan_responder;
+	memset(&hwifi->stats, 0, sizeof(hwifi->stats));
+
+	// The two strongest access points are kept, sorted by RSSI
+	TEST_CHECK(WIFI_Scan(hwifi, NULL, results, 2, &count) == WIFI_OK);
+	TEST_CHECK(count == 2);
+	TEST_CHECK(!strcmp(results[0].ssid, "home") && results[0].rssi == -45 && results[0].channel == 6);
+	TEST_CHECK(!strcmp(results[1].ssid, "cafe, upstairs") && results[1].security == OPEN);
+
+	TEST_CHECK(stats->count == 1 && stats->errors == 0);
+	TEST_CHECK(stats->bytesTx == sizeof(WIFI_CMD_SCAN "\r") - 1);
+	TEST_CHECK(stats->bytesRx > WIFI_SCAN_BLOCK_SIZE);
+
+	// A filtered scan
+	TEST_CHECK(WIFI_Scan(hwifi, &(WIFI_ScanFilterTypeDef){ .ssid = "home", .minRssi = -75 }, results, 2, &count) == WIFI_OK);
+	TEST_CHECK(count == 2 && results[0].bssid[5] == 0x02 && results[1].bssid[5] == 0x04);
+	TEST_CHECK(stats->count == 2);
+}
+
+static void test_scan_timeout(WIFI_HandleTypeDef* hwifi){
+
+	WIFI_ScanResultTypeDef results[2];
+	uint8_t count = 1;
+
+	host_reset();
+	memset(&hwifi->stats, 0, sizeof(hwifi->stats));
+
+	host_busy = 1;
+	TEST_CHECK(WIFI_Scan(hwifi, NULL, results, 2, &count) == WIFI_TIMEOUT);
+	TEST_CHECK(count == 0);
+	TEST_CHECK(hwifi->stats.cmd[WIFI_CMD_CLASS_OTHER].errors == 1);
+}
+
+
+int main(void){
+
+	static WIFI_HandleTypeDef hwifi;
+
+	hwifi.handle = &hspi3;
+
+	test_scan(&hwifi);
+	test_scan_timeout(&hwifi);
+
+	return TEST_RESULT("test_scan");
+}
@@ -0,0 +1,291 @@
+/*
+ * test_socket.c
+ *
+ * Checks the socket ownership kept in the client and server bitmasks of the
+ * handle: double close, use after close, and close all followed by reopening.
+ * Also checks the read packet size, the payload framing of R0 with binary
+ * data, the read timeout of WIFI_Recv() and the host check of
+ * WIFI_TCPConnect().
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_hal.h"
+#include "test.h"
+
+
+/* Variables -----------------------------------------------------------------*/
+static char commands[32][WIFI_CMD_BUFFER_SIZE(WIFI_CMD_STRING_MAX_LENGTH)];
+static uint8_t commandCount = 0;
+static uint8_t failClose = 0;
+static uint8_t slowReads = 0;		// R0 waits for the read timeout without data
+static uint32_t readTimeout = 0;
+static uint32_t maxReadTimeout = 0;
+
+
+/* Helpers -------------------------------------------------------------------*/
+static const char* socket_responder(const char* command){
+
+	if(commandCount < sizeof(commands) / sizeof(commands[0])){
+		snprintf(commands[commandCount++], sizeof(commands[0]), "%s", command);
+	}
+	if(failClose && (!strcmp(command, "P5=0") || !strcmp(command, "P6=0"))) return "ERROR";
+	if(!strncmp(command, "R2=", 3)){
+		readTimeout = strtoul(command + 3, NULL, 10);
+		if(readTimeout > maxReadTimeout) maxReadTimeout = readTimeout;
+	}
+	if(!strcmp(command, "R0") && slowReads){
+		HAL_Delay(readTimeout);
+		return "\r\nOK";
+	}
+	if(!strcmp(command, "R0")) return "hello\r\nOK";
+	if(!strcmp(command, "D0=collector.local")) return "192.168.1.20\r\nOK";
+
+	return "OK";
+}
+
+static void start(void){
+
+	host_reset();
+	host_responder = socket_responder;
+	commandCount = 0;
+	failClose = 0;
+	slowReads = 0;
+}
+
+static uint8_t sent(const char* command){
+
+	for(uint8_t i = 0; i < commandCount; i++){
+		if(!strcmp(commands[i], command)) return 1;
+	}
+
+	return 0;
+}
+
+
+/* Tests ---------------------------------------------------------------------*/
+static void test_open(WIFI_HandleTypeDef* hwifi){
+
+	start();
+	TEST_CHECK(WIFI_SocketOpen(hwifi, 1, WIFI_SOCKET_CLIENT) == WIFI_OK);
+	TEST_CHECK(sent("P0=1") && sent("P6=1"));
+	TEST_CHECK(hwifi->clientSockets == (1 << 1) && hwifi->serverSockets == 0);
+
+	// An owned socket cannot be opened a second time, in either role
+	start();
+	TEST_CHECK(WIFI_SocketOpen(hwifi, 1, WIFI_SOCKET_CLIENT) == WIFI_ERROR);
+	TEST_CHECK(WIFI_SocketOpen(hwifi, 1, WIFI_SOCKET_SERVER) == WIFI_ERROR);
+	TEST_CHECK(commandCount == 0);
+	TEST_CHECK(hwifi->clientSockets == (1 << 1) && hwifi->serverSockets == 0);
+
+	start();
+	TEST_CHECK(WIFI_SocketOpen(hwifi, WIFI_MAX_SOCKETS, WIFI_SOCKET_CLIENT) == WIFI_ERROR);
+	TEST_CHECK(commandCount == 0);
+}
+
+static void test_double_close(WIFI_HandleTypeDef* hwifi){
+
+	start();
+	TEST_CHECK(WIFI_SocketClose(hwifi, 1) == WIFI_OK);
+	TEST_CHECK(sent("P6=0"));
+	TEST_CHECK(hwifi->clientSockets == 0);
+
+	// The second close is a no-op and does not talk to the module
+	start();
+	TEST_CHECK(WIFI_SocketClose(hwifi, 1) == WIFI_OK);
+	TEST_CHECK(WIFI_SocketClose(hwifi, WIFI_MAX_SOCKETS) == WIFI_OK);
+	TEST_CHECK(commandCount == 0 && host_txLength == 0);
+}
+
+static void test_use_after_close(WIFI_HandleTypeDef* hwifi){
+
+	char buffer[16];
+	uint16_t received = 0xFFFF;
+
+	start();
+	TEST_CHECK(WIFI_SocketSend(hwifi, 1, "data", 4) == WIFI_ERROR);
+	TEST_CHECK(WIFI_SocketReceive(hwifi, 1, buffer, sizeof(buffer), &received) == WIFI_ERROR);
+	TEST_CHECK(commandCount == 0 && host_txLength == 0);
+}
+
+static void test_close_all_reopen(WIFI_HandleTypeDef* hwifi){
+
+	start();
+	TEST_CHECK(WIFI_SocketOpen(hwifi, 0, WIFI_SOCKET_SERVER) == WIFI_OK);
+	TEST_CHECK(WIFI_SocketOpen(hwifi, 1, WIFI_SOCKET_CLIENT) == WIFI_OK);
+	TEST_CHECK(WIFI_SocketOpen(hwifi, 3, WIFI_SOCKET_CLIENT) == WIFI_OK);
+	TEST_CHECK(hwifi->serverSockets == 0x1 && hwifi->clientSockets == 0xA);
+
+	// Each socket is closed with the command of its role
+	start();
+	TEST_CHECK(WIFI_SocketCloseAll(hwifi) == WIFI_OK);
+	TEST_CHECK(sent("P0=0") && sent("P5=0"));
+	TEST_CHECK(sent("P0=1") && sent("P0=3") && sent("P6=0"));
+	TEST_CHECK(!sent("P0=2"));
+	TEST_CHECK(hwifi->serverSockets == 0 && hwifi->clientSockets == 0);
+
+	start();
+	TEST_CHECK(WIFI_SocketCloseAll(hwifi) == WIFI_OK);
+	TEST_CHECK(commandCount == 0);
+
+	// A socket number is free again after closing, also in the other role
+	start();
+	TEST_CHECK(WIFI_SocketOpen(hwifi, 1, WIFI_SOCKET_SERVER) == WIFI_OK);
+	TEST_CHECK(sent("P5=1"));
+	TEST_CHECK(hwifi->serverSockets == (1 << 1) && hwifi->clientSockets == 0);
+	TEST_CHECK(WIFI_SocketSend(hwifi, 1, "data", 4) == WIFI_OK);
+}
+
+static void test_close_error(WIFI_HandleTypeDef* hwifi){
+
+	// A failed close still releases the socket, so it can be opened again
+	start();
+	failClose = 1;
+	WIFI_SocketClose(hwifi, 1);
+	TEST_CHECK(sent("P5=0"));
+	TEST_CHECK(hwifi->serverSockets == 0 && hwifi->clientSockets == 0);
+
+	start();
+	TEST_CHECK(WIFI_SocketOpen(hwifi, 1, WIFI_SOCKET_CLIENT) == WIFI_OK);
+	TEST_CHECK(WIFI_SocketClose(hwifi, 1) == WIFI_OK);
+}
+
+static void test_receive_packet_size(WIFI_HandleTypeDef* hwifi){
+
+	static char buffer[WIFI_MAX_READ_PACKET_SIZE + 16];
+	uint16_t received = 0;
+
+	start();
+	TEST_CHECK(WIFI_SocketOpen(hwifi, 1, WIFI_SOCKET_CLIENT) == WIFI_OK);
+
+	// A large buffer does not raise the read packet size beyond what the module accepts
+	start();
+	TEST_CHECK(WIFI_SocketReceive(hwifi, 1, buffer, sizeof(buffer), &received) == WIFI_OK);
+	TEST_CHECK(sent("R1=1200"));
+	TEST_CHECK(received == 5 && !strcmp(buffer, "hello"));
+
+	TEST_CHECK(WIFI_SocketClose(hwifi, 1) == WIFI_OK);
+}
+
+static void test_receive_binary(WIFI_HandleTypeDef* hwifi){
+
+	static const char data[] = "\0\x15" "ab\r\nOK\r\n" "\x15";
+	char buffer[32];
+	uint16_t received = 0;
+
+	start();
+	TEST_CHECK(WIFI_SocketOpen(hwifi, 1, WIFI_SOCKET_CLIENT) == WIFI_OK);
+
+	// NUL, padding bytes and status lines inside the payload are data
+	start();
+	host_data = data;
+	host_dataLength = sizeof(data) - 1;
+	memset(buffer, 0x55, sizeof(buffer));
+	TEST_CHECK(WIFI_SocketReceive(hwifi, 1, buffer, sizeof(buffer), &received) == WIFI_OK);
+	TEST_CHECK(received == sizeof(data) - 1 && !memcmp(buffer, data, sizeof(data) - 1));
+	TEST_CHECK(buffer[received] == '\0');
+
+	// A buffer that only holds the payload and its terminator is enough
+	start();
+	host_data = data;
+	host_dataLength = sizeof(data) - 1;
+	TEST_CHECK(WIFI_SocketReceive(hwifi, 1, buffer, sizeof(data), &received) == WIFI_OK);
+	TEST_CHECK(received == sizeof(data) - 1 && !memcmp(buffer, data, sizeof(data) - 1));
+
+	TEST_CHECK(WIFI_SocketClose(hwifi, 1) == WIFI_OK);
+}
+
+static void test_recv(WIFI_HandleTypeDef* hwifi){
+
+	char buffer[8];
+	uint32_t received = 0;
+	uint32_t tick;
+	WIFI_CmdStatsTypeDef* stats = &hwifi->stats.cmd[WIFI_CMD_CLASS_R0];
+	uint32_t count = stats->count;
+	uint32_t errors = stats->errors;
+
+	start();
+	TEST_CHECK(WIFI_SocketOpen(hwifi, WIFI_TCP_SOCKET, WIFI_SOCKET_CLIENT) == WIFI_OK);
+
+	// The odd last byte of the payload is moved from the tail into the buffer
+	memset(buffer, 0, sizeof(buffer));
+	TEST_CHECK(WIFI_Recv(hwifi, buffer, 5, 1000, &received) == WIFI_OK);
+	TEST_CHECK(received == 5 && !memcmp(buffer, "hello", 5));
+	TEST_CHECK(stats->count == count + 1 && stats->errors == errors);
+	TEST_CHECK(stats->bytesRx >= 2 + 5 + sizeof(WIFI_MSG_READ_END) - 1);
+	TEST_CHECK(hwifi->power.lastActivity != 0);
+
+	// A payload longer than the read packet size is refused
+	start();
+	TEST_CHECK(WIFI_Recv(hwifi, buffer, 4, 1000, &received) == WIFI_ERROR);
+	TEST_CHECK(received == 0);
+	TEST_CHECK(stats->errors == errors + 1);
+
+	// A dozing module is woken for the read
+	start();
+	hwifi->power.state = WIFI_POWER_DOZING;
+	TEST_CHECK(WIFI_Recv(hwifi, buffer, 5, 1000, &received) == WIFI_OK);
+	TEST_CHECK(received == 5);
+	TEST_CHECK(hwifi->power.state == WIFI_POWER_AWAKE);
+
+	// A timeout beyond WIFI_TIMEOUT_TIME is split into reads the driver waits for, and is not overrun
+	start();
+	slowReads = 1;
+	maxReadTimeout = 0;
+	tick = HAL_GetTick();
+	TEST_CHECK(WIFI_Recv(hwifi, buffer, 5, 12000, &received) == WIFI_OK);
+	tick = HAL_GetTick() - tick;
+	TEST_CHECK(received == 0);
+	TEST_CHECK(maxReadTimeout > 0 && maxReadTimeout <= WIFI_MAX_READ_TIMEOUT);
+	TEST_CHECK(tick >= 12000 && tick < 12000 + 200);
+	TEST_CHECK(stats->errors == errors + 1);
+
+	TEST_CHECK(WIFI_TCPClose(hwifi) == WIFI_OK);
+}
+
+static void test_tcp_connect(WIFI_HandleTypeDef* hwifi){
+
+	// Without a host nothing is sent
+	start();
+	TEST_CHECK(WIFI_TCPConnect(hwifi, NULL, 8080) == WIFI_ERROR);
+	TEST_CHECK(WIFI_TCPConnect(hwifi, "", 8080) == WIFI_ERROR);
+	TEST_CHECK(commandCount == 0);
+
+	// An incomplete address is looked up, and no address is returned
+	start();
+	TEST_CHECK(WIFI_TCPConnect(hwifi, "1.2", 8080) == WIFI_ERROR);
+	TEST_CHECK(sent("D0=1.2") && commandCount == 1);
+	TEST_CHECK(!WIFI_IS_SOCKET_OPEN(hwifi, WIFI_TCP_SOCKET));
+
+	start();
+	TEST_CHECK(WIFI_TCPConnect(hwifi, "10.0.0.1", 8080) == WIFI_OK);
+	TEST_CHECK(!sent("D0=10.0.0.1") && sent("P3=10.0.0.1") && sent("P4=8080"));
+	TEST_CHECK(WIFI_TCPClose(hwifi) == WIFI_OK);
+
+	start();
+	TEST_CHECK(WIFI_TCPConnect(hwifi, "collector.local", 8080) == WIFI_OK);
+	TEST_CHECK(sent("D0=collector.local") && sent("P3=192.168.1.20"));
+	TEST_CHECK(WIFI_TCPClose(hwifi) == WIFI_OK);
+}
+
+
+int main(void){
+
+	static WIFI_HandleTypeDef hwifi;
+
+	hwifi.handle = &hspi3;
+
+	test_open(&hwifi);
+	test_double_close(&hwifi);
+	test_use_after_close(&hwifi);
+	test_close_all_reopen(&hwifi);
+	test_close_error(&hwifi);
+	test_receive_packet_size(&hwifi);
+	test_receive_binary(&hwifi);
+	test_recv(&hwifi);
+	test_tcp_connect(&hwifi);
+
+	return TEST_RESULT("test_socket");
+}
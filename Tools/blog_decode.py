@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""Decodes the binary log written by binlog.c.
+
+The console stream is read from a file or a serial port dump and printed as
+text. Plain printf output is passed through. A record starts with 0x00, then
+the word count, then the little endian words (header, tick, arguments). The
+format string is looked up in the .blog_fmt section of the firmware ELF.
+
+Usage: blog_decode.py firmware.elf [capture.bin]
+"""
+
+import re
+import struct
+import sys
+
+FRAME_MARKER = 0x00
+FORMAT_SPEC = re.compile(r"%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|z|t)?([diuxXcsp%])")
+
+
+def read_sections(path):
+    """Returns {name: (address, data)} of all sections of an ELF32 file."""
+    with open(path, "rb") as f:
+        elf = f.read()
+
+    if elf[:4] != b"\x7fELF" or elf[4] != 1:
+        sys.exit("%s is not an ELF32 file" % path)
+
+    shoff, = struct.unpack_from("<I", elf, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x2E)
+
+    headers = [struct.unpack_from("<IIIIIIIIII", elf, shoff + i * shentsize) for i in range(shnum)]
+    names = headers[shstrndx]
+
+    sections = {}
+    for name, stype, _, addr, offset, size, _, _, _, _ in headers:
+        end = elf.index(b"\0", names[4] + name)
+        # SHT_NOBITS sections have no data in the file
+        data = b"" if stype == 8 else elf[offset:offset + size]
+        sections[elf[names[4] + name:end].decode()] = (addr, data)
+
+    return sections
+
+
+def c_string(data, offset):
+    end = data.find(b"\0", offset)
+    return data[offset:end if end >= 0 else len(data)].decode(errors="replace")
+
+
+def resolve_string(sections, address):
+    """Looks up %s arguments that point to constant strings in flash."""
+    for name, (base, data) in sections.items():
+        if base and base <= address < base + len(data) and name in (".rodata", ".text"):
+            return c_string(data, address - base)
+    return "<0x%08x>" % address
+
+
+def format_record(formats, sections, words):
+    header, tick, args = words[0], words[1], list(words[2:])
+    fmt = c_string(formats, header & 0x00FFFFFF)
+
+    def substitute(match):
+        flags, conv = match.group(1), match.group(2)
+        if conv == "%":
+            return "%"
+        value = args.pop(0) if args else 0
+        if conv in "di":
+            value = value - (1 << 32) if value & 0x80000000 else value
+            conv = "d"
+        elif conv == "u":
+            conv = "d"
+        elif conv == "p":
+            return "0x%08x" % value
+        elif conv == "s":
+            value = resolve_string(sections, value)
+        elif conv == "c":
+            value = chr(value & 0xFF)
+        return ("%" + flags + conv) % value
+
+    return "[%10u] %s" % (tick, FORMAT_SPEC.sub(substitute, fmt))
+
+
+def decode(stream, formats, sections, out):
+    i = 0
+    while i < len(stream):
+        if stream[i] != FRAME_MARKER:
+            out.write(chr(stream[i]))
+            i += 1
+            continue
+
+        if i + 2 > len(stream):
+            break
+        count = stream[i + 1]
+        end = i + 2 + 4 * count
+        if count < 2 or end > len(stream):
+            break
+
+        words = struct.unpack_from("<%dI" % count, stream, i + 2)
+        out.write(format_record(formats, sections, words) + "\n")
+        i = end
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit(__doc__)
+
+    sections = read_sections(sys.argv[1])
+    if ".blog_fmt" not in sections:
+        sys.exit("%s has no .blog_fmt section" % sys.argv[1])
+
+    if len(sys.argv) == 3:
+        with open(sys.argv[2], "rb") as f:
+            stream = f.read()
+    else:
+        stream = sys.stdin.buffer.read()
+
+    decode(stream, sections[".blog_fmt"][1], sections, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Reports the static RAM of a firmware build.
+
+Prints the size of the RAM sections (.data, .bss and the reserved heap and
+stack) and the largest objects in them, read from the symbol table of the
+ELF. Build every footprint profile (WIFI_FOOTPRINT) and compare the reports.
+
+Usage: ram_report.py firmware.elf [number of objects]
+"""
+
+import struct
+import sys
+
+RAM_SECTIONS = (".data", ".bss", "._user_heap_stack")
+STT_OBJECT = 1
+
+
+def read_elf(path):
+    """Returns the sections as {name: (index, size)} and the object symbols."""
+    with open(path, "rb") as f:
+        elf = f.read()
+
+    if elf[:4] != b"\x7fELF" or elf[4] != 1:
+        sys.exit("%s is not an ELF32 file" % path)
+
+    shoff, = struct.unpack_from("<I", elf, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x2E)
+    headers = [struct.unpack_from("<IIIIIIIIII", elf, shoff + i * shentsize) for i in range(shnum)]
+
+    def name(table, offset):
+        start = headers[table][4] + offset
+        return elf[start:elf.index(b"\0", start)].decode()
+
+    sections = {name(shstrndx, h[0]): (i, h[5]) for i, h in enumerate(headers)}
+
+    symbols = []
+    for symtab in (h for h in headers if h[1] == 2):  # SHT_SYMTAB
+        strtab = symtab[6]  # sh_link
+        for offset in range(symtab[4], symtab[4] + symtab[5], 16):
+            st_name, _, st_size, st_info, _, st_shndx = struct.unpack_from("<IIIBBH", elf, offset)
+            if st_info & 0xF == STT_OBJECT and st_size:
+                symbols.append((name(strtab, st_name), st_size, st_shndx))
+
+    return sections, symbols
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+
+    sections, symbols = read_elf(sys.argv[1])
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 20
+
+    total = 0
+    for section in RAM_SECTIONS:
+        if section in sections:
+            print("%-20s %8d" % (section, sections[section][1]))
+            total += sections[section][1]
+    print("%-20s %8d\n" % ("total", total))
+
+    indices = {sections[s][0]: s for s in RAM_SECTIONS if s in sections}
+    objects = sorted((s for s in symbols if s[2] in indices), key=lambda s: -s[1])
+    for symbol, size, index in objects[:count]:
+        print("%-32s %6d  %s" % (symbol, size, indices[index]))
+
+
+if __name__ == "__main__":
+    main()
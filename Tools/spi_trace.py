@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+"""Analyses an SPI trace dumped by spi_trace.c.
+
+The trace is read from a console capture or from the /trace HTTP route. Each
+record line is "<cycles> <T|R> <length> <hex bytes>", the header line holds
+the core clock. Commands are paired with the following response and printed
+with their latency, followed by a summary per command. With --script the
+pairs are written as JSON (command, response and the delay before the
+response), so a captured session can be replayed on the scripted module of
+the host tests (Tests/host/host_replay.c). The recorder keeps only the first
+SPI_TRACE_MAX_PAYLOAD bytes of a frame, exchanges with a truncated frame are
+marked as not replayable.
+
+Usage: spi_trace.py [--script out.json] [trace.txt]
+"""
+
+import json
+import re
+import sys
+
+HEADER = re.compile(r"# spi trace (\d+) Hz, (\d+) overwritten")
+RECORD = re.compile(r"^(\d+) ([TR]) (\d+) ([0-9a-f]*)$")
+TX_PADDING = 0x0A
+RX_PADDING = 0x15
+
+
+def read_trace(lines):
+    """Returns the core clock, the overwritten count and the records."""
+    clock, overwritten, records = None, 0, []
+
+    for line in lines:
+        line = line.strip()
+        match = HEADER.search(line)
+        if match:
+            # A new dump starts, only the last one is used
+            clock, overwritten, records = int(match.group(1)), int(match.group(2)), []
+            continue
+        match = RECORD.match(line)
+        if match and clock is not None:
+            records.append((int(match.group(1)), match.group(2), int(match.group(3)), bytes.fromhex(match.group(4))))
+
+    if clock is None:
+        sys.exit("no spi trace found")
+
+    return clock, overwritten, records
+
+
+def text(data, padding):
+    # Latin-1 maps every byte to one character, so binary payloads survive the JSON
+    return data.rstrip(bytes([padding])).decode("latin-1")
+
+
+def pair(clock, records):
+    """Pairs each command with the frames received up to the next command,
+    the latency is in us."""
+    pairs, command, response = [], None, None
+
+    def close():
+        if command is None or response is None:
+            return
+        # The cycle counter wraps after 2^32 cycles
+        delay = ((response["timestamp"] - command[0]) & 0xFFFFFFFF) * 1e6 / clock
+        pairs.append({
+            "command": text(command[2], TX_PADDING),
+            "commandLength": command[1],
+            "response": text(response["data"], RX_PADDING),
+            "responseLength": response["length"],
+            "delayUs": round(delay, 1),
+            "replayable": len(command[2]) == command[1] and not response["truncated"],
+        })
+
+    for timestamp, direction, length, data in records:
+        if direction == "T":
+            close()
+            command, response = (timestamp, length, data), None
+        elif command is not None:
+            # A response may be read in several frames, e.g. a scan in blocks
+            if response is None:
+                response = {"timestamp": timestamp, "length": 0, "data": b"", "truncated": False}
+            response["length"] += length
+            response["data"] += data
+            response["truncated"] |= len(data) < length
+    close()
+
+    return pairs
+
+
+def main():
+    args = sys.argv[1:]
+    script = None
+    if len(args) >= 2 and args[0] == "--script":
+        script = args[1]
+        args = args[2:]
+
+    with open(args[0], errors="replace") if args else sys.stdin as f:
+        clock, overwritten, records = read_trace(f)
+
+    pairs = pair(clock, records)
+
+    if overwritten:
+        print("%d records were overwritten before the dump" % overwritten)
+    truncated = sum(1 for p in pairs if not p["replayable"])
+    if truncated:
+        print("%d exchanges were truncated by the recorder and are not replayable,"
+              " increase SPI_TRACE_MAX_PAYLOAD" % truncated)
+
+    summary = {}
+    for p in pairs:
+        print("%10.1f us  %-24r -> %r" % (p["delayUs"], p["command"][:24], p["response"][:40]))
+        name = re.match(r"[A-Z\$][A-Z0-9]?", p["command"])
+        delays = summary.setdefault(name.group(0) if name else "?", [])
+        delays.append(p["delayUs"])
+
+    print("\n%-8s %6s %10s %10s %10s" % ("command", "count", "min", "mean", "max"))
+    for name, delays in sorted(summary.items()):
+        print("%-8s %6d %10.1f %10.1f %10.1f" % (name, len(delays), min(delays), sum(delays) / len(delays), max(delays)))
+
+    if script:
+        with open(script, "w") as f:
+            json.dump({"clock": clock, "exchanges": pairs}, f, indent=1)
+
+
+if __name__ == "__main__":
+    main()